@@ -0,0 +1,854 @@
+#include "aabb.hpp"
+#include "arena.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "compressed_bvh.hpp"
+#include "hittable_list.hpp"
+#include "framebuffer.hpp"
+#include "perlin.hpp"
+#include "quad.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "sphere.hpp"
+#include "texture.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+// windows.h must come first.
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// Micro and scene benchmarks for tracking performance across versions.
+// Results are written as JSON to stdout (or --output), progress to stderr.
+// --convergence adds the RMSE of every sampler at 1, 4, 16 and 64 samples per
+// pixel against an independent reference render. --no-arena builds the
+// scenes with one heap allocation per object instead of in a SceneArena.
+// --bvh-memory compares the memory, build time and ray cost of BVHNode and
+// CompressedBVH over up to a million spheres. --ray-order renders the
+// diffuse-heavy scenes in every TraceOrder and reports their ray rates.
+// --time-budget S renders every scene within S seconds and reports the
+// samples per pixel reached against those predicted after the warm-up.
+//
+//   RayTraceBench [--width N] [--spp N] [--filter substring]
+//                 [--output file] [--no-scenes] [--no-micro] [--no-arena]
+//                 [--convergence] [--reference-spp N] [--bvh-memory]
+//                 [--ray-order] [--time-budget S]
+
+namespace {
+
+constexpr std::uint32_t kSeed = 42;
+constexpr double kMinimumSeconds = 0.25;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  int width = 100;
+  int samplesPerPixel = 8;
+  std::string filter;
+  std::string output;
+  bool scenes = true;
+  bool micro = true;
+  bool arena = true;
+  bool convergence = false;
+  bool bvhMemory = false;
+  bool rayOrder = false;
+  double timeBudgetSeconds = 0;
+  int referenceSamplesPerPixel = 1024;
+};
+
+// Keeps benchmark results observable so the optimizer cannot drop the work.
+volatile double gSink = 0;
+
+double elapsedSeconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+size_t peakRssKilobytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters{};
+  GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+  return counters.PeakWorkingSetSize / 1024;
+#else
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<size_t>(usage.ru_maxrss);
+#endif
+}
+
+class NullBuffer : public std::streambuf {
+protected:
+  int_type overflow(int_type character) override { return character; }
+};
+
+// Silences std::cout and std::clog (image and progress output) while alive.
+class Silence {
+public:
+  Silence()
+      : mCout{std::cout.rdbuf(&mNull)}, mClog{std::clog.rdbuf(&mNull)} {}
+  Silence(const Silence&) = delete;
+  Silence(Silence&&) = delete;
+  Silence& operator=(const Silence&) = delete;
+  Silence& operator=(Silence&&) = delete;
+  ~Silence() {
+    std::cout.rdbuf(mCout);
+    std::clog.rdbuf(mClog);
+  }
+
+private:
+  NullBuffer mNull;
+  std::streambuf* mCout;
+  std::streambuf* mClog;
+};
+
+// Counts every ray the camera traces against the scene.
+class CountingHittable : public Hittable {
+public:
+  CountingHittable(const Hittable& world) : mWorld{world} {}
+
+  bool hit(const Ray& ray, Interval rayRange,
+           HitRecord& hitInfo) const override {
+    ++mRays;
+    return mWorld.hit(ray, rayRange, hitInfo);
+  }
+
+  [[nodiscard]] AABB boundingBox() const override {
+    return mWorld.boundingBox();
+  }
+
+  [[nodiscard]] size_t rays() const { return mRays; }
+
+private:
+  const Hittable& mWorld;
+  mutable size_t mRays{0};
+};
+
+class JsonWriter {
+public:
+  void beginEntry(const std::string& kind, const std::string& name) {
+    mOut << (mEntries++ == 0 ? "\n" : ",\n") << R"(    {"kind": ")" << kind
+         << R"(", "name": ")" << name << '"';
+  }
+  void field(const std::string& key, double value) {
+    mOut << R"(, ")" << key << R"(": )" << value;
+  }
+  void endEntry() { mOut << '}'; }
+
+  [[nodiscard]] std::string finish(const Options& options) const {
+    std::ostringstream json;
+    json << "{\n"
+         << R"(  "seed": )" << kSeed << ",\n"
+         << R"(  "width": )" << options.width << ",\n"
+         << R"(  "samplesPerPixel": )" << options.samplesPerPixel << ",\n"
+         << R"(  "peakRssKb": )" << peakRssKilobytes() << ",\n"
+         << R"(  "results": [)" << mOut.str() << "\n  ]\n}\n";
+    return json.str();
+  }
+
+private:
+  std::ostringstream mOut;
+  int mEntries{0};
+};
+
+bool selected(const Options& options, const std::string& name) {
+  return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+// Runs body (which performs opsPerCall operations) until at least
+// kMinimumSeconds have passed and returns the mean cost per operation.
+double nanosecondsPerOp(size_t opsPerCall, const std::function<void()>& body,
+                        double* ops = nullptr) {
+  body(); // Warm up caches and lazy initialization.
+
+  size_t calls = 0;
+  const auto start = Clock::now();
+  do {
+    body();
+    ++calls;
+  } while (elapsedSeconds(start) < kMinimumSeconds);
+  const double seconds = elapsedSeconds(start);
+
+  const auto totalOps = static_cast<double>(calls * opsPerCall);
+  if (ops != nullptr) {
+    *ops = totalOps;
+  }
+  return seconds * 1e9 / totalOps;
+}
+
+void micro(JsonWriter& json, const Options& options, const std::string& name,
+           size_t opsPerCall, const std::function<void()>& body) {
+  if (!selected(options, name)) {
+    return;
+  }
+  double ops = 0;
+  const double nsPerOp = nanosecondsPerOp(opsPerCall, body, &ops);
+  std::cerr << name << ": " << nsPerOp << " ns/op\n";
+
+  json.beginEntry("micro", name);
+  json.field("nsPerOp", nsPerOp);
+  json.field("ops", ops);
+  json.endEntry();
+}
+
+std::vector<Ray> randomRays(size_t count, const Vec3& low, const Vec3& high) {
+  // Rays between two random points of the given box.
+  std::vector<Ray> rays;
+  rays.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    const Vec3 from = low + Vec3::random() * (high - low);
+    const Vec3 to = low + Vec3::random() * (high - low);
+    rays.emplace_back(from, to - from, utils::randomDouble());
+  }
+  return rays;
+}
+
+HittableList randomSpheres(size_t count, double extent = 100) {
+  HittableList spheres;
+  auto material = std::make_shared<Lambertian>(Color{0.5, 0.5, 0.5});
+  for (size_t i = 0; i < count; ++i) {
+    spheres.add(std::make_shared<Sphere>(Vec3::random(-extent, extent),
+                                         utils::randomDouble(0.5, 2.0),
+                                         material));
+  }
+  return spheres;
+}
+
+void runMicroBenchmarks(JsonWriter& json, const Options& options) {
+  constexpr size_t kRayCount = 4096;
+  utils::seedRandom(kSeed);
+  const auto rays = randomRays(kRayCount, Vec3{-2}, Vec3{2});
+  const auto unitRange = Interval{0.001, utils::INFINITE_DOUBLE};
+
+  const AABB box{Vec3{-1}, Vec3{1}};
+  micro(json, options, "AABB::hit", rays.size(), [&] {
+    size_t hits = 0;
+    for (const auto& ray : rays) {
+      hits += box.hit(ray, unitRange) ? 1U : 0U;
+    }
+    gSink = gSink + static_cast<double>(hits);
+  });
+
+  auto material = std::make_shared<Lambertian>(Color{0.5, 0.5, 0.5});
+  const Sphere sphere{Vec3{0}, 1.0, material};
+  micro(json, options, "Sphere::hit", rays.size(), [&] {
+    HitRecord hitInfo;
+    size_t hits = 0;
+    for (const auto& ray : rays) {
+      hits += sphere.hit(ray, unitRange, hitInfo) ? 1U : 0U;
+    }
+    gSink = gSink + static_cast<double>(hits);
+  });
+
+  const Quad quad{Vec3{-1, -1, 0}, Vec3{2, 0, 0}, Vec3{0, 2, 0}, material};
+  micro(json, options, "Quad::hit", rays.size(), [&] {
+    HitRecord hitInfo;
+    size_t hits = 0;
+    for (const auto& ray : rays) {
+      hits += quad.hit(ray, unitRange, hitInfo) ? 1U : 0U;
+    }
+    gSink = gSink + static_cast<double>(hits);
+  });
+
+  const Box rotatedBox{Vec3{-1}, Vec3{1}, material, 30, Vec3{0.1, 0, 0}};
+  micro(json, options, "Box::hit/rotated", rays.size(), [&] {
+    HitRecord hitInfo;
+    size_t hits = 0;
+    for (const auto& ray : rays) {
+      hits += rotatedBox.hit(ray, unitRange, hitInfo) ? 1U : 0U;
+    }
+    gSink = gSink + static_cast<double>(hits);
+  });
+
+  // The spheres of oneWeekendFinalScene, tested one after another, as static
+  // spheres and as moving spheres that stay in place.
+  std::vector<Sphere> staticSpheres;
+  std::vector<MovingSphere> movingSpheres;
+  auto addSphere = [&](const Vec3& center, double radius) {
+    staticSpheres.emplace_back(center, radius, material);
+    movingSpheres.emplace_back(center, center, radius, material);
+  };
+  addSphere(Vec3{0, -1000, 0}, 1000);
+  for (int a = -11; a < 11; a++) {
+    for (int b = -11; b < 11; b++) {
+      addSphere(Vec3{a + 0.9 * utils::randomDouble(), 0.2,
+                     b + 0.9 * utils::randomDouble()},
+                0.2);
+    }
+  }
+  addSphere(Vec3{0, 1, 0}, 1);
+  addSphere(Vec3{-4, 1, 0}, 1);
+  addSphere(Vec3{4, 1, 0}, 1);
+
+  std::vector<Ray> cameraRays;
+  for (size_t i = 0; i < kRayCount / 4; ++i) {
+    const Vec3 target{utils::randomDouble(-11, 11), utils::randomDouble(0, 1),
+                      utils::randomDouble(-11, 11)};
+    const Vec3 lookFrom{13, 2, 3};
+    cameraRays.emplace_back(lookFrom, target - lookFrom, utils::randomDouble());
+  }
+  auto sphereMicro = [&](const std::string& name, const auto& spheres) {
+    micro(json, options, name, cameraRays.size() * spheres.size(), [&] {
+      HitRecord hitInfo;
+      size_t hits = 0;
+      for (const auto& ray : cameraRays) {
+        Interval range = unitRange;
+        for (const auto& sphere : spheres) {
+          if (sphere.hit(ray, range, hitInfo)) {
+            range = Interval{range.min(), hitInfo.t};
+            ++hits;
+          }
+        }
+      }
+      gSink = gSink + static_cast<double>(hits);
+    });
+  };
+  sphereMicro("Sphere::hit/oneWeekendFinalScene", staticSpheres);
+  sphereMicro("MovingSphere::hit/oneWeekendFinalScene", movingSpheres);
+
+  constexpr size_t kSphereCount = 10000;
+  const auto spheres = randomSpheres(kSphereCount);
+  micro(json, options, "BVHNode::build/10k spheres", kSphereCount, [&] {
+    const BVHNode bvh{spheres};
+    gSink = gSink + bvh.boundingBox().mX.size();
+  });
+
+  const BVHNode bvh{spheres};
+  const auto sceneRays = randomRays(kRayCount, Vec3{-100}, Vec3{100});
+  micro(json, options, "BVHNode::hit/10k spheres", sceneRays.size(), [&] {
+    HitRecord hitInfo;
+    size_t hits = 0;
+    for (const auto& ray : sceneRays) {
+      hits += bvh.hit(ray, unitRange, hitInfo) ? 1U : 0U;
+    }
+    gSink = gSink + static_cast<double>(hits);
+  });
+  micro(json, options, "BVHNode::occluded/10k spheres", sceneRays.size(),
+        [&] {
+          size_t hits = 0;
+          for (const auto& ray : sceneRays) {
+            hits += bvh.occluded(ray, Interval{0.001, 1.0}) ? 1U : 0U;
+          }
+          gSink = gSink + static_cast<double>(hits);
+        });
+
+  micro(json, options, "CompressedBVH::build/10k spheres", kSphereCount, [&] {
+    const CompressedBVH compressed{spheres};
+    gSink = gSink + compressed.boundingBox().mX.size();
+  });
+
+  const CompressedBVH compressed{spheres};
+  micro(json, options, "CompressedBVH::hit/10k spheres", sceneRays.size(),
+        [&] {
+          HitRecord hitInfo;
+          size_t hits = 0;
+          for (const auto& ray : sceneRays) {
+            hits += compressed.hit(ray, unitRange, hitInfo) ? 1U : 0U;
+          }
+          gSink = gSink + static_cast<double>(hits);
+        });
+  micro(json, options, "CompressedBVH::occluded/10k spheres",
+        sceneRays.size(), [&] {
+          size_t hits = 0;
+          for (const auto& ray : sceneRays) {
+            hits += compressed.occluded(ray, Interval{0.001, 1.0}) ? 1U : 0U;
+          }
+          gSink = gSink + static_cast<double>(hits);
+        });
+
+  constexpr size_t kPointCount = 4096;
+  std::vector<Vec3> points;
+  std::vector<Vec2<double>> uvs;
+  for (size_t i = 0; i < kPointCount; ++i) {
+    points.push_back(Vec3::random(-50, 50));
+    uvs.emplace_back(utils::randomDouble(), utils::randomDouble());
+  }
+
+  const Perlin perlin;
+  micro(json, options, "Perlin::turbulence/7", points.size(), [&] {
+    double sum = 0;
+    for (const auto& point : points) {
+      sum += perlin.turbulence(point, 7);
+    }
+    gSink = gSink + sum;
+  });
+
+  // Same points through the texture, evaluated directly and from a grid
+  // baked over their bounds.
+  NoiseTexture noise{4};
+  auto noiseMicro = [&](const std::string& name) {
+    micro(json, options, name, points.size(), [&] {
+      double sum = 0;
+      for (const auto& point : points) {
+        sum += noise.value({}, point).x();
+      }
+      gSink = gSink + sum;
+    });
+  };
+  noiseMicro("NoiseTexture::value");
+  noise.bake(AABB{Vec3{-50}, Vec3{50}}, 64);
+  noiseMicro("NoiseTexture::value/baked 64^3");
+
+  const ImageTexture earth{"earthmap.jpg"};
+  micro(json, options, "ImageTexture::value", uvs.size(), [&] {
+    double sum = 0;
+    for (size_t i = 0; i < uvs.size(); ++i) {
+      sum += earth.value(uvs[i], points[i]).x();
+    }
+    gSink = gSink + sum;
+  });
+
+  // A checker of checkers of solid colours, as a tree and compiled.
+  const CheckerTexture checker{
+      4.0,
+      std::make_shared<CheckerTexture>(0.5, Color{0.2, 0.3, 0.1}, Color{1}),
+      std::make_shared<CheckerTexture>(0.7, Color{0.9}, Color{0.1})};
+  micro(json, options, "CheckerTexture::value/nested", points.size(), [&] {
+    double sum = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+      sum += checker.value(uvs[i], points[i]).x();
+    }
+    gSink = gSink + sum;
+  });
+
+  const TextureProgram program{checker};
+  std::vector<TextureProgram::Lookup> lookups;
+  for (size_t i = 0; i < kPointCount; ++i) {
+    lookups.push_back({uvs[i], points[i]});
+  }
+  std::vector<Color> colors(kPointCount);
+  micro(json, options, "TextureProgram::values/nested checker", lookups.size(),
+        [&] {
+          program.values(lookups, colors);
+          gSink = gSink + colors.back().x();
+        });
+}
+
+// Declared first, the arena outlives the lists that point into it.
+struct BuiltScene {
+  SceneArena arena;
+  HittableList world;
+  HittableList lights;
+};
+
+void runSceneBenchmarks(JsonWriter& json, const Options& options) {
+  for (const auto& entry : scene::all()) {
+    if (!selected(options, entry.name)) {
+      continue;
+    }
+
+    utils::seedRandom(kSeed);
+    auto built = std::make_unique<BuiltScene>();
+    HittableList& world = built->world;
+    HittableList& lights = built->lights;
+    Camera cam;
+    const auto buildStart = Clock::now();
+    if (options.arena) {
+      const SceneArena::Scope scope{built->arena};
+      entry.build(world, lights, cam);
+    } else {
+      entry.build(world, lights, cam);
+    }
+    const double buildMs = elapsedSeconds(buildStart) * 1e3;
+
+    cam.mImageWidth = options.width;
+    cam.mSamplesPerPixel = options.samplesPerPixel;
+
+    CountingHittable counted{world};
+    const auto renderStart = Clock::now();
+    {
+      const Silence silence;
+      if (lights.empty()) {
+        cam.render(counted);
+      } else {
+        cam.render(counted, lights);
+      }
+    }
+    const double renderSeconds = elapsedSeconds(renderStart);
+    const double megaRaysPerSecond =
+        static_cast<double>(counted.rays()) / renderSeconds / 1e6;
+    const auto peakRss = static_cast<double>(peakRssKilobytes());
+
+    const auto teardownStart = Clock::now();
+    built.reset();
+    const double teardownMs = elapsedSeconds(teardownStart) * 1e3;
+
+    std::cerr << entry.name << ": build " << buildMs << " ms, render "
+              << renderSeconds << " s, " << megaRaysPerSecond
+              << " Mrays/s, teardown " << teardownMs << " ms\n";
+
+    json.beginEntry("scene", entry.name);
+    json.field("buildMs", buildMs);
+    json.field("renderMs", renderSeconds * 1e3);
+    json.field("rays", static_cast<double>(counted.rays()));
+    json.field("mraysPerSecond", megaRaysPerSecond);
+    json.field("teardownMs", teardownMs);
+    json.field("peakRssKb", peakRss);
+    json.endEntry();
+  }
+}
+
+constexpr std::array<size_t, 3> kBvhMemorySphereCounts{10'000, 100'000,
+                                                       1'000'000};
+
+// Builds both BVH layouts over the same spheres, kept at the density of the
+// 10k sphere micro benchmarks, and reports what each costs. BVHNode counts
+// its nodes as allocated in an arena, without shared_ptr control blocks.
+void runBvhMemory(JsonWriter& json, const Options& options) {
+  constexpr size_t kRayCount = 4096;
+  const auto unitRange = Interval{0.001, utils::INFINITE_DOUBLE};
+  for (const size_t count : kBvhMemorySphereCounts) {
+    const std::string bvhName = "BVHNode/" + std::to_string(count) + " spheres";
+    const std::string compressedName =
+        "CompressedBVH/" + std::to_string(count) + " spheres";
+    if (!selected(options, bvhName) && !selected(options, compressedName)) {
+      continue;
+    }
+
+    utils::seedRandom(kSeed);
+    const double extent =
+        100 * std::cbrt(static_cast<double>(count) / 10'000.0);
+    const auto spheres = randomSpheres(count, extent);
+    const auto rays = randomRays(kRayCount, Vec3{-extent}, Vec3{extent});
+
+    auto report = [&](const std::string& name, const Hittable& bvh,
+                      double buildMs, size_t nodes, size_t bytes) {
+      const double hitNs = nanosecondsPerOp(rays.size(), [&] {
+        HitRecord hitInfo;
+        size_t hits = 0;
+        for (const auto& ray : rays) {
+          hits += bvh.hit(ray, unitRange, hitInfo) ? 1U : 0U;
+        }
+        gSink = gSink + static_cast<double>(hits);
+      });
+      const double occludedNs = nanosecondsPerOp(rays.size(), [&] {
+        size_t hits = 0;
+        for (const auto& ray : rays) {
+          hits += bvh.occluded(ray, Interval{0.001, 1.0}) ? 1U : 0U;
+        }
+        gSink = gSink + static_cast<double>(hits);
+      });
+      const double bytesPerObject =
+          static_cast<double>(bytes) / static_cast<double>(count);
+
+      std::cerr << name << ": " << bytes / 1024 << " KiB ("
+                << bytesPerObject << " bytes/object), build " << buildMs
+                << " ms, hit " << hitNs << " ns, occluded " << occludedNs
+                << " ns\n";
+
+      json.beginEntry("bvhMemory", name);
+      json.field("nodes", static_cast<double>(nodes));
+      json.field("bytes", static_cast<double>(bytes));
+      json.field("bytesPerObject", bytesPerObject);
+      json.field("buildMs", buildMs);
+      json.field("hitNs", hitNs);
+      json.field("occludedNs", occludedNs);
+      json.endEntry();
+    };
+
+    {
+      SceneArena arena;
+      const SceneArena::Scope scope{arena};
+      const auto buildStart = Clock::now();
+      const BVHNode bvh{spheres};
+      const double buildMs = elapsedSeconds(buildStart) * 1e3;
+      report(bvhName, bvh, buildMs, bvh.nodeCount(),
+             bvh.nodeCount() * sizeof(BVHNode));
+    }
+    {
+      const auto buildStart = Clock::now();
+      const CompressedBVH bvh{spheres};
+      const double buildMs = elapsedSeconds(buildStart) * 1e3;
+      report(compressedName, bvh, buildMs, bvh.nodeCount(),
+             bvh.memoryBytes());
+    }
+  }
+}
+
+struct TraceOrderEntry {
+  const char* name;
+  TraceOrder order;
+};
+
+constexpr std::array<TraceOrderEntry, 3> kTraceOrders{{
+    {"depthFirst", TraceOrder::DepthFirst},
+    {"batched", TraceOrder::Batched},
+    {"sortedBatches", TraceOrder::SortedBatches},
+}};
+
+constexpr std::array<std::string_view, 3> kRayOrderScenes{
+    "cornellBox", "oneWeekendFinalScene", "secondBookFinalScene"};
+constexpr int kRayOrderRepeats = 3;
+
+// Renders each scene in every trace order, interleaved and repeated, and
+// reports the fastest render of each against depth first.
+void runRayOrder(JsonWriter& json, const Options& options) {
+  for (const auto& entry : scene::all()) {
+    if (!selected(options, entry.name) ||
+        std::find(kRayOrderScenes.begin(), kRayOrderScenes.end(),
+                  entry.name) == kRayOrderScenes.end()) {
+      continue;
+    }
+
+    utils::seedRandom(kSeed);
+    BuiltScene built;
+    Camera cam;
+    {
+      const SceneArena::Scope scope{built.arena};
+      entry.build(built.world, built.lights, cam);
+    }
+    cam.mImageWidth = options.width;
+    cam.mSamplesPerPixel = options.samplesPerPixel;
+    const Tile image{0, 0, cam.mImageWidth, cam.imageHeight()};
+
+    std::array<double, kTraceOrders.size()> bestSeconds{};
+    std::array<size_t, kTraceOrders.size()> rays{};
+    bestSeconds.fill(utils::INFINITE_DOUBLE);
+    for (int repeat = 0; repeat < kRayOrderRepeats; ++repeat) {
+      for (size_t i = 0; i < kTraceOrders.size(); ++i) {
+        cam.mTraceOrder = kTraceOrders[i].order;
+        CountingHittable counted{built.world};
+        const auto renderStart = Clock::now();
+        const FrameBuffer result =
+            built.lights.empty() ? cam.renderTile(counted, image)
+                                 : cam.renderTile(counted, built.lights, image);
+        bestSeconds[i] = std::fmin(bestSeconds[i], elapsedSeconds(renderStart));
+        rays[i] = counted.rays();
+        gSink = gSink + result.data()[0];
+      }
+    }
+
+    for (size_t i = 0; i < kTraceOrders.size(); ++i) {
+      const double megaRaysPerSecond =
+          static_cast<double>(rays[i]) / bestSeconds[i] / 1e6;
+      const double speedup = bestSeconds[0] / bestSeconds[i];
+      std::cerr << entry.name << ": " << kTraceOrders[i].name << " "
+                << megaRaysPerSecond << " Mrays/s, " << speedup
+                << "x depth first\n";
+
+      json.beginEntry("rayOrder", entry.name + "/" + kTraceOrders[i].name);
+      json.field("renderMs", bestSeconds[i] * 1e3);
+      json.field("rays", static_cast<double>(rays[i]));
+      json.field("mraysPerSecond", megaRaysPerSecond);
+      json.field("speedup", speedup);
+      json.endEntry();
+    }
+  }
+}
+
+// Caps the samples per pixel of the time-budgeted renders well above what
+// any budget reaches.
+constexpr int kBudgetSamplesPerPixelCap = 1 << 20;
+
+void runTimeBudget(JsonWriter& json, const Options& options) {
+  for (const auto& entry : scene::all()) {
+    if (!selected(options, entry.name)) {
+      continue;
+    }
+
+    utils::seedRandom(kSeed);
+    BuiltScene built;
+    Camera cam;
+    {
+      const SceneArena::Scope scope{built.arena};
+      entry.build(built.world, built.lights, cam);
+    }
+    cam.mImageWidth = options.width;
+    cam.mSamplesPerPixel = kBudgetSamplesPerPixelCap;
+    cam.mTimeBudgetSeconds = options.timeBudgetSeconds;
+    {
+      const Silence silence;
+      if (built.lights.empty()) {
+        cam.render(built.world);
+      } else {
+        cam.render(built.world, built.lights);
+      }
+    }
+
+    const Camera::BudgetReport& report = cam.budgetReport();
+    const double accuracy =
+        report.samplesPerPixel / report.predictedSamplesPerPixel;
+    std::cerr << entry.name << ": " << report.samplesPerPixel
+              << " spp in " << report.elapsedSeconds << " s, "
+              << report.predictedSamplesPerPixel << " predicted\n";
+
+    json.beginEntry("timeBudget", entry.name);
+    json.field("budgetSeconds", report.budgetSeconds);
+    json.field("elapsedSeconds", report.elapsedSeconds);
+    json.field("samplesPerPixel", report.samplesPerPixel);
+    json.field("minSamplesPerPixel", report.minSamplesPerPixel);
+    json.field("predictedSamplesPerPixel", report.predictedSamplesPerPixel);
+    json.field("predictionAccuracy", accuracy);
+    json.field("passes", report.passes);
+    json.endEntry();
+  }
+}
+
+struct SamplerEntry {
+  const char* name;
+  SamplerType type;
+};
+
+constexpr std::array<SamplerEntry, 4> kSamplers{{
+    {"independent", SamplerType::Independent},
+    {"stratified", SamplerType::Stratified},
+    {"sobol", SamplerType::Sobol},
+    {"blueNoise", SamplerType::BlueNoise},
+}};
+
+constexpr std::array<int, 4> kConvergenceSamplesPerPixel{1, 4, 16, 64};
+
+FrameBuffer renderImage(const scene::Entry& entry, const Options& options,
+                        int samplesPerPixel, SamplerType sampler,
+                        std::uint32_t seed) {
+  utils::seedRandom(kSeed);
+  HittableList world;
+  HittableList lights;
+  Camera cam;
+  entry.build(world, lights, cam);
+  cam.mImageWidth = options.width;
+  cam.mSamplesPerPixel = samplesPerPixel;
+  cam.mSamplerType = sampler;
+  cam.mSeed = seed;
+
+  const Tile image{0, 0, cam.mImageWidth, cam.imageHeight()};
+  const Silence silence;
+  return lights.empty() ? cam.renderTile(world, image)
+                        : cam.renderTile(world, lights, image);
+}
+
+// Root mean square error of the displayed values: gamma corrected and
+// clamped, so fireflies count no more than a white pixel.
+double displayError(const FrameBuffer& image, const FrameBuffer& reference) {
+  auto display = [](float value) {
+    return std::fmin(1.0, color::linearToGamma(value));
+  };
+  double sum = 0;
+  for (size_t i = 0; i < image.size(); ++i) {
+    const double difference =
+        display(image.data()[i]) - display(reference.data()[i]);
+    sum += difference * difference;
+  }
+  return std::sqrt(sum / static_cast<double>(image.size()));
+}
+
+void runConvergence(JsonWriter& json, const Options& options) {
+  for (const auto& entry : scene::all()) {
+    if (!selected(options, entry.name)) {
+      continue;
+    }
+
+    // A different seed keeps the reference's noise independent of the
+    // images compared against it.
+    const FrameBuffer reference =
+        renderImage(entry, options, options.referenceSamplesPerPixel,
+                    SamplerType::Independent, kSeed + 1);
+    for (const auto& sampler : kSamplers) {
+      for (const int samplesPerPixel : kConvergenceSamplesPerPixel) {
+        const auto renderStart = Clock::now();
+        const FrameBuffer image = renderImage(entry, options, samplesPerPixel,
+                                              sampler.type, kSeed);
+        const double renderMs = elapsedSeconds(renderStart) * 1e3;
+        const double error = displayError(image, reference);
+
+        std::cerr << entry.name << ": " << sampler.name << " at "
+                  << samplesPerPixel << " spp, RMSE " << error << '\n';
+
+        json.beginEntry("convergence",
+                        entry.name + "/" + sampler.name);
+        json.field("samplesPerPixel", samplesPerPixel);
+        json.field("rmse", error);
+        json.field("renderMs", renderMs);
+        json.endEntry();
+      }
+    }
+  }
+}
+
+Options parseOptions(int argc, char** argv) {
+  Options options;
+  const std::vector<std::string> args(argv + 1, argv + argc);
+  for (size_t i = 0; i < args.size(); ++i) {
+    const bool hasValue = i + 1 < args.size();
+    if (args[i] == "--width" && hasValue) {
+      options.width = std::stoi(args[++i]);
+    } else if (args[i] == "--spp" && hasValue) {
+      options.samplesPerPixel = std::stoi(args[++i]);
+    } else if (args[i] == "--filter" && hasValue) {
+      options.filter = args[++i];
+    } else if (args[i] == "--output" && hasValue) {
+      options.output = args[++i];
+    } else if (args[i] == "--no-scenes") {
+      options.scenes = false;
+    } else if (args[i] == "--no-micro") {
+      options.micro = false;
+    } else if (args[i] == "--no-arena") {
+      options.arena = false;
+    } else if (args[i] == "--convergence") {
+      options.convergence = true;
+    } else if (args[i] == "--bvh-memory") {
+      options.bvhMemory = true;
+    } else if (args[i] == "--ray-order") {
+      options.rayOrder = true;
+    } else if (args[i] == "--time-budget" && hasValue) {
+      options.timeBudgetSeconds = std::stod(args[++i]);
+    } else if (args[i] == "--reference-spp" && hasValue) {
+      options.referenceSamplesPerPixel = std::stoi(args[++i]);
+    } else {
+      std::cerr << "Unknown argument '" << args[i] << "'.\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const auto options = parseOptions(argc, argv);
+  JsonWriter json;
+
+  if (options.micro) {
+    runMicroBenchmarks(json, options);
+  }
+  if (options.scenes) {
+    runSceneBenchmarks(json, options);
+  }
+  if (options.convergence) {
+    runConvergence(json, options);
+  }
+  if (options.bvhMemory) {
+    runBvhMemory(json, options);
+  }
+  if (options.rayOrder) {
+    runRayOrder(json, options);
+  }
+  if (options.timeBudgetSeconds > 0) {
+    runTimeBudget(json, options);
+  }
+
+  const auto report = json.finish(options);
+  if (options.output.empty()) {
+    std::cout << report;
+  } else {
+    std::ofstream{options.output} << report;
+  }
+}
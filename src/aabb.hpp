@@ -2,6 +2,7 @@
 
 #include "interval.hpp"
 #include "ray.hpp"
+#include "stats.hpp"
 #include "vec3.hpp"
 struct AxisAlignedBoundingBox {
   Interval mX, mY, mZ;
@@ -42,6 +43,14 @@ struct AxisAlignedBoundingBox {
   }
 
   [[nodiscard]] bool hit(const Ray& incoming, Interval rayT) const {
+    Interval span;
+    return hitSpan(incoming, rayT, span);
+  }
+
+  // Slab test that also reports the part of rayT inside the box.
+  [[nodiscard]] bool hitSpan(const Ray& incoming, Interval rayT,
+                             Interval& span) const {
+    stats::add(stats::Counter::BoxTests);
     const Vec3& rayOrigin = incoming.origin();
     const Vec3& rayDirection = incoming.direction();
 
@@ -68,6 +77,7 @@ struct AxisAlignedBoundingBox {
         return false;
       }
     }
+    span = Interval{lowerT, upperT};
     return true;
   }
 
@@ -77,6 +87,26 @@ struct AxisAlignedBoundingBox {
     }
     return mY.size() > mZ.size() ? 1 : 2;
   }
+
+  // Box whose bounds move linearly from start at time 0 to end at time 1.
+  [[nodiscard]] static AxisAlignedBoundingBox
+  interpolate(const AxisAlignedBoundingBox& start,
+              const AxisAlignedBoundingBox& end, double time) {
+    auto lerp = [time](const Interval& a, const Interval& b) {
+      return Interval{a.min() + time * (b.min() - a.min()),
+                      a.max() + time * (b.max() - a.max())};
+    };
+    AxisAlignedBoundingBox box;
+    box.mX = lerp(start.mX, end.mX);
+    box.mY = lerp(start.mY, end.mY);
+    box.mZ = lerp(start.mZ, end.mZ);
+    return box;
+  }
+
+  [[nodiscard]] double surfaceArea() const {
+    return 2.0 * (mX.size() * mY.size() + mY.size() * mZ.size() +
+                  mZ.size() * mX.size());
+  }
   static const AxisAlignedBoundingBox empty, universe;
 
 private:
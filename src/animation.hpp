@@ -0,0 +1,238 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "utils.hpp"
+#include "vec3.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Pose of an animated object at a point in time: a rotation about the y axis
+// in degrees, then a translation.
+struct Keyframe {
+  double time{};
+  Vec3 translation;
+  double rotationY{};
+};
+
+// Object moved through a list of keyframes, interpolating linearly between
+// them and holding the first and last pose outside their range. The pose
+// changes only through setTime(), so it stays fixed for all rays of a frame.
+class Keyframed : public Hittable {
+public:
+  Keyframed(std::shared_ptr<Hittable> object, std::vector<Keyframe> keyframes)
+      : mObject{std::move(object)}, mKeyframes{std::move(keyframes)},
+        mObjectBox{mObject->boundingBox()} {
+    std::sort(mKeyframes.begin(), mKeyframes.end(),
+              [](const Keyframe& a, const Keyframe& b) {
+                return a.time < b.time;
+              });
+    setTime(mKeyframes.empty() ? 0.0 : mKeyframes.front().time);
+  }
+
+  void setTime(double time) {
+    const Keyframe pose = poseAt(time);
+    const double radians = utils::toRadians(pose.rotationY);
+    mSinTheta = std::sin(radians);
+    mCosTheta = std::cos(radians);
+    mTranslation = pose.translation;
+
+    Vec3 min{utils::INFINITE_DOUBLE};
+    Vec3 max{-utils::INFINITE_DOUBLE};
+    for (int corner = 0; corner < 8; ++corner) {
+      const Vec3 point = toWorld(
+          Vec3{(corner & 1) != 0 ? mObjectBox.mX.max() : mObjectBox.mX.min(),
+               (corner & 2) != 0 ? mObjectBox.mY.max() : mObjectBox.mY.min(),
+               (corner & 4) != 0 ? mObjectBox.mZ.max() : mObjectBox.mZ.min()});
+      for (size_t axis = 0; axis < 3; ++axis) {
+        min[axis] = std::fmin(min[axis], point[axis]);
+        max[axis] = std::fmax(max[axis], point[axis]);
+      }
+    }
+    mBoundingBox = AABB{min + mTranslation, max + mTranslation};
+  }
+
+  bool hit(const Ray& ray, Interval rayRange,
+           HitRecord& hitInfo) const override {
+    if (!mObject->hit(toObject(ray), rayRange, hitInfo)) {
+      return false;
+    }
+    hitInfo.position = toWorld(hitInfo.position) + mTranslation;
+    hitInfo.setFaceNormal(ray, toWorld(hitInfo.normal()));
+    hitInfo.dpdu = toWorld(hitInfo.dpdu);
+    hitInfo.dpdv = toWorld(hitInfo.dpdv);
+    return true;
+  }
+
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    return mObject->occluded(toObject(ray), rayRange);
+  }
+
+  bool hitSpan(const Ray& ray, Interval rayRange,
+               Interval& span) const override {
+    return mObject->hitSpan(toObject(ray), rayRange, span);
+  }
+
+  [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
+
+  // Of the current pose only.
+  void fingerprint(Fingerprint& print) const override {
+    print.add("Keyframed");
+    print.add(mTranslation);
+    print.add(mSinTheta);
+    print.add(mCosTheta);
+    mObject->fingerprint(print);
+  }
+
+private:
+  std::shared_ptr<Hittable> mObject;
+  std::vector<Keyframe> mKeyframes;
+  AABB mObjectBox;
+  Vec3 mTranslation;
+  double mSinTheta{};
+  double mCosTheta{1};
+  AABB mBoundingBox;
+
+  [[nodiscard]] Keyframe poseAt(double time) const {
+    if (mKeyframes.empty()) {
+      return {};
+    }
+    const auto next = std::upper_bound(
+        mKeyframes.begin(), mKeyframes.end(), time,
+        [](double value, const Keyframe& key) { return value < key.time; });
+    if (next == mKeyframes.begin()) {
+      return mKeyframes.front();
+    }
+    if (next == mKeyframes.end()) {
+      return mKeyframes.back();
+    }
+    const Keyframe& previous = *(next - 1);
+    const double blend = (time - previous.time) / (next->time - previous.time);
+    return {time,
+            previous.translation +
+                blend * (next->translation - previous.translation),
+            previous.rotationY + blend * (next->rotationY - previous.rotationY)};
+  }
+
+  [[nodiscard]] Ray toObject(const Ray& ray) const {
+    return {toObjectRotation(ray.origin() - mTranslation),
+            toObjectRotation(ray.direction()), ray.time()};
+  }
+
+  [[nodiscard]] Vec3 toObjectRotation(const Vec3& world) const {
+    return {mCosTheta * world.x() - mSinTheta * world.z(), world.y(),
+            mSinTheta * world.x() + mCosTheta * world.z()};
+  }
+
+  [[nodiscard]] Vec3 toWorld(const Vec3& local) const {
+    return {mCosTheta * local.x() + mSinTheta * local.z(), local.y(),
+            -mSinTheta * local.x() + mCosTheta * local.z()};
+  }
+};
+
+// Scene whose keyframed objects move from frame to frame. Static objects
+// get a BVH of their own that is built once. The tree over the animated
+// objects keeps its topology between frames and only refits its bounds; it
+// is rebuilt when its SAH cost exceeds the cost at the last build by more
+// than the rebuild threshold.
+class Animation : public Hittable {
+public:
+  explicit Animation(double rebuildThreshold = 1.3)
+      : mRebuildThreshold{rebuildThreshold} {}
+
+  void add(std::shared_ptr<Hittable> object) {
+    mStatic.add(std::move(object));
+    mStaticTree.reset();
+  }
+
+  void addAnimated(std::shared_ptr<Keyframed> object) {
+    mAnimated.add(object);
+    mKeyframed.push_back(std::move(object));
+    mAnimatedTree.reset();
+  }
+
+  // Poses every animated object at the given time and updates the BVHs.
+  void setTime(double time) {
+    for (const auto& object : mKeyframed) {
+      object->setTime(time);
+    }
+    if (!mStaticTree && !mStatic.empty()) {
+      mStaticTree = build(mStatic);
+    }
+    if (mKeyframed.empty()) {
+      return;
+    }
+    if (mAnimatedTree) {
+      mAnimatedTree->refit();
+      ++mRefits;
+      if (mAnimatedTree->sahCost() <= mRebuildThreshold * mBuildCost) {
+        return;
+      }
+    }
+    mAnimatedTree = build(mAnimated);
+    mBuildCost = mAnimatedTree->sahCost();
+    ++mRebuilds;
+  }
+
+  bool hit(const Ray& ray, Interval rayRange,
+           HitRecord& hitInfo) const override {
+    const bool hitStatic =
+        mStaticTree && mStaticTree->hit(ray, rayRange, hitInfo);
+    if (hitStatic) {
+      rayRange = Interval{rayRange.min(), hitInfo.t};
+    }
+    const bool hitAnimated =
+        mAnimatedTree && mAnimatedTree->hit(ray, rayRange, hitInfo);
+    return hitStatic || hitAnimated;
+  }
+
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    return (mStaticTree && mStaticTree->occluded(ray, rayRange)) ||
+           (mAnimatedTree && mAnimatedTree->occluded(ray, rayRange));
+  }
+
+  [[nodiscard]] AABB boundingBox() const override {
+    return AABB{mStaticTree ? mStaticTree->boundingBox() : AABB::empty,
+                mAnimatedTree ? mAnimatedTree->boundingBox() : AABB::empty};
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("Animation");
+    mStatic.fingerprint(print);
+    mAnimated.fingerprint(print);
+  }
+
+  void forEachObject(
+      const std::function<void(const Hittable&)>& visit) const override {
+    mStatic.forEachObject(visit);
+    mAnimated.forEachObject(visit);
+  }
+
+  [[nodiscard]] int refitCount() const { return mRefits; }
+  [[nodiscard]] int rebuildCount() const { return mRebuilds; }
+
+private:
+  double mRebuildThreshold;
+  HittableList mStatic;
+  HittableList mAnimated;
+  std::vector<std::shared_ptr<Keyframed>> mKeyframed;
+  std::unique_ptr<BVHNode> mStaticTree;
+  std::unique_ptr<BVHNode> mAnimatedTree;
+  double mBuildCost{};
+  int mRefits{};
+  int mRebuilds{};
+
+  static std::unique_ptr<BVHNode> build(HittableList& objects) {
+    // BVHNode reorders the objects it is given, so build from a copy.
+    auto copy = objects.getObjects();
+    return std::make_unique<BVHNode>(copy, 0, copy.size());
+  }
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "color.hpp"
+#include "framebuffer.hpp"
+#include "vec3.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+// Properties of the surface a camera ray hits first.
+struct FirstHit {
+  Color albedo;
+  Vec3 normal;
+  // Distance along the ray.
+  double depth{};
+  Vec3 position;
+  Color emission;
+  // IMaterial::id(), or -1 when the ray missed.
+  double materialId{-1};
+
+  // Sums everything but the material id, which keeps the first one hit.
+  FirstHit& operator+=(const FirstHit& other) {
+    albedo += other.albedo;
+    normal += other.normal;
+    depth += other.depth;
+    position += other.position;
+    emission += other.emission;
+    if (materialId < 0) {
+      materialId = other.materialId;
+    }
+    return *this;
+  }
+};
+
+// Arbitrary output variables: one float buffer per first-hit property,
+// averaged over the samples of each pixel.
+class AovBuffers {
+public:
+  enum class Layer : std::uint8_t {
+    Albedo,
+    Normal,
+    Depth,
+    Position,
+    MaterialId,
+    Emission,
+    Count
+  };
+
+  AovBuffers() = default;
+  AovBuffers(int width, int height) {
+    for (size_t i = 0; i < kLayerCount; ++i) {
+      mLayers[i] = FrameBuffer{width, height, kLayerChannels[i]};
+    }
+  }
+
+  [[nodiscard]] bool empty() const { return mLayers[0].empty(); }
+
+  [[nodiscard]] const FrameBuffer& layer(Layer layer) const {
+    return mLayers[static_cast<size_t>(layer)];
+  }
+
+  // Stores the sum of a pixel's first hits over the given number of samples.
+  void set(int xIndex, int yIndex, const FirstHit& sum, double sampleScale) {
+    buffer(Layer::Albedo).set(xIndex, yIndex, sum.albedo * sampleScale);
+    buffer(Layer::Normal).set(xIndex, yIndex, sum.normal * sampleScale);
+    buffer(Layer::Depth).at(xIndex, yIndex, 0) =
+        static_cast<float>(sum.depth * sampleScale);
+    buffer(Layer::Position).set(xIndex, yIndex, sum.position * sampleScale);
+    buffer(Layer::MaterialId).at(xIndex, yIndex, 0) =
+        static_cast<float>(sum.materialId);
+    buffer(Layer::Emission).set(xIndex, yIndex, sum.emission * sampleScale);
+  }
+
+  // Copies a tile-sized buffer into one layer at the tile's position.
+  void blit(Layer layer, const FrameBuffer& source, const Tile& tile) {
+    buffer(layer).blit(source, tile);
+  }
+
+  // Writes every layer to <prefix>_<layer>.pfm.
+  void write(const std::string& prefix) const {
+    for (size_t i = 0; i < kLayerCount; ++i) {
+      std::ofstream file{prefix + "_" + std::string{kLayerNames[i]} + ".pfm",
+                         std::ios::binary};
+      mLayers[i].writePFM(file);
+    }
+  }
+
+private:
+  static constexpr size_t kLayerCount = static_cast<size_t>(Layer::Count);
+  static constexpr std::array<int, kLayerCount> kLayerChannels{3, 3, 1,
+                                                               3, 1, 3};
+  static constexpr std::array<std::string_view, kLayerCount> kLayerNames{
+      "albedo", "normal", "depth", "position", "material", "emission"};
+
+  std::array<FrameBuffer, kLayerCount> mLayers;
+
+  FrameBuffer& buffer(Layer layer) {
+    return mLayers[static_cast<size_t>(layer)];
+  }
+};
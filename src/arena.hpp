@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Owns the objects of a scene in large blocks of memory, allocated by bumping
+// a pointer. Objects keep their address until the arena is destroyed, which
+// destroys them all at once in reverse order of creation.
+//
+// make() returns shared_ptrs without a control block, so the scene code can
+// pass them around as before without any reference counting; they must not
+// outlive the arena.
+class SceneArena {
+public:
+  SceneArena() = default;
+  SceneArena(const SceneArena&) = delete;
+  SceneArena& operator=(const SceneArena&) = delete;
+  SceneArena(SceneArena&&) = delete;
+  SceneArena& operator=(SceneArena&&) = delete;
+  ~SceneArena() {
+    for (auto it = mDestructors.rbegin(); it != mDestructors.rend(); ++it) {
+      it->destroy(it->object);
+    }
+  }
+
+  template <typename T, typename... Args>
+  std::shared_ptr<T> make(Args&&... args) {
+    void* memory = allocate(sizeof(T), alignof(T));
+    T* object = ::new (memory) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      mDestructors.push_back(
+          {object, [](void* pointer) { static_cast<T*>(pointer)->~T(); }});
+    }
+    ++mObjectCount;
+    // Aliasing an empty pointer gives a non-null pointer that owns nothing.
+    return std::shared_ptr<T>{std::shared_ptr<T>{}, object};
+  }
+
+  [[nodiscard]] size_t objectCount() const { return mObjectCount; }
+  [[nodiscard]] size_t bytesReserved() const { return mBytesReserved; }
+
+  // Ids for the materials of this scene, in order of creation.
+  std::uint32_t nextMaterialId() { return mNextMaterialId++; }
+
+  // Makes makeShared() allocate from an arena on this thread while in scope.
+  class Scope {
+  public:
+    explicit Scope(SceneArena& arena)
+        : mPrevious{std::exchange(current(), &arena)} {}
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    Scope(Scope&&) = delete;
+    Scope& operator=(Scope&&) = delete;
+    ~Scope() { current() = mPrevious; }
+
+  private:
+    SceneArena* mPrevious;
+  };
+
+  static SceneArena*& current() {
+    thread_local constinit SceneArena* arena = nullptr;
+    return arena;
+  }
+
+private:
+  static constexpr size_t kBlockBytes = size_t{256} * 1024;
+
+  struct Destructor {
+    void* object;
+    void (*destroy)(void*);
+  };
+
+  std::vector<std::unique_ptr<std::byte[]>> mBlocks;
+  std::byte* mNext{};
+  size_t mRemaining{};
+  size_t mBytesReserved{};
+  size_t mObjectCount{};
+  std::uint32_t mNextMaterialId{};
+  std::vector<Destructor> mDestructors;
+
+  void* allocate(size_t size, size_t alignment) {
+    void* memory = mNext;
+    if (std::align(alignment, size, memory, mRemaining) == nullptr) {
+      const size_t blockSize = std::max(kBlockBytes, size + alignment);
+      mBlocks.push_back(std::make_unique_for_overwrite<std::byte[]>(blockSize));
+      mBytesReserved += blockSize;
+      memory = mBlocks.back().get();
+      mRemaining = blockSize;
+      (void)std::align(alignment, size, memory, mRemaining);
+    }
+    mNext = static_cast<std::byte*>(memory) + size;
+    mRemaining -= size;
+    return memory;
+  }
+};
+
+// Scene objects are made through this: from the arena in scope on this
+// thread, or like std::make_shared without one.
+template <typename T, typename... Args>
+std::shared_ptr<T> makeShared(Args&&... args) {
+  if (SceneArena* arena = SceneArena::current()) {
+    return arena->make<T>(std::forward<Args>(args)...);
+  }
+  return std::make_shared<T>(std::forward<Args>(args)...);
+}
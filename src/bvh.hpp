@@ -1,11 +1,15 @@
 #pragma once
 
 #include "aabb.hpp"
+#include "arena.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
 #include "interval.hpp"
+#include "stats.hpp"
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <functional>
 #include <iterator>
 #include <memory>
 #include <vector>
@@ -15,14 +19,13 @@ public:
       : BVHNode{list.getObjects(), 0, list.getObjects().size()} {}
 
   BVHNode(std::vector<std::shared_ptr<Hittable>>& objects, size_t start,
-          size_t end)
-      : mBoundingBox(AABB::empty) {
-
+          size_t end) {
+    AABB bounds = AABB::empty;
     for (size_t iObject = start; iObject < end; ++iObject) {
-      mBoundingBox = AABB{mBoundingBox, objects[iObject]->boundingBox()};
+      bounds = AABB{bounds, objects[iObject]->boundingBox()};
     }
 
-    size_t axis = mBoundingBox.longestAxis();
+    size_t axis = bounds.longestAxis();
 
     auto comparator = (axis == 0)   ? boundingXCompare
                       : (axis == 1) ? boundingYCompare
@@ -40,14 +43,42 @@ public:
                 std::begin(objects) + static_cast<long long>(end), comparator);
 
       auto mid = start + objectSpan / 2;
-      mLeft = std::make_shared<BVHNode>(objects, start, mid);
-      mRight = std::make_shared<BVHNode>(objects, mid, end);
+      mLeft = makeShared<BVHNode>(objects, start, mid);
+      mRight = makeShared<BVHNode>(objects, mid, end);
+      mInterior = true;
+    }
+    updateMotionBounds();
+  }
+
+  // Recomputes every bounding box bottom-up from the objects' current boxes,
+  // keeping the tree as it was built. Much cheaper than a rebuild, but the
+  // tree gets worse as objects move away from where they were split.
+  void refit() {
+    if (mInterior) {
+      childNode(mLeft).refit();
+      childNode(mRight).refit();
     }
+    updateMotionBounds();
+  }
+
+  // Expected cost of tracing a ray that hits the root box, by the surface
+  // area heuristic: every node visit and object test weighted by the chance
+  // of reaching it, in units of one object test.
+  [[nodiscard]] double sahCost() const {
+    const double rootArea = boundingBox().surfaceArea();
+    return rootArea > 0 ? sahCost(rootArea) : 0.0;
+  }
+
+  [[nodiscard]] size_t nodeCount() const {
+    return mInterior ? 1 + childNode(mLeft).nodeCount() +
+                           childNode(mRight).nodeCount()
+                     : 1;
   }
 
   bool hit(const Ray& incoming, Interval rayRange,
            HitRecord& hitInfo) const override {
-    if (!mBoundingBox.hit(incoming, rayRange)) {
+    stats::add(stats::Counter::BVHNodesVisited);
+    if (!boxHit(incoming, rayRange)) {
       return false;
     }
     bool hitLeft = mLeft->hit(incoming, rayRange, hitInfo);
@@ -57,12 +88,92 @@ public:
     return hitLeft || hitRight;
   }
 
-  [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
+  [[nodiscard]] bool occluded(const Ray& incoming,
+                              Interval rayRange) const override {
+    // Any hit will do, so there is no need to shrink the range or visit both
+    // children.
+    stats::add(stats::Counter::BVHNodesVisited);
+    if (!boxHit(incoming, rayRange)) {
+      return false;
+    }
+    return mLeft->occluded(incoming, rayRange) ||
+           (mRight != mLeft && mRight->occluded(incoming, rayRange));
+  }
+
+  [[nodiscard]] AABB boundingBox() const override {
+    return mMoving ? AABB{mMotionBounds.start, mMotionBounds.end}
+                   : mMotionBounds.start;
+  }
+
+  [[nodiscard]] MotionBounds motionBounds() const override {
+    return mMotionBounds;
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("BVHNode");
+    forEachObject([&](const Hittable& object) { object.fingerprint(print); });
+  }
+
+  void forEachObject(
+      const std::function<void(const Hittable&)>& visit) const override {
+    mLeft->forEachObject(visit);
+    if (mRight != mLeft) {
+      mRight->forEachObject(visit);
+    }
+  }
 
 private:
+  static constexpr double kMotionAreaRatio = 1.25;
+
   std::shared_ptr<Hittable> mLeft;
   std::shared_ptr<Hittable> mRight;
-  AABB mBoundingBox;
+  // When something below moves far compared to its size, rays test the box
+  // at their time instead of the one swept over the whole shutter. Otherwise
+  // both boxes hold the swept box, as interpolating would cost more than it
+  // saves.
+  MotionBounds mMotionBounds;
+  bool mMoving{};
+  // Whether both children are BVHNodes rather than objects.
+  bool mInterior{};
+
+  void updateMotionBounds() {
+    const MotionBounds left = mLeft->motionBounds();
+    const MotionBounds right = mRight->motionBounds();
+    mMotionBounds = {AABB{left.start, right.start}, AABB{left.end, right.end}};
+    const AABB swept{mMotionBounds.start, mMotionBounds.end};
+    mMoving = swept.surfaceArea() >
+              kMotionAreaRatio * std::fmax(mMotionBounds.start.surfaceArea(),
+                                           mMotionBounds.end.surfaceArea());
+    if (!mMoving) {
+      mMotionBounds = {swept, swept};
+    }
+  }
+
+  [[nodiscard]] bool boxHit(const Ray& ray, Interval rayRange) const {
+    if (mMoving) {
+      return AABB::interpolate(mMotionBounds.start, mMotionBounds.end,
+                               ray.time())
+          .hit(ray, rayRange);
+    }
+    return mMotionBounds.start.hit(ray, rayRange);
+  }
+
+  static BVHNode& childNode(const std::shared_ptr<Hittable>& child) {
+    return static_cast<BVHNode&>(*child);
+  }
+
+  [[nodiscard]] double sahCost(double rootArea) const {
+    constexpr double kTraversalCost = 1.0;
+    constexpr double kObjectCost = 1.0;
+    const double reachProbability = boundingBox().surfaceArea() / rootArea;
+    if (mInterior) {
+      return kTraversalCost * reachProbability +
+             childNode(mLeft).sahCost(rootArea) +
+             childNode(mRight).sahCost(rootArea);
+    }
+    const double objectCount = mLeft == mRight ? 1.0 : 2.0;
+    return (kTraversalCost + kObjectCost * objectCount) * reachProbability;
+  }
 
   static bool box_compare(const std::shared_ptr<Hittable> a,
                           const std::shared_ptr<Hittable> b,
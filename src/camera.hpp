@@ -1,12 +1,48 @@
 #pragma once
 
+#include "animation.hpp"
+#include "aov.hpp"
 #include "color.hpp"
+#include "denoiser.hpp"
+#include "fingerprint.hpp"
+#include "framebuffer.hpp"
+#include "heatmap.hpp"
 #include "hittable.hpp"
 #include "material.hpp"
+#include "pdf.hpp"
+#include "ray_sort.hpp"
+#include "render_cache.hpp"
+#include "sampler.hpp"
+#include "stats.hpp"
 #include "utils.hpp"
 #include "vec3.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// How the camera traces the paths of its samples.
+enum class TraceOrder : std::uint8_t {
+  // Each sample's path to the end before the next one starts.
+  DepthFirst,
+  // Breadth first: one bounce of every path of a batch of samples, then the
+  // next bounce of the paths still going. Paths draw their random numbers
+  // from streams of their own, so the image differs from DepthFirst (unless
+  // a low-discrepancy sampler provides them) but not between the batched
+  // orders.
+  Batched,
+  // Batched, with each bounce's rays sorted by RaySorter before they are
+  // traced.
+  SortedBatches,
+};
 
 class Camera {
 public:
@@ -25,30 +61,923 @@ public:
 
   Color mBackgroundColor;
 
-  void render(const Hittable& world) {
+  // With statistics compiled in, the JSON report of each render is also
+  // written here when set.
+  std::string mStatisticsFile;
+
+  // When set, render() also writes per-pixel cost heatmaps next to the
+  // image; see Heatmap::write() for the file names. Not written by
+  // time-budgeted renders, which come back to each pixel in every pass.
+  std::string mHeatmapPrefix;
+
+  // Filters the image with the edge-aware Denoiser before it is written,
+  // guided by the first-hit albedo, normal and depth of every pixel.
+  bool mDenoise = false;
+  Denoiser::Settings mDenoiseSettings;
+
+  // When set, render() also writes the first-hit AOV buffers as float
+  // images; see AovBuffers::write() for the file names.
+  std::string mAovPrefix;
+
+  // Every pixel draws its samples from its own random stream seeded from
+  // this and its position, so it renders the same whichever tile, process or
+  // order it is rendered in.
+  std::uint32_t mSeed = 0;
+
+  // Where the pixel, lens, time and path samples come from.
+  SamplerType mSamplerType = SamplerType::Independent;
+
+  // Heatmaps measure every pixel on its own, so they force DepthFirst.
+  TraceOrder mTraceOrder = TraceOrder::DepthFirst;
+
+  // When positive, render() spends this many seconds of wall-clock time on
+  // the image instead of a fixed number of samples, up to mSamplesPerPixel.
+  // A one-sample warm-up pass measures what a sample costs; each later pass
+  // adds as many samples per pixel as the time left allows, at most doubling
+  // them. A pass cut short by the deadline leaves some pixels one pass
+  // ahead, so every pixel is averaged over its own count.
+  double mTimeBudgetSeconds = 0;
+
+  // Renders only this part of the image, in pixels, and writes an image of
+  // its size, e.g. to look at one object while working on it. Its pixels
+  // come out as they do in the full image. Empty renders the whole image.
+  Tile mCropWindow;
+
+  // When set, render() keeps the tiles it renders in this directory and
+  // reuses them, also in later runs, while nothing that goes into them
+  // changes: the camera, the lights and every object whose bounds fall in
+  // the tile's part of the view. Light that reaches a tile from objects
+  // outside its view (reflections, shadows, bounced light) is not part of
+  // that, so a change to one of those leaves the tile as it was. Objects,
+  // materials and textures without a fingerprint are never reused, and
+  // neither are time-budgeted renders.
+  std::string mTileCacheDirectory;
+
+  // How the last time-budgeted render went.
+  struct BudgetReport {
+    double budgetSeconds{};
+    // Until the image was written.
+    double elapsedSeconds{};
+    // Mean samples per pixel the warm-up pass predicted the budget allows,
+    // and those traced.
+    double predictedSamplesPerPixel{};
+    double samplesPerPixel{};
+    int minSamplesPerPixel{};
+    int passes{};
+  };
+
+  void render(const Hittable& world) { render(world, nullptr); }
+
+  // Renders with next event estimation: diffuse bounces sample a mixture of
+  // the material PDF and directions towards the given light objects.
+  void render(const Hittable& world, const Hittable& lights) {
+    render(world, &lights);
+  }
+
+  // Renders frameCount frames of an animation, frame i posed at
+  // startTime + i * frameDuration, to <prefix>_<i>.ppm. Heatmap and AOV
+  // prefixes get the same frame suffix.
+  void renderSequence(Animation& world, int frameCount, double startTime,
+                      double frameDuration, const std::string& prefix) {
+    renderSequence(world, nullptr, frameCount, startTime, frameDuration,
+                   prefix);
+  }
+  void renderSequence(Animation& world, const Hittable& lights,
+                      int frameCount, double startTime, double frameDuration,
+                      const std::string& prefix) {
+    renderSequence(world, &lights, frameCount, startTime, frameDuration,
+                   prefix);
+  }
+
+  // Renders the colour of one tile of the image, e.g. for a distributed
+  // worker. The result matches the same pixels of a full render.
+  [[nodiscard]] FrameBuffer renderTile(const Hittable& world,
+                                       const Tile& tile) {
+    return renderTile(world, nullptr, tile);
+  }
+  [[nodiscard]] FrameBuffer renderTile(const Hittable& world,
+                                       const Hittable& lights,
+                                       const Tile& tile) {
+    return renderTile(world, &lights, tile);
+  }
+
+  [[nodiscard]] int imageHeight() const {
+    return std::max(int(mImageWidth / mAspectRatio), 1);
+  }
+
+  // Counters of the last render; all zero unless built with
+  // RAYTRACE_ENABLE_STATS.
+  [[nodiscard]] const stats::Report& statistics() const { return mStatistics; }
+
+  [[nodiscard]] const BudgetReport& budgetReport() const {
+    return mBudgetReport;
+  }
+
+private:
+  void render(const Hittable& world, const Hittable* lights) {
+    render(world, lights, std::cout);
+  }
+
+  void render(const Hittable& world, const Hittable* lights,
+              std::ostream& out) {
+    const auto start = std::chrono::steady_clock::now();
     initialize();
-    std::cout << "P3\n" << mImageWidth << ' ' << mImageHeight << "\n255\n";
-
-    for (int yIndex = 0; yIndex < mImageHeight; ++yIndex) {
-      std::clog << "\rScanlines remaining: " << (mImageHeight - yIndex) << ' '
-                << std::flush;
-      for (int xIndex = 0; xIndex < mImageWidth; ++xIndex) {
-        auto pixelColor = Color{0, 0, 0};
-        for (int iSample = 0; iSample < mSamplesPerPixel; ++iSample) {
-          Ray r = calculateSampleRay(xIndex, yIndex);
-          pixelColor += calculateRayColor(r, mMaxDepth, world);
+    stats::reset();
+    // Buffers cover the region only; pixels keep their image coordinates
+    // everywhere else.
+    const Tile region = renderRegion();
+    FrameBuffer image{region.width, region.height};
+    FrameBuffer variance;
+    if (mDenoise) {
+      variance = FrameBuffer{region.width, region.height, 1};
+    }
+    AovBuffers aovs;
+    const bool collectFirstHits = mDenoise || !mAovPrefix.empty();
+    if (collectFirstHits) {
+      aovs = AovBuffers{region.width, region.height};
+    }
+
+    auto store = [&](int xIndex, int yIndex, const PixelSamples& samples,
+                     double sampleScale) {
+      xIndex -= region.x;
+      yIndex -= region.y;
+      image.set(xIndex, yIndex, samples.color * sampleScale);
+      if (collectFirstHits) {
+        aovs.set(xIndex, yIndex, samples.firstHits, sampleScale);
+      }
+      if (mDenoise) {
+        variance.at(xIndex, yIndex, 0) = static_cast<float>(
+            meanVariance(samples.color, samples.squares, sampleScale));
+      }
+    };
+
+    const bool budgeted = mTimeBudgetSeconds > 0;
+    std::unique_ptr<Heatmap> heatmap;
+    if (!mHeatmapPrefix.empty() && !budgeted) {
+      heatmap = std::make_unique<Heatmap>(region.width, region.height);
+    }
+
+    const bool batched = mTraceOrder != TraceOrder::DepthFirst && !heatmap;
+    auto trace = [&](const Tile& tile) {
+      for (int yIndex = tile.y; yIndex < tile.y + tile.height; ++yIndex) {
+        std::vector<PixelSamples> row;
+        if (batched) {
+          row = traceBatch(Tile{tile.x, yIndex, tile.width, 1}, 0,
+                           mSamplesPerPixel, world, lights, collectFirstHits);
+        }
+        for (int xIndex = tile.x; xIndex < tile.x + tile.width; ++xIndex) {
+          if (heatmap) {
+            heatmap->beginPixel();
+          }
+          const PixelSamples samples =
+              batched ? row[static_cast<size_t>(xIndex - tile.x)]
+                      : samplePixel(xIndex, yIndex, world, lights,
+                                    collectFirstHits);
+          if (heatmap) {
+            heatmap->endPixel(xIndex - region.x, yIndex - region.y);
+          }
+          store(xIndex, yIndex, samples, mPixelSampleScale);
         }
-        pixelColor *= mPixelSampleScale;
-        color::write(std::cout, pixelColor);
+      }
+    };
+
+    if (budgeted) {
+      renderWithinBudget(start, region, world, lights, collectFirstHits,
+                         store);
+    } else if (!mTileCacheDirectory.empty()) {
+      // Every layer the render keeps per pixel goes into the cache.
+      auto layersOf = [&](const Tile& tile) {
+        std::vector<FrameBuffer> layers{image.crop(tile)};
+        if (mDenoise) {
+          layers.push_back(variance.crop(tile));
+        }
+        for (size_t i = 0; collectFirstHits && i < kAovLayerCount; ++i) {
+          layers.push_back(
+              aovs.layer(static_cast<AovBuffers::Layer>(i)).crop(tile));
+        }
+        return layers;
+      };
+      auto blitLayers = [&](const std::vector<FrameBuffer>& layers,
+                            const Tile& tile) {
+        auto layer = layers.begin();
+        image.blit(*layer++, tile);
+        if (mDenoise) {
+          variance.blit(*layer++, tile);
+        }
+        for (size_t i = 0; collectFirstHits && i < kAovLayerCount; ++i) {
+          aovs.blit(static_cast<AovBuffers::Layer>(i), *layer++, tile);
+        }
+      };
+
+      const RenderCache cache{mTileCacheDirectory};
+      const std::vector<Tile> tiles = cacheTiles(region);
+      const std::vector<Fingerprint> prints = tileFingerprints(
+          region, tiles, world, lights, batched, collectFirstHits);
+      size_t reused = 0;
+      for (size_t i = 0; i < tiles.size(); ++i) {
+        std::clog << "\rTiles remaining: " << (tiles.size() - i) << ' '
+                  << std::flush;
+        const Tile local{tiles[i].x - region.x, tiles[i].y - region.y,
+                         tiles[i].width, tiles[i].height};
+        std::vector<FrameBuffer> layers = layersOf(local);
+        if (prints[i].known() && cache.load(prints[i].value(), layers)) {
+          blitLayers(layers, local);
+          ++reused;
+          continue;
+        }
+        trace(tiles[i]);
+        if (prints[i].known()) {
+          cache.store(prints[i].value(), layersOf(local));
+        }
+      }
+      std::clog << "\nTile cache: " << reused << " of " << tiles.size()
+                << " tiles reused";
+    } else {
+      for (int yIndex = region.y; yIndex < region.y + region.height;
+           ++yIndex) {
+        std::clog << "\rScanlines remaining: "
+                  << (region.y + region.height - yIndex) << ' ' << std::flush;
+        trace(Tile{region.x, yIndex, region.width, 1});
       }
     }
 
     std::clog << "\n\rDone.\n";
+    if (mDenoise) {
+      image = Denoiser::denoise(
+          image, aovs.layer(AovBuffers::Layer::Albedo),
+          aovs.layer(AovBuffers::Layer::Normal),
+          aovs.layer(AovBuffers::Layer::Depth), variance, mDenoiseSettings);
+    }
+    image.writePPM(out);
+    if (budgeted) {
+      mBudgetReport.elapsedSeconds =
+          std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                        start)
+              .count();
+      reportBudget();
+    }
+    reportStatistics();
+    if (heatmap) {
+      heatmap->write(mHeatmapPrefix);
+    }
+    if (!mAovPrefix.empty()) {
+      aovs.write(mAovPrefix);
+    }
+  }
+
+  void renderSequence(Animation& world, const Hittable* lights,
+                      int frameCount, double startTime, double frameDuration,
+                      const std::string& prefix) {
+    const std::string heatmapPrefix = mHeatmapPrefix;
+    const std::string aovPrefix = mAovPrefix;
+    for (int frame = 0; frame < frameCount; ++frame) {
+      world.setTime(startTime + frame * frameDuration);
+
+      std::ostringstream suffix;
+      suffix << '_' << std::setfill('0') << std::setw(4) << frame;
+      if (!heatmapPrefix.empty()) {
+        mHeatmapPrefix = heatmapPrefix + suffix.str();
+      }
+      if (!aovPrefix.empty()) {
+        mAovPrefix = aovPrefix + suffix.str();
+      }
+      std::ofstream file{prefix + suffix.str() + ".ppm"};
+      render(world, lights, file);
+    }
+    mHeatmapPrefix = heatmapPrefix;
+    mAovPrefix = aovPrefix;
+    std::clog << "BVH refits: " << world.refitCount()
+              << ", rebuilds: " << world.rebuildCount() << '\n';
+  }
+
+  FrameBuffer renderTile(const Hittable& world, const Hittable* lights,
+                         const Tile& tile) {
+    initialize();
+    FrameBuffer pixels{tile.width, tile.height};
+    if (mTraceOrder != TraceOrder::DepthFirst) {
+      const std::vector<PixelSamples> samples =
+          traceBatch(tile, 0, mSamplesPerPixel, world, lights, false);
+      for (int yIndex = 0; yIndex < tile.height; ++yIndex) {
+        for (int xIndex = 0; xIndex < tile.width; ++xIndex) {
+          pixels.set(xIndex, yIndex,
+                     samples[static_cast<size_t>(yIndex * tile.width + xIndex)]
+                             .color *
+                         mPixelSampleScale);
+        }
+      }
+      return pixels;
+    }
+    for (int yIndex = 0; yIndex < tile.height; ++yIndex) {
+      for (int xIndex = 0; xIndex < tile.width; ++xIndex) {
+        const PixelSamples samples = samplePixel(
+            tile.x + xIndex, tile.y + yIndex, world, lights, false);
+        pixels.set(xIndex, yIndex, samples.color * mPixelSampleScale);
+      }
+    }
+    return pixels;
+  }
+
+  // Sums over all samples of a pixel.
+  struct PixelSamples {
+    Color color;
+    Color squares;
+    FirstHit firstHits;
+
+    PixelSamples& operator+=(const PixelSamples& other) {
+      color += other.color;
+      squares += other.squares;
+      firstHits += other.firstHits;
+      return *this;
+    }
+  };
+
+  // Share of the budget kept back for resolving, denoising and writing the
+  // image after the last pass.
+  static constexpr double kBudgetOutputShare = 0.05;
+
+  template <typename Store>
+  void renderWithinBudget(std::chrono::steady_clock::time_point start,
+                          const Tile& region, const Hittable& world,
+                          const Hittable* lights, bool collectFirstHits,
+                          Store&& store) {
+    using Clock = std::chrono::steady_clock;
+    auto secondsSince = [](Clock::time_point time) {
+      return std::chrono::duration<double>(Clock::now() - time).count();
+    };
+    const double traceSeconds = mTimeBudgetSeconds * (1 - kBudgetOutputShare);
+    const auto deadline =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(traceSeconds));
+
+    const size_t pixelCount =
+        static_cast<size_t>(region.width) * static_cast<size_t>(region.height);
+    auto pixelOf = [&](int xIndex, int yIndex) {
+      return static_cast<size_t>((yIndex - region.y) * region.width +
+                                 xIndex - region.x);
+    };
+    std::vector<PixelSamples> sums(pixelCount);
+    std::vector<int> counts(pixelCount);
+    // Each pixel's generator carries on from pass to pass, so the passes
+    // draw the same samples a single render would.
+    std::vector<std::uint64_t> randoms(pixelCount);
+    for (int yIndex = region.y; yIndex < region.y + region.height; ++yIndex) {
+      for (int xIndex = region.x; xIndex < region.x + region.width;
+           ++xIndex) {
+        randoms[pixelOf(xIndex, yIndex)] = pixelSeed(xIndex, yIndex);
+      }
+    }
+
+    const bool batched = mTraceOrder != TraceOrder::DepthFirst;
+    auto traceRow = [&](int yIndex, int firstSample, int sampleCount) {
+      std::vector<PixelSamples> row;
+      if (batched) {
+        row = traceBatch(Tile{region.x, yIndex, region.width, 1}, firstSample,
+                         sampleCount, world, lights, collectFirstHits);
+      }
+      for (int xIndex = region.x; xIndex < region.x + region.width;
+           ++xIndex) {
+        const size_t pixel = pixelOf(xIndex, yIndex);
+        sums[pixel] +=
+            batched ? row[static_cast<size_t>(xIndex - region.x)]
+                    : samplePixel(xIndex, yIndex, firstSample,
+                                  firstSample + sampleCount, randoms[pixel],
+                                  world, lights, collectFirstHits);
+        counts[pixel] += sampleCount;
+      }
+    };
+
+    mBudgetReport = BudgetReport{.budgetSeconds = mTimeBudgetSeconds};
+    auto secondsLeft = [&] {
+      return std::chrono::duration<double>(deadline - Clock::now()).count();
+    };
+    int samplesDone = 0;
+    // What one sample of every pixel costs, as of the last pass.
+    double secondsPerPass = 0;
+    while (samplesDone < mSamplesPerPixel) {
+      // The warm-up pass traces one sample and always finishes, so that
+      // every pixel has one.
+      const bool warmUp = samplesDone == 0;
+      int passSamples = 1;
+      if (!warmUp) {
+        passSamples = static_cast<int>(
+            std::clamp(std::floor(secondsLeft() / secondsPerPass), 1.0,
+                       static_cast<double>(std::min(
+                           samplesDone, mSamplesPerPixel - samplesDone))));
+      }
+
+      const auto passStart = Clock::now();
+      int rows = 0;
+      for (; rows < region.height && (warmUp || Clock::now() < deadline);
+           ++rows) {
+        std::clog << "\rPass " << mBudgetReport.passes + 1
+                  << ", scanlines remaining: " << (region.height - rows)
+                  << ' ' << std::flush;
+        traceRow(region.y + rows, samplesDone, passSamples);
+      }
+      // A pass cut off before its first row traced nothing and is not one.
+      if (rows > 0) {
+        ++mBudgetReport.passes;
+      }
+      if (rows < region.height) {
+        break;
+      }
+      secondsPerPass = secondsSince(passStart) / passSamples;
+      if (warmUp) {
+        mBudgetReport.predictedSamplesPerPixel =
+            std::clamp(1 + secondsLeft() / secondsPerPass, 1.0,
+                       static_cast<double>(mSamplesPerPixel));
+      }
+      samplesDone += passSamples;
+    }
+
+    double sampleSum = 0;
+    mBudgetReport.minSamplesPerPixel = mSamplesPerPixel;
+    for (int yIndex = region.y; yIndex < region.y + region.height; ++yIndex) {
+      for (int xIndex = region.x; xIndex < region.x + region.width;
+           ++xIndex) {
+        const size_t pixel = pixelOf(xIndex, yIndex);
+        store(xIndex, yIndex, sums[pixel], 1.0 / counts[pixel]);
+        sampleSum += counts[pixel];
+        mBudgetReport.minSamplesPerPixel =
+            std::min(mBudgetReport.minSamplesPerPixel, counts[pixel]);
+      }
+    }
+    mBudgetReport.samplesPerPixel =
+        sampleSum / static_cast<double>(pixelCount);
+  }
+
+  void reportBudget() const {
+    const BudgetReport& report = mBudgetReport;
+    std::clog << "Time budget: " << report.budgetSeconds << " s, took "
+              << report.elapsedSeconds << " s; " << report.samplesPerPixel
+              << " samples per pixel (at least " << report.minSamplesPerPixel
+              << ") in " << report.passes << " passes, "
+              << report.predictedSamplesPerPixel
+              << " predicted after the warm-up ("
+              << 100 * report.samplesPerPixel /
+                     report.predictedSamplesPerPixel
+              << "%).\n";
+  }
+
+  static constexpr int kCacheTileSize = 32;
+  static constexpr size_t kAovLayerCount =
+      static_cast<size_t>(AovBuffers::Layer::Count);
+
+  // mCropWindow clipped to the image, or the whole image.
+  [[nodiscard]] Tile renderRegion() const {
+    if (mCropWindow.width <= 0 || mCropWindow.height <= 0) {
+      return Tile{0, 0, mImageWidth, mImageHeight};
+    }
+    const int left = std::clamp(mCropWindow.x, 0, mImageWidth);
+    const int top = std::clamp(mCropWindow.y, 0, mImageHeight);
+    const int right =
+        std::clamp(mCropWindow.x + mCropWindow.width, left, mImageWidth);
+    const int bottom =
+        std::clamp(mCropWindow.y + mCropWindow.height, top, mImageHeight);
+    return Tile{left, top, right - left, bottom - top};
+  }
+
+  // The tiles of a grid fixed to the image, so that crop windows share the
+  // tiles inside them, clipped to region, in scanline order.
+  [[nodiscard]] static std::vector<Tile> cacheTiles(const Tile& region) {
+    std::vector<Tile> tiles;
+    const int right = region.x + region.width;
+    const int bottom = region.y + region.height;
+    for (int y = region.y / kCacheTileSize * kCacheTileSize; y < bottom;
+         y += kCacheTileSize) {
+      for (int x = region.x / kCacheTileSize * kCacheTileSize; x < right;
+           x += kCacheTileSize) {
+        const int left = std::max(x, region.x);
+        const int top = std::max(y, region.y);
+        tiles.push_back({left, top,
+                         std::min(x + kCacheTileSize, right) - left,
+                         std::min(y + kCacheTileSize, bottom) - top});
+      }
+    }
+    return tiles;
+  }
+
+  // What each of the cacheTiles() of region depends on: the camera, the
+  // lights, the tile itself and every object that pixelsSeeing() puts in it.
+  [[nodiscard]] std::vector<Fingerprint>
+  tileFingerprints(const Tile& region, const std::vector<Tile>& tiles,
+                   const Hittable& world, const Hittable* lights,
+                   bool batched, bool collectFirstHits) const {
+    // Only the AOV output shows material ids.
+    const bool writesMaterialIds = !mAovPrefix.empty();
+    Fingerprint camera;
+    camera.includeMaterialIds(writesMaterialIds);
+    camera.add(mAspectRatio);
+    camera.add(mImageWidth);
+    camera.add(mSamplesPerPixel);
+    camera.add(mMaxDepth);
+    camera.add(mVerticalFov);
+    camera.add(mLookFrom);
+    camera.add(mLookAt);
+    camera.add(mUp);
+    camera.add(mDefocusAngle);
+    camera.add(mFocusDistance);
+    camera.add(mBackgroundColor);
+    camera.add(static_cast<std::uint64_t>(mSeed));
+    camera.add(static_cast<int>(mSamplerType));
+    camera.add(batched);
+    camera.add(collectFirstHits);
+    camera.add(writesMaterialIds);
+    camera.add(mDenoise);
+    if (lights != nullptr) {
+      lights->fingerprint(camera);
+    }
+
+    std::vector<Fingerprint> prints;
+    prints.reserve(tiles.size());
+    for (const Tile& tile : tiles) {
+      Fingerprint print = camera;
+      print.add(tile.x);
+      print.add(tile.y);
+      print.add(tile.width);
+      print.add(tile.height);
+      prints.push_back(print);
+    }
+
+    const int firstColumn = region.x / kCacheTileSize;
+    const int lastColumn = (region.x + region.width - 1) / kCacheTileSize;
+    const int firstRow = region.y / kCacheTileSize;
+    const int lastRow = (region.y + region.height - 1) / kCacheTileSize;
+    world.forEachObject([&](const Hittable& object) {
+      const Tile pixels = pixelsSeeing(object.boundingBox());
+      if (pixels.width <= 0 || pixels.height <= 0) {
+        return;
+      }
+      Fingerprint objectPrint;
+      objectPrint.includeMaterialIds(writesMaterialIds);
+      object.fingerprint(objectPrint);
+      const int right = (pixels.x + pixels.width - 1) / kCacheTileSize;
+      const int bottom = (pixels.y + pixels.height - 1) / kCacheTileSize;
+      for (int row = std::max(pixels.y / kCacheTileSize, firstRow);
+           row <= std::min(bottom, lastRow); ++row) {
+        for (int column = std::max(pixels.x / kCacheTileSize, firstColumn);
+             column <= std::min(right, lastColumn); ++column) {
+          Fingerprint& print =
+              prints[static_cast<size_t>((row - firstRow) *
+                                             (lastColumn - firstColumn + 1) +
+                                         column - firstColumn)];
+          print.add(objectPrint.value());
+          if (!objectPrint.known()) {
+            print.markUnknown();
+          }
+        }
+      }
+    });
+    return prints;
+  }
+
+  // The pixels whose camera rays can reach into box, allowing for the
+  // spread of samples over a pixel and across the lens; empty if none can.
+  [[nodiscard]] Tile pixelsSeeing(const AABB& box) const {
+    const Tile everything{0, 0, mImageWidth, mImageHeight};
+    const Vec3 firstPixel = mFirstPixelLocation - mCenter;
+    const double pixelWidth = mPixelDeltaX.length();
+    const double pixelHeight = mPixelDeltaY.length();
+    double nearest = utils::INFINITE_DOUBLE;
+    double farthest = 0;
+    double left = utils::INFINITE_DOUBLE;
+    double right = -utils::INFINITE_DOUBLE;
+    double top = utils::INFINITE_DOUBLE;
+    double bottom = -utils::INFINITE_DOUBLE;
+    int behind = 0;
+    for (int corner = 0; corner < 8; ++corner) {
+      const Vec3 offset =
+          Vec3{(corner & 1) != 0 ? box.mX.max() : box.mX.min(),
+               (corner & 2) != 0 ? box.mY.max() : box.mY.min(),
+               (corner & 4) != 0 ? box.mZ.max() : box.mZ.min()} -
+          mCenter;
+      const double depth = -dot(offset, mW);
+      if (!std::isfinite(depth)) {
+        return everything;
+      }
+      if (depth <= 0) {
+        ++behind;
+        continue;
+      }
+      nearest = std::fmin(nearest, depth);
+      farthest = std::fmax(farthest, depth);
+      // Where the ray from the camera centre crosses the focus plane.
+      const Vec3 onFocusPlane = offset * (mFocusDistance / depth) - firstPixel;
+      const double x = dot(onFocusPlane, mU) / pixelWidth;
+      const double y = -dot(onFocusPlane, mV) / pixelHeight;
+      left = std::fmin(left, x);
+      right = std::fmax(right, x);
+      top = std::fmin(top, y);
+      bottom = std::fmax(bottom, y);
+    }
+    if (behind == 8) {
+      return {};
+    }
+    if (behind > 0) {
+      return everything;
+    }
+
+    // Seen from a lens of radius r, a point at depth z appears anywhere
+    // within r |1 - f / z| of there on the focus plane f away. Samples also
+    // spread half a pixel around the pixel centre; one more pixel covers
+    // rounding.
+    const double lensRadius = mDefocusAngle > 0 ? mDefocusDiskU.length() : 0;
+    const double blur =
+        lensRadius * std::fmax(std::fabs(1 - mFocusDistance / nearest),
+                               std::fabs(1 - mFocusDistance / farthest));
+    const double marginX = blur / pixelWidth + 1.5;
+    const double marginY = blur / pixelHeight + 1.5;
+    auto clampTo = [](double value, int size) {
+      return static_cast<int>(std::clamp(value, -1.0, double(size)));
+    };
+    const int x0 = std::max(clampTo(std::floor(left - marginX), mImageWidth),
+                            0);
+    const int x1 = std::min(clampTo(std::ceil(right + marginX), mImageWidth),
+                            mImageWidth - 1);
+    const int y0 = std::max(clampTo(std::floor(top - marginY), mImageHeight),
+                            0);
+    const int y1 =
+        std::min(clampTo(std::ceil(bottom + marginY), mImageHeight),
+                 mImageHeight - 1);
+    if (x0 > x1 || y0 > y1) {
+      return {};
+    }
+    return {x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+  }
+
+  PixelSamples samplePixel(int xIndex, int yIndex, const Hittable& world,
+                           const Hittable* lights, bool collectFirstHits) {
+    std::uint64_t random = pixelSeed(xIndex, yIndex);
+    return samplePixel(xIndex, yIndex, 0, mSamplesPerPixel, random, world,
+                       lights, collectFirstHits);
+  }
+
+  // Samples [firstSample, endSample) of a pixel, drawn from the generator
+  // state random, which is left where they end.
+  PixelSamples samplePixel(int xIndex, int yIndex, int firstSample,
+                           int endSample, std::uint64_t& random,
+                           const Hittable& world, const Hittable* lights,
+                           bool collectFirstHits) {
+    utils::seedRandom(random);
+    utils::sampleSource() = mSampler.get();
+    PixelSamples samples;
+    for (int iSample = firstSample; iSample < endSample; ++iSample) {
+      if (mSampler) {
+        mSampler->startPixelSample(xIndex, yIndex, iSample);
+      }
+      RayDifferential differential;
+      Ray r = calculateSampleRay(xIndex, yIndex, differential);
+      FirstHit sampleFirstHit;
+      const Color sampleColor =
+          calculateRayColor(r, mMaxDepth, world, lights,
+                            collectFirstHits ? &sampleFirstHit : nullptr);
+      samples.color += sampleColor;
+      samples.squares += sampleColor * sampleColor;
+      samples.firstHits += sampleFirstHit;
+      stats::add(stats::Counter::Samples);
+      stats::endPath();
+    }
+    utils::sampleSource() = nullptr;
+    random = utils::randomGenerator().state();
+    return samples;
+  }
+
+  // A live path of the batched trace orders, between two bounces.
+  struct PathState {
+    Ray ray;
+    Color throughput{1, 1, 1};
+    Color radiance;
+    // The generator state, or the sampler dimension, to resume from.
+    std::uint64_t random{};
+    // The path's sample within the batch.
+    std::uint32_t index{};
+    int rays{};
+  };
+
+  // Which pixel and sample a path of a batch traces.
+  struct PathOrigin {
+    int xIndex;
+    int yIndex;
+    int sampleIndex;
+  };
+
+  static constexpr size_t kBatchPaths = size_t{1} << 16U;
+
+  // samplePixel() for samples [firstSample, firstSample + sampleCount) of
+  // every pixel of the tile, in rows. The paths of up to
+  // kBatchPaths samples are traced together, one bounce at a time; the paths
+  // still going are packed after each bounce and, for SortedBatches,
+  // reordered by their next ray. Each path's result is scattered back to its
+  // sample when it ends.
+  std::vector<PixelSamples> traceBatch(const Tile& tile, int firstSample,
+                                       int sampleCount, const Hittable& world,
+                                       const Hittable* lights,
+                                       bool collectFirstHits) {
+    const auto samplesPerPixel = static_cast<size_t>(sampleCount);
+    const auto pathCount = static_cast<size_t>(tile.width) *
+                           static_cast<size_t>(tile.height) * samplesPerPixel;
+    auto originOf = [&](size_t path) {
+      const auto pixel = static_cast<int>(path / samplesPerPixel);
+      return PathOrigin{tile.x + pixel % tile.width,
+                        tile.y + pixel / tile.width,
+                        firstSample + static_cast<int>(path % samplesPerPixel)};
+    };
+
+    std::vector<PixelSamples> pixels(static_cast<size_t>(tile.width) *
+                                     static_cast<size_t>(tile.height));
+    const size_t batchSize = std::min(pathCount, kBatchPaths);
+    // Only camera rays carry differentials, and they are traced before any
+    // path moves.
+    std::vector<RayDifferential> differentials(batchSize);
+    std::vector<FirstHit> firstHits(collectFirstHits ? batchSize : 0);
+    std::vector<Color> radiance(batchSize);
+    std::vector<int> rays(batchSize);
+    std::vector<PathState> paths;
+    std::vector<PathState> next;
+    std::vector<std::uint32_t> order;
+    RaySorter sorter;
+    auto finish = [&](const PathState& path) {
+      radiance[path.index] = path.radiance;
+      rays[path.index] = path.rays;
+    };
+
+    utils::sampleSource() = mSampler.get();
+    for (size_t first = 0; first < pathCount; first += batchSize) {
+      const size_t count = std::min(batchSize, pathCount - first);
+      paths.clear();
+      for (size_t i = 0; i < count; ++i) {
+        paths.push_back(
+            startPath(static_cast<std::uint32_t>(i), originOf(first + i),
+                      differentials[i]));
+      }
+
+      for (int depth = mMaxDepth; depth > 0 && !paths.empty(); --depth) {
+        // Camera rays are coherent already.
+        if (mTraceOrder == TraceOrder::SortedBatches && depth != mMaxDepth) {
+          order.resize(paths.size());
+          for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = static_cast<std::uint32_t>(i);
+          }
+          sorter.sort(order, [&](std::uint32_t i) -> const Ray& {
+            return paths[i].ray;
+          });
+          next.clear();
+          for (const std::uint32_t i : order) {
+            next.push_back(paths[i]);
+          }
+          std::swap(paths, next);
+        }
+
+        next.clear();
+        for (PathState& path : paths) {
+          FirstHit* firstHit = depth == mMaxDepth && collectFirstHits
+                                   ? &firstHits[path.index]
+                                   : nullptr;
+          if (traceBounce(path, originOf(first + path.index), depth, world,
+                          lights, firstHit)) {
+            next.push_back(path);
+          } else {
+            finish(path);
+          }
+        }
+        std::swap(paths, next);
+      }
+      for (const PathState& path : paths) {
+        finish(path);
+      }
+
+      // Summed in sample order, so the result does not depend on the order
+      // the paths were traced in.
+      for (size_t i = 0; i < count; ++i) {
+        PixelSamples& samples = pixels[(first + i) / samplesPerPixel];
+        samples.color += radiance[i];
+        samples.squares += radiance[i] * radiance[i];
+        if (collectFirstHits) {
+          samples.firstHits += firstHits[i];
+          firstHits[i] = FirstHit{};
+        }
+        stats::add(stats::Counter::Samples);
+        stats::endPath(rays[i]);
+      }
+    }
+    utils::sampleSource() = nullptr;
+    return pixels;
+  }
+
+  PathState startPath(std::uint32_t index, const PathOrigin& origin,
+                      RayDifferential& differential) {
+    if (mSampler) {
+      mSampler->startPixelSample(origin.xIndex, origin.yIndex,
+                                 origin.sampleIndex);
+    } else {
+      utils::seedRandom(
+          static_cast<std::uint64_t>(pixelSeed(origin.xIndex, origin.yIndex))
+              << 32U |
+          static_cast<std::uint64_t>(origin.sampleIndex));
+    }
+    PathState path;
+    path.ray = calculateSampleRay(origin.xIndex, origin.yIndex, differential);
+    path.index = index;
+    suspendPath(path);
+    return path;
+  }
+
+  void resumePath(const PathState& path, const PathOrigin& origin) {
+    if (mSampler) {
+      mSampler->startPixelSample(origin.xIndex, origin.yIndex,
+                                 origin.sampleIndex);
+      mSampler->setDimension(static_cast<std::uint32_t>(path.random));
+    } else {
+      utils::seedRandom(path.random);
+    }
+  }
+
+  void suspendPath(PathState& path) {
+    path.random =
+        mSampler ? mSampler->dimension() : utils::randomGenerator().state();
+  }
+
+  // calculateRayColor() for one bounce of a batched path: adds what the
+  // bounce contributes and returns whether the path goes on.
+  bool traceBounce(PathState& path, const PathOrigin& origin, int depth,
+                   const Hittable& world, const Hittable* lights,
+                   FirstHit* firstHit) {
+    resumePath(path, origin);
+    stats::addPathRay(depth == mMaxDepth);
+    ++path.rays;
+
+    bool continues = false;
+    HitRecord hitInfo;
+    if (!world.hit(path.ray, Interval{0.001, utils::INFINITE_DOUBLE},
+                   hitInfo)) {
+      if (firstHit != nullptr) {
+        firstHit->albedo = color::White;
+      }
+      path.radiance += path.throughput * mBackgroundColor;
+    } else {
+      stats::add(stats::Counter::Hits);
+      if (path.ray.differential() != nullptr) {
+        hitInfo.computeUVDifferentials(*path.ray.differential());
+      }
+      const Bounce bounce = visitMaterial(
+          *hitInfo.material, [&](const auto& material) -> Bounce {
+            return shade(material, path.ray, hitInfo, world, lights,
+                         firstHit);
+          });
+      path.radiance += path.throughput * bounce.emission;
+      if (bounce.scattered) {
+        path.throughput = path.throughput * bounce.weight / bounce.pdf;
+        path.ray = bounce.next;
+        continues = true;
+      }
+    }
+    suspendPath(path);
+    return continues;
+  }
+
+  [[nodiscard]] std::uint32_t pixelSeed(int xIndex, int yIndex) const {
+    // Murmur3 finalizer over seed and position, so neighbouring pixels get
+    // unrelated streams.
+    constexpr std::uint32_t kGoldenRatio = 0x9e3779b9U;
+    std::uint32_t hash = (static_cast<std::uint32_t>(yIndex) *
+                              static_cast<std::uint32_t>(mImageWidth) +
+                          static_cast<std::uint32_t>(xIndex)) +
+                         mSeed * kGoldenRatio;
+    hash ^= hash >> 16U;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13U;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16U;
+    return hash;
+  }
+
+  // Variance of a pixel's mean colour, averaged over the channels, from the
+  // sums of its samples and of their squares.
+  // sampleScale is one over the number of samples.
+  [[nodiscard]] static double meanVariance(const Color& sum,
+                                           const Color& squares,
+                                           double sampleScale) {
+    const Color mean = sum * sampleScale;
+    const Color sampleVariance = squares * sampleScale - mean * mean;
+    const double channelMean =
+        (sampleVariance.x() + sampleVariance.y() + sampleVariance.z()) / 3;
+    return std::fmax(0, channelMean) * sampleScale;
+  }
+
+  void reportStatistics() {
+    if constexpr (stats::kEnabled) {
+      mStatistics = stats::collect();
+      mStatistics.writeText(std::clog);
+      if (!mStatisticsFile.empty()) {
+        std::ofstream file{mStatisticsFile};
+        mStatistics.writeJson(file);
+      }
+    }
   }
 
-private:
   int mImageHeight{};
   double mPixelSampleScale{};
+  double mDifferentialScale{};
   Vec3 mCenter;
   Vec3 mPixelDeltaX;
   Vec3 mPixelDeltaY;
@@ -58,11 +987,24 @@ private:
   Vec3 mDefocusDiskU;
   Vec3 mDefocusDiskV;
 
+  stats::Report mStatistics;
+  BudgetReport mBudgetReport;
+  // Shared by copies of the camera only until they render: initialize()
+  // makes a new one, so copies can render on different threads.
+  std::shared_ptr<Sampler> mSampler;
+
   void initialize() {
-    mImageHeight = std::max(int(mImageWidth / mAspectRatio), 1);
+    mImageHeight = imageHeight();
+    mSampler = makeSampler(mSamplerType, mSamplesPerPixel, mSeed);
 
     mPixelSampleScale = 1.0 / mSamplesPerPixel;
 
+    // With many samples per pixel each one only needs to cover a fraction of
+    // the pixel, so texture filtering can stay sharper.
+    constexpr double kMinimumDifferentialScale = 0.125;
+    mDifferentialScale = std::fmax(kMinimumDifferentialScale,
+                                   1.0 / std::sqrt(mSamplesPerPixel));
+
     mCenter = mLookFrom;
 
     const double theta = utils::toRadians(mVerticalFov);
@@ -94,7 +1036,8 @@ private:
     mDefocusDiskV = mV * defocusRadius;
   };
 
-  [[nodiscard]] Ray calculateSampleRay(int xIndex, int yIndex) const {
+  [[nodiscard]] Ray calculateSampleRay(int xIndex, int yIndex,
+                                       RayDifferential& differential) const {
 
     const Vec3 offset = samplePixelCenterOffset();
     const Vec3 centerDelta = ((yIndex + offset.y()) * mPixelDeltaY) +
@@ -105,7 +1048,14 @@ private:
     const Vec3 rayDirection = pixelCenter - rayOrigin;
     const double rayTime = utils::randomDouble();
 
-    return {rayOrigin, rayDirection, rayTime};
+    differential.xOrigin = rayOrigin;
+    differential.yOrigin = rayOrigin;
+    differential.xDirection =
+        rayDirection + mDifferentialScale * mPixelDeltaX;
+    differential.yDirection =
+        rayDirection + mDifferentialScale * mPixelDeltaY;
+
+    return {rayOrigin, rayDirection, rayTime, &differential};
   }
 
   [[nodiscard]] Vec3 defocusDiskSample() const {
@@ -116,29 +1066,98 @@ private:
   [[nodiscard]] static Vec3 samplePixelCenterOffset() {
     // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit
     // square.
-    return {utils::randomDouble() - 0.5, utils::randomDouble() - 0.5, 0};
+    const auto [r1, r2] = utils::randomPair();
+    return {r1 - 0.5, r2 - 0.5, 0};
   }
 
-  Color calculateRayColor(const Ray& ray, int depth, const Hittable& world) {
+  Color calculateRayColor(const Ray& ray, int depth, const Hittable& world,
+                          const Hittable* lights,
+                          FirstHit* firstHit = nullptr) {
     if (depth <= 0) {
       return color::Black;
     }
+    stats::addPathRay(depth == mMaxDepth);
     HitRecord hitInfo;
     if (!world.hit(ray, Interval{0.001, utils::INFINITE_DOUBLE}, hitInfo)) {
+      if (firstHit != nullptr) {
+        firstHit->albedo = color::White;
+      }
       return mBackgroundColor;
     }
+    stats::add(stats::Counter::Hits);
+    if (ray.differential() != nullptr) {
+      hitInfo.computeUVDifferentials(*ray.differential());
+    }
 
-    Ray scattered{};
-    Color attenuation{};
-    Color emissionColor{
-        hitInfo.material->emitted(hitInfo.uv, hitInfo.position)};
-    if (!hitInfo.material->scatter(ray, hitInfo, attenuation, scattered)) {
-      return emissionColor;
+    const Bounce bounce = visitMaterial(
+        *hitInfo.material, [&](const auto& material) -> Bounce {
+          return shade(material, ray, hitInfo, world, lights, firstHit);
+        });
+    if (!bounce.scattered) {
+      return bounce.emission;
+    }
+    return bounce.emission +
+           bounce.weight *
+               calculateRayColor(bounce.next, depth - 1, world, lights) /
+               bounce.pdf;
+  }
+
+  // What a hit contributes to its path: the light it emits and, if the path
+  // goes on, the ray to continue along. The light arriving back along that
+  // ray counts weight * incoming / pdf.
+  struct Bounce {
+    Color emission;
+    bool scattered{};
+    Ray next{};
+    Color weight{};
+    double pdf{1};
+  };
+
+  // The rest of calculateRayColor, for a hit on the given material.
+  template <typename Material>
+  Bounce shade(const Material& material, const Ray& ray,
+               const HitRecord& hitInfo, const Hittable& world,
+               const Hittable* lights, FirstHit* firstHit) {
+    ScatterRecord scatterInfo;
+    const Color emissionColor{material.emitted(hitInfo.uv, hitInfo.position)};
+    Bounce bounce{.emission = emissionColor};
+    if (firstHit != nullptr) {
+      firstHit->albedo = material.albedo(hitInfo);
+      firstHit->normal = hitInfo.normal();
+      firstHit->depth = hitInfo.t * ray.direction().length();
+      firstHit->position = hitInfo.position;
+      firstHit->emission = emissionColor;
+      firstHit->materialId = material.id();
+    }
+    if (!material.sample(ray, hitInfo, scatterInfo)) {
+      return bounce;
     }
 
-    Color scatterColor =
-        attenuation * calculateRayColor(scattered, depth - 1, world);
+    if (scatterInfo.skipPdf) {
+      bounce.scattered = true;
+      bounce.next = scatterInfo.skipPdfRay;
+      bounce.weight = scatterInfo.attenuation;
+      return bounce;
+    }
+
+    const PDF* samplingPdf = scatterInfo.samplingPdf();
+    const HittablePDF lightPdf{lights != nullptr ? *lights : world,
+                               hitInfo.position};
+    const MixturePDF mixturePdf{lightPdf, *samplingPdf};
+    if (lights != nullptr) {
+      samplingPdf = &mixturePdf;
+    }
+
+    const Ray scattered{hitInfo.position, samplingPdf->generate(), ray.time()};
+    const auto pdfValue = samplingPdf->value(scattered.direction());
+    if (pdfValue <= 0) {
+      return bounce;
+    }
 
-    return emissionColor + scatterColor;
+    bounce.scattered = true;
+    bounce.next = scattered;
+    bounce.weight = material.eval(ray, hitInfo, scattered);
+    bounce.pdf = pdfValue;
+    return bounce;
   }
 };
\ No newline at end of file
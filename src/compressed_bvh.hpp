@@ -0,0 +1,358 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "interval.hpp"
+#include "stats.hpp"
+#include "vec3.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Four-wide BVH for scenes too large for BVHNode, which spends well over 100
+// bytes on every node. Nodes here take one 64-byte cache line and store the
+// boxes of their children as 8-bit offsets from their own box. A quantized
+// box is rounded outwards, so it always contains the exact one, and rays test
+// the exact objects in the leaves.
+//
+// The tree is built once, from the objects' swept boxes, and holds fewer than
+// 2^31 objects. Objects that move a lot during the shutter are better off in
+// a BVHNode.
+class CompressedBVH : public Hittable {
+public:
+  CompressedBVH(HittableList list) : mObjects{std::move(list.getObjects())} {
+    std::vector<Primitive> primitives;
+    primitives.reserve(mObjects.size());
+    for (size_t i = 0; i < mObjects.size(); ++i) {
+      const AABB box = mObjects[i]->boundingBox();
+      primitives.push_back({box, center(box), static_cast<std::uint32_t>(i)});
+      mBoundingBox = AABB{mBoundingBox, box};
+    }
+    if (primitives.empty()) {
+      return;
+    }
+    mNodes.reserve(primitives.size() / 2 + 1);
+    build(primitives, 0, primitives.size(), mBoundingBox);
+
+    // Leaves index the objects in the order the build left them in.
+    std::vector<std::shared_ptr<Hittable>> ordered;
+    ordered.reserve(primitives.size());
+    for (const Primitive& primitive : primitives) {
+      ordered.push_back(std::move(mObjects[primitive.object]));
+    }
+    mObjects = std::move(ordered);
+  }
+
+  bool hit(const Ray& ray, Interval rayRange,
+           HitRecord& hitInfo) const override {
+    if (mNodes.empty()) {
+      return false;
+    }
+    const RayFrame frame{ray};
+    bool hitAnything = false;
+
+    std::array<Entry, kStackSize> stack;
+    size_t stackSize = 0;
+    stack[stackSize++] = {0, rayRange.min()};
+    while (stackSize > 0) {
+      const Entry entry = stack[--stackSize];
+      if (entry.t > rayRange.max()) {
+        continue;
+      }
+      if ((entry.child & kLeafBit) != 0) {
+        if (mObjects[entry.child & ~kLeafBit]->hit(ray, rayRange, hitInfo)) {
+          hitAnything = true;
+          rayRange = Interval{rayRange.min(), hitInfo.t};
+        }
+        continue;
+      }
+
+      std::array<Entry, kWidth> hits;
+      const size_t hitCount =
+          intersectChildren(mNodes[entry.child], frame, rayRange, hits);
+      // Pushed farthest first, so the nearest child is visited next.
+      const size_t first = stackSize;
+      for (size_t i = 0; i < hitCount; ++i) {
+        size_t slot = stackSize++;
+        while (slot > first && stack[slot - 1].t < hits[i].t) {
+          stack[slot] = stack[slot - 1];
+          --slot;
+        }
+        stack[slot] = hits[i];
+      }
+    }
+    return hitAnything;
+  }
+
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    if (mNodes.empty()) {
+      return false;
+    }
+    const RayFrame frame{ray};
+
+    std::array<Entry, kStackSize> stack;
+    size_t stackSize = 0;
+    stack[stackSize++] = {0, rayRange.min()};
+    while (stackSize > 0) {
+      const Entry entry = stack[--stackSize];
+      if ((entry.child & kLeafBit) != 0) {
+        if (mObjects[entry.child & ~kLeafBit]->occluded(ray, rayRange)) {
+          return true;
+        }
+        continue;
+      }
+
+      std::array<Entry, kWidth> hits;
+      const size_t hitCount =
+          intersectChildren(mNodes[entry.child], frame, rayRange, hits);
+      for (size_t i = 0; i < hitCount; ++i) {
+        stack[stackSize++] = hits[i];
+      }
+    }
+    return false;
+  }
+
+  [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("CompressedBVH");
+    for (const auto& object : mObjects) {
+      object->fingerprint(print);
+    }
+  }
+
+  void forEachObject(
+      const std::function<void(const Hittable&)>& visit) const override {
+    for (const auto& object : mObjects) {
+      object->forEachObject(visit);
+    }
+  }
+
+  [[nodiscard]] size_t nodeCount() const { return mNodes.size(); }
+
+  // Bytes held by the tree: its nodes and the pointers to its objects.
+  [[nodiscard]] size_t memoryBytes() const {
+    return mNodes.size() * sizeof(Node) +
+           mObjects.size() * sizeof(std::shared_ptr<Hittable>);
+  }
+
+private:
+  static constexpr size_t kWidth = 4;
+  // Children with this bit set are objects, the others nodes.
+  static constexpr std::uint32_t kLeafBit = std::uint32_t{1} << 31;
+  static constexpr std::uint8_t kQuantizedMax = 255;
+  // The split below keeps the tree balanced, so with fewer than 2^31 objects
+  // it is at most 16 levels deep, each pushing at most three more entries.
+  static constexpr size_t kStackSize = 64;
+
+  // Child i spans, along each axis, from origin + low[axis][i] * 2^exponent
+  // to origin + high[axis][i] * 2^exponent.
+  struct alignas(64) Node {
+    std::array<float, 3> origin;
+    std::array<std::int8_t, 3> exponent;
+    std::uint8_t childCount;
+    std::array<std::array<std::uint8_t, kWidth>, 3> low;
+    std::array<std::array<std::uint8_t, kWidth>, 3> high;
+    std::array<std::uint32_t, kWidth> children;
+  };
+  static_assert(sizeof(Node) == 64);
+
+  struct Primitive {
+    AABB box;
+    Vec3 center;
+    std::uint32_t object;
+  };
+
+  // A child still to visit, and where the ray enters its box.
+  struct Entry {
+    std::uint32_t child;
+    double t;
+  };
+
+  // Per-ray values shared by every node test.
+  struct RayFrame {
+    explicit RayFrame(const Ray& ray) : origin{ray.origin()} {
+      for (size_t axis = 0; axis < 3; ++axis) {
+        inverseDirection[axis] = 1.0 / ray.direction()[axis];
+      }
+    }
+    Vec3 origin;
+    Vec3 inverseDirection;
+  };
+
+  std::vector<std::shared_ptr<Hittable>> mObjects;
+  std::vector<Node> mNodes;
+  AABB mBoundingBox = AABB::empty;
+
+  static Vec3 center(const AABB& box) {
+    return {0.5 * (box.mX.min() + box.mX.max()),
+            0.5 * (box.mY.min() + box.mY.max()),
+            0.5 * (box.mZ.min() + box.mZ.max())};
+  }
+
+  static double powerOfTwo(int exponent) {
+    return std::bit_cast<double>(static_cast<std::uint64_t>(exponent + 1023)
+                                 << 52);
+  }
+
+  size_t intersectChildren(const Node& node, const RayFrame& frame,
+                           Interval rayRange,
+                           std::array<Entry, kWidth>& hits) const {
+    stats::add(stats::Counter::BVHNodesVisited);
+    stats::add(stats::Counter::BoxTests, node.childCount);
+
+    // Slab distances are affine in the quantized coordinates.
+    std::array<double, 3> base{};
+    std::array<double, 3> step{};
+    for (size_t axis = 0; axis < 3; ++axis) {
+      base[axis] = (static_cast<double>(node.origin[axis]) -
+                    frame.origin[axis]) *
+                   frame.inverseDirection[axis];
+      step[axis] =
+          powerOfTwo(node.exponent[axis]) * frame.inverseDirection[axis];
+    }
+
+    size_t hitCount = 0;
+    for (size_t i = 0; i < node.childCount; ++i) {
+      double near = rayRange.min();
+      double far = rayRange.max();
+      for (size_t axis = 0; axis < 3; ++axis) {
+        double t0 = base[axis] + node.low[axis][i] * step[axis];
+        double t1 = base[axis] + node.high[axis][i] * step[axis];
+        if (t0 > t1) {
+          std::swap(t0, t1);
+        }
+        near = t0 > near ? t0 : near;
+        far = t1 < far ? t1 : far;
+      }
+      if (near <= far) {
+        hits[hitCount++] = {node.children[i], near};
+      }
+    }
+    return hitCount;
+  }
+
+  // Builds the node over primitives[start, end), whose boxes lie in bounds,
+  // and returns its index.
+  std::uint32_t build(std::vector<Primitive>& primitives, size_t start,
+                      size_t end, const AABB& bounds) {
+    const auto index = static_cast<std::uint32_t>(mNodes.size());
+    mNodes.emplace_back();
+
+    // Split the largest group at its median until there are four.
+    std::array<std::pair<size_t, size_t>, kWidth> groups{};
+    size_t groupCount = 1;
+    groups[0] = {start, end};
+    while (groupCount < kWidth) {
+      auto largest = std::max_element(
+          groups.begin(), groups.begin() + static_cast<long>(groupCount),
+          [](const auto& a, const auto& b) {
+            return a.second - a.first < b.second - b.first;
+          });
+      const auto [first, last] = *largest;
+      if (last - first < 2) {
+        break;
+      }
+      const size_t mid = first + (last - first) / 2;
+      splitAtMedian(primitives, first, mid, last);
+      *largest = {first, mid};
+      groups[groupCount++] = {mid, last};
+    }
+    std::sort(groups.begin(), groups.begin() + static_cast<long>(groupCount));
+
+    std::array<AABB, kWidth> boxes{};
+    std::array<std::uint32_t, kWidth> children{};
+    for (size_t i = 0; i < groupCount; ++i) {
+      const auto [first, last] = groups[i];
+      boxes[i] = AABB::empty;
+      for (size_t p = first; p < last; ++p) {
+        boxes[i] = AABB{boxes[i], primitives[p].box};
+      }
+      children[i] = last - first == 1
+                        ? kLeafBit | static_cast<std::uint32_t>(first)
+                        : build(primitives, first, last, boxes[i]);
+    }
+
+    // Building the children may have moved the nodes.
+    Node& node = mNodes[index];
+    node.childCount = static_cast<std::uint8_t>(groupCount);
+    node.children = children;
+    for (size_t axis = 0; axis < 3; ++axis) {
+      const Interval& extent = bounds.axisInterval(axis);
+      // The origin rounds down, and the scale up to a power of two, so the
+      // frame covers the whole node.
+      auto origin = static_cast<float>(extent.min());
+      if (static_cast<double>(origin) > extent.min()) {
+        origin = std::nextafter(origin, -std::numeric_limits<float>::max());
+      }
+      const double size = extent.max() - static_cast<double>(origin);
+      int exponent = std::numeric_limits<std::int8_t>::min();
+      if (size > 0) {
+        (void)std::frexp(size / kQuantizedMax, &exponent);
+        --exponent;
+        while (kQuantizedMax * powerOfTwo(exponent) < size) {
+          ++exponent;
+        }
+        exponent = std::clamp<int>(exponent,
+                                   std::numeric_limits<std::int8_t>::min(),
+                                   std::numeric_limits<std::int8_t>::max());
+      }
+      node.origin[axis] = origin;
+      node.exponent[axis] = static_cast<std::int8_t>(exponent);
+
+      const double scale = powerOfTwo(exponent);
+      for (size_t i = 0; i < kWidth; ++i) {
+        if (i >= groupCount) {
+          node.low[axis][i] = kQuantizedMax;
+          node.high[axis][i] = 0;
+          continue;
+        }
+        const Interval& child = boxes[i].axisInterval(axis);
+        node.low[axis][i] =
+            quantize(std::floor((child.min() - origin) / scale), child.min(),
+                     origin, scale, -1);
+        node.high[axis][i] =
+            quantize(std::ceil((child.max() - origin) / scale), child.max(),
+                     origin, scale, 1);
+      }
+    }
+    return index;
+  }
+
+  // Clamps an offset to the 8-bit range, stepping it in direction until it
+  // lies on the outer side of value despite rounding in the subtraction.
+  static std::uint8_t quantize(double offset, double value, double origin,
+                               double scale, double direction) {
+    offset = std::clamp(offset, 0.0, double{kQuantizedMax});
+    while (offset + direction >= 0 && offset + direction <= kQuantizedMax &&
+           (origin + offset * scale - value) * direction < 0) {
+      offset += direction;
+    }
+    return static_cast<std::uint8_t>(offset);
+  }
+
+  static void splitAtMedian(std::vector<Primitive>& primitives, size_t start,
+                            size_t mid, size_t end) {
+    AABB centers = AABB::empty;
+    for (size_t p = start; p < end; ++p) {
+      centers = AABB{centers, AABB{primitives[p].center, primitives[p].center}};
+    }
+    const size_t axis = centers.longestAxis();
+    std::nth_element(primitives.begin() + static_cast<long>(start),
+                     primitives.begin() + static_cast<long>(mid),
+                     primitives.begin() + static_cast<long>(end),
+                     [axis](const Primitive& a, const Primitive& b) {
+                       return a.center[axis] < b.center[axis];
+                     });
+  }
+};
@@ -1,8 +1,10 @@
 #pragma once
 
+#include "arena.hpp"
 #include "hittable.hpp"
 #include "interval.hpp"
 #include "material.hpp"
+#include "stats.hpp"
 #include "texture.hpp"
 #include "utils.hpp"
 #include <cmath>
@@ -12,50 +14,36 @@ public:
   ConstantMedium(double density, std::shared_ptr<Texture> texture,
                  std::shared_ptr<Hittable> boundry)
       : mNegativeInverseDensity{-1.0 / density},
-        phaseMaterial{std::make_shared<Isotropic>(texture)},
+        phaseMaterial{makeShared<Isotropic>(texture)},
         mBoundary{boundry} {}
   ConstantMedium(double density, const Color& albedo,
                  std::shared_ptr<Hittable> boundry)
       : mNegativeInverseDensity{-1.0 / density},
-        phaseMaterial{std::make_shared<Isotropic>(albedo)}, mBoundary{boundry} {
+        phaseMaterial{makeShared<Isotropic>(albedo)}, mBoundary{boundry} {
   }
 
   bool hit(const Ray& ray, Interval rayRange,
            HitRecord& hitInfo) const override {
-    HitRecord entryPoint;
-    HitRecord exitPoint;
-
-    if (!mBoundary->hit(ray, Interval::universe, entryPoint)) {
-      return false;
-    }
-
-    if (!mBoundary->hit(
-            ray, Interval{entryPoint.t + kEpsilon, utils::INFINITE_DOUBLE},
-            exitPoint)) {
-      return false;
-    }
-
-    entryPoint.t = std::fmax(entryPoint.t, rayRange.min());
-    exitPoint.t = std::fmin(exitPoint.t, rayRange.max());
-
-    if (entryPoint.t >= exitPoint.t) {
+    stats::add(stats::Counter::MediumTests);
+    Interval span;
+    if (!mBoundary->hitSpan(ray, rayRange, span)) {
       return false;
     }
 
-    if (entryPoint.t < 0) {
-      entryPoint.t = 0;
-    }
+    const auto entryT = std::fmax(span.min(), 0.0);
+    const auto exitT = span.max();
 
     auto rayLength = ray.direction().length();
-    auto distanceInsideVolume = (exitPoint.t - entryPoint.t) * rayLength;
+    auto distanceInsideVolume = (exitT - entryT) * rayLength;
     auto hitDistance =
         mNegativeInverseDensity * std::log(utils::randomDouble());
 
     if (hitDistance > distanceInsideVolume) {
       return false;
     }
+    stats::add(stats::Counter::MediumScatters);
 
-    hitInfo.t = entryPoint.t + hitDistance / rayLength;
+    hitInfo.t = entryT + hitDistance / rayLength;
     hitInfo.position = ray.at(hitInfo.t);
 
     hitInfo.setFaceNormal(ray, Vec3{1, 0, 0}); // arbitrary
@@ -64,12 +52,34 @@ public:
     return true;
   }
 
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    // Draws a scattering distance exactly as hit() does.
+    stats::add(stats::Counter::MediumTests);
+    Interval span;
+    if (!mBoundary->hitSpan(ray, rayRange, span)) {
+      return false;
+    }
+
+    const auto entryT = std::fmax(span.min(), 0.0);
+    const auto distanceInsideVolume =
+        (span.max() - entryT) * ray.direction().length();
+    return mNegativeInverseDensity * std::log(utils::randomDouble()) <=
+           distanceInsideVolume;
+  }
+
   [[nodiscard]] AABB boundingBox() const override {
     return mBoundary->boundingBox();
   }
 
+  void fingerprint(Fingerprint& print) const override {
+    print.add("ConstantMedium");
+    print.add(mNegativeInverseDensity);
+    phaseMaterial->fingerprint(print);
+    mBoundary->fingerprint(print);
+  }
+
 private:
-  static constexpr double kEpsilon = 0.0001;
   double mNegativeInverseDensity;
   std::shared_ptr<IMaterial> phaseMaterial;
   std::shared_ptr<Hittable> mBoundary;
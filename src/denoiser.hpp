@@ -0,0 +1,367 @@
+#pragma once
+
+#include "framebuffer.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010). Each pass
+// applies a 5x5 B3 spline kernel with holes of 2^pass pixels, weighting every
+// tap by how similar its first-hit albedo, normal and depth and its current
+// colour are to the centre pixel. Texture detail is kept by filtering the
+// colour divided by albedo and multiplying it back afterwards.
+//
+// As in SVGF (Schied et al. 2017) colour differences are measured against the
+// estimated variance of each pixel, which is filtered alongside the colour.
+// Noisy pixels and fireflies are then blended with their neighbours while
+// converged edges stay sharp.
+//
+// Rows are filtered in parallel, and the inner loops run over padded
+// contiguous float planes without branches so the compiler vectorizes them.
+class Denoiser {
+public:
+  struct Settings {
+    int passes = 5;
+    // In standard deviations of the centre pixel.
+    float colorSigma = 4.0F;
+    float albedoSigma = 0.1F;
+    float normalSigma = 0.3F;
+    // Relative to the centre pixel's depth.
+    float depthSigma = 0.05F;
+    // Clamps every pixel to the brightest of its eight neighbours first, as
+    // a single very bright sample is too rare to be filtered away.
+    bool suppressFireflies = true;
+  };
+
+  // color, albedo and normal have three channels. depth and variance have
+  // one; variance is that of the pixel's mean colour, averaged over channels.
+  [[nodiscard]] static FrameBuffer denoise(const FrameBuffer& color,
+                                           const FrameBuffer& albedo,
+                                           const FrameBuffer& normal,
+                                           const FrameBuffer& depth,
+                                           const FrameBuffer& variance,
+                                           const Settings& settings) {
+    const int width = color.width();
+    const int height = color.height();
+    const int passes = std::clamp(settings.passes, 1, kMaximumPasses);
+    const int pad = 2 << (passes - 1);
+
+    std::array<Plane, 3> guideAlbedo;
+    std::array<Plane, 3> guideNormal;
+    Plane guideDepth{width, height, pad};
+    std::array<Plane, 4> current;
+    std::array<Plane, 4> next;
+    for (int channel = 0; channel < 3; ++channel) {
+      const auto c = static_cast<size_t>(channel);
+      guideAlbedo[c] = Plane{width, height, pad};
+      guideNormal[c] = Plane{width, height, pad};
+      current[c] = Plane{width, height, pad};
+      next[c] = Plane{width, height, pad};
+      guideAlbedo[c].load(albedo.plane(channel));
+      guideNormal[c].load(normal.plane(channel));
+      current[c].load(color.plane(channel));
+    }
+    guideDepth.load(depth.plane(0));
+    current[kVariance] = Plane{width, height, pad};
+    next[kVariance] = Plane{width, height, pad};
+    current[kVariance].load(variance.plane(0));
+
+    // Demodulate, so the filter only has to smooth lighting.
+    for (int yIndex = 0; yIndex < height; ++yIndex) {
+      float* varianceRow = current[kVariance].row(yIndex);
+      for (size_t c = 0; c < 3; ++c) {
+        float* colorRow = current[c].row(yIndex);
+        const float* albedoRow = guideAlbedo[c].row(yIndex);
+        for (int xIndex = 0; xIndex < width; ++xIndex) {
+          colorRow[xIndex] /= albedoRow[xIndex] + kEpsilon;
+        }
+      }
+      for (int xIndex = 0; xIndex < width; ++xIndex) {
+        const float meanAlbedo = (guideAlbedo[0].row(yIndex)[xIndex] +
+                                  guideAlbedo[1].row(yIndex)[xIndex] +
+                                  guideAlbedo[2].row(yIndex)[xIndex]) /
+                                     3 +
+                                 kEpsilon;
+        varianceRow[xIndex] /= meanAlbedo * meanAlbedo;
+      }
+    }
+    if (settings.suppressFireflies) {
+      for (size_t c = 0; c < 3; ++c) {
+        clampToNeighbours(current[c], width, height);
+      }
+    }
+
+    const Inverses inverses{
+        1.0F / (settings.albedoSigma * settings.albedoSigma),
+        1.0F / (settings.normalSigma * settings.normalSigma),
+        1.0F / (settings.depthSigma * settings.depthSigma)};
+    const float colorSigmaSquared = settings.colorSigma * settings.colorSigma;
+
+    for (int pass = 0; pass < passes; ++pass) {
+      for (auto& plane : current) {
+        plane.replicateEdges();
+      }
+      const int step = 1 << pass;
+
+      utils::parallelFor(0, height, [&](int yIndex) {
+        std::array<std::vector<float>, 4> sum;
+        for (auto& channel : sum) {
+          channel.assign(static_cast<size_t>(width), 0.0F);
+        }
+        std::vector<float> weightSum(static_cast<size_t>(width), 0.0F);
+        std::vector<float> inverseColor(static_cast<size_t>(width));
+        const float* centreVariance = current[kVariance].row(yIndex);
+        for (size_t xIndex = 0; xIndex < inverseColor.size(); ++xIndex) {
+          inverseColor[xIndex] =
+              1.0F / (colorSigmaSquared * centreVariance[xIndex] + kEpsilon);
+        }
+
+        const Pixel centre = pixelRow(current, guideAlbedo, guideNormal,
+                                      guideDepth, yIndex, 0);
+        for (int ky = -2; ky <= 2; ++ky) {
+          const int tapY = std::clamp(yIndex + ky * step, 0, height - 1);
+          for (int kx = -2; kx <= 2; ++kx) {
+            const Pixel tap = pixelRow(current, guideAlbedo, guideNormal,
+                                       guideDepth, tapY, kx * step);
+            const float kernel = kKernel[static_cast<size_t>(ky + 2)] *
+                                 kKernel[static_cast<size_t>(kx + 2)];
+            accumulate(centre, tap, kernel, inverses, inverseColor.data(),
+                       width, sum[0].data(), sum[1].data(), sum[2].data(),
+                       sum[kVariance].data(), weightSum.data());
+          }
+        }
+
+        for (size_t c = 0; c < 3; ++c) {
+          float* out = next[c].row(yIndex);
+          for (size_t xIndex = 0; xIndex < static_cast<size_t>(width);
+               ++xIndex) {
+            out[xIndex] = sum[c][xIndex] / weightSum[xIndex];
+          }
+        }
+        float* outVariance = next[kVariance].row(yIndex);
+        for (size_t xIndex = 0; xIndex < static_cast<size_t>(width);
+             ++xIndex) {
+          outVariance[xIndex] = sum[kVariance][xIndex] /
+                                (weightSum[xIndex] * weightSum[xIndex]);
+        }
+      });
+
+      std::swap(current, next);
+    }
+
+    FrameBuffer result{width, height, 3};
+    for (int channel = 0; channel < 3; ++channel) {
+      const auto c = static_cast<size_t>(channel);
+      float* out = result.plane(channel);
+      for (int yIndex = 0; yIndex < height; ++yIndex) {
+        const float* colorRow = current[c].row(yIndex);
+        const float* albedoRow = guideAlbedo[c].row(yIndex);
+        for (int xIndex = 0; xIndex < width; ++xIndex) {
+          out[static_cast<size_t>(yIndex) * static_cast<size_t>(width) +
+              static_cast<size_t>(xIndex)] =
+              colorRow[xIndex] * (albedoRow[xIndex] + kEpsilon);
+        }
+      }
+    }
+    return result;
+  }
+
+private:
+  static constexpr int kMaximumPasses = 8;
+  static constexpr size_t kVariance = 3;
+  static constexpr float kEpsilon = 1e-3F;
+  static constexpr std::array<float, 5> kKernel{1.0F / 16, 1.0F / 4,
+                                                3.0F / 8, 1.0F / 4, 1.0F / 16};
+
+  // Single channel image with `pad` extra columns on both sides, filled with
+  // copies of the edge pixels, so horizontal taps never need clamping.
+  class Plane {
+  public:
+    Plane() = default;
+    Plane(int width, int height, int pad)
+        : mWidth{width}, mHeight{height}, mPad{pad},
+          mData(static_cast<size_t>(width + 2 * pad) *
+                static_cast<size_t>(height)) {}
+
+    [[nodiscard]] float* row(int yIndex) {
+      return mData.data() + offset(yIndex);
+    }
+    [[nodiscard]] const float* row(int yIndex) const {
+      return mData.data() + offset(yIndex);
+    }
+
+    void load(const float* source) {
+      for (int yIndex = 0; yIndex < mHeight; ++yIndex) {
+        std::copy_n(source + static_cast<size_t>(yIndex) *
+                                 static_cast<size_t>(mWidth),
+                    mWidth, row(yIndex));
+      }
+      replicateEdges();
+    }
+
+    void replicateEdges() {
+      for (int yIndex = 0; yIndex < mHeight; ++yIndex) {
+        float* pixels = row(yIndex);
+        std::fill(pixels - mPad, pixels, pixels[0]);
+        std::fill(pixels + mWidth, pixels + mWidth + mPad, pixels[mWidth - 1]);
+      }
+    }
+
+  private:
+    int mWidth{};
+    int mHeight{};
+    int mPad{};
+    std::vector<float> mData;
+
+    [[nodiscard]] size_t offset(int yIndex) const {
+      return static_cast<size_t>(yIndex) *
+                 static_cast<size_t>(mWidth + 2 * mPad) +
+             static_cast<size_t>(mPad);
+    }
+  };
+
+  static void clampToNeighbours(Plane& plane, int width, int height) {
+    std::vector<float> source(static_cast<size_t>(width) *
+                              static_cast<size_t>(height));
+    for (int yIndex = 0; yIndex < height; ++yIndex) {
+      std::copy_n(plane.row(yIndex), width,
+                  source.begin() + static_cast<std::ptrdiff_t>(yIndex) * width);
+    }
+    const auto value = [&](int xIndex, int yIndex) {
+      return source[static_cast<size_t>(std::clamp(yIndex, 0, height - 1)) *
+                        static_cast<size_t>(width) +
+                    static_cast<size_t>(std::clamp(xIndex, 0, width - 1))];
+    };
+
+    for (int yIndex = 0; yIndex < height; ++yIndex) {
+      float* row = plane.row(yIndex);
+      for (int xIndex = 0; xIndex < width; ++xIndex) {
+        float brightest = 0.0F;
+        for (int dy = -1; dy <= 1; ++dy) {
+          for (int dx = -1; dx <= 1; ++dx) {
+            if (dx != 0 || dy != 0) {
+              brightest = std::max(brightest, value(xIndex + dx, yIndex + dy));
+            }
+          }
+        }
+        row[xIndex] = std::min(row[xIndex], brightest);
+      }
+    }
+  }
+
+  // Inverse squared sigmas of the guide features.
+  struct Inverses {
+    float albedo;
+    float normal;
+    float depth;
+  };
+
+  // Row pointers of every plane, shifted horizontally by a tap offset.
+  struct Pixel {
+    std::array<const float*, 4> color;
+    std::array<const float*, 3> albedo;
+    std::array<const float*, 3> normal;
+    const float* depth;
+  };
+
+  static Pixel pixelRow(const std::array<Plane, 4>& color,
+                        const std::array<Plane, 3>& albedo,
+                        const std::array<Plane, 3>& normal,
+                        const Plane& depth, int yIndex, int xOffset) {
+    Pixel pixel{};
+    for (size_t c = 0; c < 3; ++c) {
+      pixel.color[c] = color[c].row(yIndex) + xOffset;
+      pixel.albedo[c] = albedo[c].row(yIndex) + xOffset;
+      pixel.normal[c] = normal[c].row(yIndex) + xOffset;
+    }
+    pixel.color[kVariance] = color[kVariance].row(yIndex) + xOffset;
+    pixel.depth = depth.row(yIndex) + xOffset;
+    return pixel;
+  }
+
+  // exp(-x) for x >= 0 as (1 - x/256)^256, which unlike std::exp vectorizes.
+  static float negativeExp(float x) {
+    // max(base, 0) through fabs, since a float compare may trap and would
+    // keep the compiler from if-converting the caller's loop. The squarings
+    // are spelled out for the same reason.
+    const float base = 1.0F - x * (1.0F / 256);
+    float result = 0.5F * (base + std::fabs(base));
+    result *= result; // ^2
+    result *= result; // ^4
+    result *= result; // ^8
+    result *= result; // ^16
+    result *= result; // ^32
+    result *= result; // ^64
+    result *= result; // ^128
+    return result * result;
+  }
+
+  // The outputs are restrict parameters so the compiler needs no run-time
+  // alias checks against the many input rows, and the inputs are copied to
+  // plain pointers as loads through the Pixel arrays would not vectorize.
+  static void accumulate(const Pixel& centre, const Pixel& tap, float kernel,
+                         const Inverses& inverses,
+                         const float* __restrict inverseColor, int width,
+                         float* __restrict sumR, float* __restrict sumG,
+                         float* __restrict sumB,
+                         float* __restrict sumVariance,
+                         float* __restrict weights) {
+    const float* centreR = centre.color[0];
+    const float* centreG = centre.color[1];
+    const float* centreB = centre.color[2];
+    const float* centreAlbedoR = centre.albedo[0];
+    const float* centreAlbedoG = centre.albedo[1];
+    const float* centreAlbedoB = centre.albedo[2];
+    const float* centreNormalX = centre.normal[0];
+    const float* centreNormalY = centre.normal[1];
+    const float* centreNormalZ = centre.normal[2];
+    const float* centreDepth = centre.depth;
+    const float* tapR = tap.color[0];
+    const float* tapG = tap.color[1];
+    const float* tapB = tap.color[2];
+    const float* tapVariance = tap.color[kVariance];
+    const float* tapAlbedoR = tap.albedo[0];
+    const float* tapAlbedoG = tap.albedo[1];
+    const float* tapAlbedoB = tap.albedo[2];
+    const float* tapNormalX = tap.normal[0];
+    const float* tapNormalY = tap.normal[1];
+    const float* tapNormalZ = tap.normal[2];
+    const float* tapDepth = tap.depth;
+
+    for (size_t x = 0; x < static_cast<size_t>(width); ++x) {
+      const float dr = centreR[x] - tapR[x];
+      const float dg = centreG[x] - tapG[x];
+      const float db = centreB[x] - tapB[x];
+      const float colorDistance = dr * dr + dg * dg + db * db;
+
+      const float ar = centreAlbedoR[x] - tapAlbedoR[x];
+      const float ag = centreAlbedoG[x] - tapAlbedoG[x];
+      const float ab = centreAlbedoB[x] - tapAlbedoB[x];
+      const float albedoDistance = ar * ar + ag * ag + ab * ab;
+
+      const float nx = centreNormalX[x] - tapNormalX[x];
+      const float ny = centreNormalY[x] - tapNormalY[x];
+      const float nz = centreNormalZ[x] - tapNormalZ[x];
+      const float normalDistance = nx * nx + ny * ny + nz * nz;
+
+      const float dz =
+          (centreDepth[x] - tapDepth[x]) / (centreDepth[x] + kEpsilon);
+      const float depthDistance = dz * dz;
+
+      const float weight =
+          kernel * negativeExp(colorDistance * inverseColor[x] +
+                               albedoDistance * inverses.albedo +
+                               normalDistance * inverses.normal +
+                               depthDistance * inverses.depth);
+
+      sumR[x] += weight * tapR[x];
+      sumG[x] += weight * tapG[x];
+      sumB[x] += weight * tapB[x];
+      sumVariance[x] += weight * weight * tapVariance[x];
+      weights[x] += weight;
+    }
+  }
+};
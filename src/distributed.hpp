@@ -0,0 +1,266 @@
+#pragma once
+
+#include "framebuffer.hpp"
+#include "socket.hpp"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Tile rendering spread over processes. Every process builds the same scene;
+// a coordinator hands out tiles over TCP, workers send back the float pixels,
+// and the tiles of a worker that disconnects or stalls go back in the queue.
+// Pixels are seeded by position (Camera::mSeed), so the merged image matches a
+// local render exactly.
+namespace distributed {
+
+// Sent by a worker when it connects; the coordinator turns away workers set up
+// for a different image.
+struct Job {
+  std::uint32_t width{};
+  std::uint32_t height{};
+  std::uint32_t samplesPerPixel{};
+  std::uint32_t seed{};
+
+  bool operator==(const Job&) const = default;
+};
+
+// Renders the colour of one tile.
+using TileRenderer = std::function<FrameBuffer(const Tile&)>;
+
+namespace detail {
+
+constexpr std::uint32_t kMagic = 0x4b575452; // "RTWK"
+constexpr std::uint32_t kVersion = 1;
+constexpr size_t kTileWords = 4;
+constexpr int kHelloTimeoutSeconds = 10;
+
+// Messages are sequences of little endian 32-bit words.
+inline bool sendWords(const Socket& socket,
+                      const std::vector<std::uint32_t>& words) {
+  std::vector<unsigned char> bytes(words.size() * 4);
+  for (size_t i = 0; i < words.size(); ++i) {
+    for (size_t byte = 0; byte < 4; ++byte) {
+      bytes[i * 4 + byte] =
+          static_cast<unsigned char>(words[i] >> (8U * byte));
+    }
+  }
+  return socket.sendAll(bytes.data(), bytes.size());
+}
+
+inline bool receiveWords(const Socket& socket,
+                         std::vector<std::uint32_t>& words) {
+  std::vector<unsigned char> bytes(words.size() * 4);
+  if (!socket.receiveAll(bytes.data(), bytes.size())) {
+    return false;
+  }
+  for (size_t i = 0; i < words.size(); ++i) {
+    words[i] = 0;
+    for (size_t byte = 0; byte < 4; ++byte) {
+      words[i] |= std::uint32_t{bytes[i * 4 + byte]} << (8U * byte);
+    }
+  }
+  return true;
+}
+
+inline std::vector<std::uint32_t> tileWords(const Tile& tile) {
+  return {static_cast<std::uint32_t>(tile.x), static_cast<std::uint32_t>(tile.y),
+          static_cast<std::uint32_t>(tile.width),
+          static_cast<std::uint32_t>(tile.height)};
+}
+
+inline Tile wordsTile(const std::vector<std::uint32_t>& words) {
+  return {static_cast<int>(words[0]), static_cast<int>(words[1]),
+          static_cast<int>(words[2]), static_cast<int>(words[3])};
+}
+
+inline bool sendTile(const Socket& socket, const Tile& tile,
+                     const FrameBuffer& pixels) {
+  std::vector<std::uint32_t> words = tileWords(tile);
+  words.reserve(kTileWords + pixels.size());
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    words.push_back(std::bit_cast<std::uint32_t>(pixels.data()[i]));
+  }
+  return sendWords(socket, words);
+}
+
+} // namespace detail
+
+class Coordinator {
+public:
+  struct Settings {
+    std::uint16_t port = 7777;
+    int tileSize = 32;
+    // Also render tiles in this process, so the image completes without any
+    // worker.
+    bool renderLocally = true;
+    // A worker that takes longer than this for one tile is dropped.
+    int tileTimeoutSeconds = 600;
+  };
+
+  explicit Coordinator(Settings settings) : mSettings{settings} {}
+
+  // Blocks until every tile has been rendered here or by a worker. Returns an
+  // empty buffer if the port cannot be opened.
+  [[nodiscard]] FrameBuffer render(const Job& job,
+                                   const TileRenderer& renderTile) {
+    Socket listener = Socket::listen(mSettings.port);
+    if (!listener.valid()) {
+      std::clog << "Cannot listen on port " << mSettings.port << '\n';
+      return {};
+    }
+
+    mImage = FrameBuffer{static_cast<int>(job.width),
+                         static_cast<int>(job.height)};
+    const auto tiles =
+        splitIntoTiles(mImage.width(), mImage.height(), mSettings.tileSize);
+    mPending.assign(tiles.begin(), tiles.end());
+    mRemaining = tiles.size();
+
+    std::vector<std::jthread> workers;
+    std::jthread acceptor{[&](const std::stop_token& stop) {
+      while (!stop.stop_requested()) {
+        if (auto socket = listener.accept(kAcceptPollMilliseconds)) {
+          workers.emplace_back(
+              [this, &job](Socket connection) {
+                serveWorker(connection, job);
+              },
+              std::move(*socket));
+        }
+      }
+    }};
+
+    if (mSettings.renderLocally) {
+      Tile tile;
+      while (takeTile(tile)) {
+        complete(tile, renderTile(tile));
+      }
+    } else {
+      std::unique_lock lock{mMutex};
+      mChanged.wait(lock, [this] { return mRemaining == 0; });
+    }
+
+    acceptor.request_stop();
+    acceptor.join();
+    workers.clear();
+    return std::move(mImage);
+  }
+
+private:
+  static constexpr int kAcceptPollMilliseconds = 200;
+
+  Settings mSettings;
+  std::mutex mMutex;
+  std::condition_variable mChanged;
+  std::deque<Tile> mPending;
+  size_t mRemaining{};
+  FrameBuffer mImage;
+
+  // Waits for a tile to render; false once the image is complete.
+  bool takeTile(Tile& tile) {
+    std::unique_lock lock{mMutex};
+    mChanged.wait(lock, [this] { return !mPending.empty() || mRemaining == 0; });
+    if (mRemaining == 0) {
+      return false;
+    }
+    tile = mPending.front();
+    mPending.pop_front();
+    return true;
+  }
+
+  void complete(const Tile& tile, const FrameBuffer& pixels) {
+    const std::scoped_lock lock{mMutex};
+    mImage.blit(pixels, tile);
+    if (--mRemaining == 0) {
+      mChanged.notify_all();
+    }
+  }
+
+  void requeue(const Tile& tile) {
+    const std::scoped_lock lock{mMutex};
+    mPending.push_front(tile);
+    mChanged.notify_one();
+  }
+
+  void serveWorker(const Socket& socket, const Job& job) {
+    socket.setReceiveTimeout(detail::kHelloTimeoutSeconds);
+    std::vector<std::uint32_t> hello(6);
+    if (!detail::receiveWords(socket, hello) || hello[0] != detail::kMagic ||
+        hello[1] != detail::kVersion ||
+        Job{hello[2], hello[3], hello[4], hello[5]} != job) {
+      std::clog << "Rejected a worker set up for a different job\n";
+      return;
+    }
+    std::clog << "Worker connected\n";
+    socket.setReceiveTimeout(mSettings.tileTimeoutSeconds);
+
+    Tile tile;
+    while (takeTile(tile)) {
+      FrameBuffer pixels{tile.width, tile.height};
+      std::vector<std::uint32_t> reply(detail::kTileWords + pixels.size());
+      const auto header = detail::tileWords(tile);
+      if (!detail::sendWords(socket, header) ||
+          !detail::receiveWords(socket, reply) ||
+          !std::equal(header.begin(), header.end(), reply.begin())) {
+        std::clog << "Worker lost; tile at " << tile.x << ", " << tile.y
+                  << " goes back in the queue\n";
+        requeue(tile);
+        return;
+      }
+      for (size_t i = 0; i < pixels.size(); ++i) {
+        pixels.data()[i] = std::bit_cast<float>(reply[detail::kTileWords + i]);
+      }
+      complete(tile, pixels);
+    }
+    // An empty tile tells the worker to stop.
+    (void)detail::sendWords(socket, detail::tileWords(Tile{}));
+  }
+};
+
+// Renders tiles for the coordinator at host:port until it has no more, trying
+// to connect for a while so workers can start first. Returns false if the
+// coordinator could not be reached or the connection dropped.
+inline bool runWorker(const std::string& host, std::uint16_t port,
+                      const Job& job, const TileRenderer& renderTile) {
+  constexpr int kConnectAttempts = 50;
+  constexpr auto kConnectRetryDelay = std::chrono::milliseconds{200};
+
+  Socket socket;
+  for (int attempt = 0; attempt < kConnectAttempts && !socket.valid();
+       ++attempt) {
+    if (attempt > 0) {
+      std::this_thread::sleep_for(kConnectRetryDelay);
+    }
+    socket = Socket::connect(host, port);
+  }
+  if (!socket.valid() ||
+      !detail::sendWords(socket, {detail::kMagic, detail::kVersion, job.width,
+                                  job.height, job.samplesPerPixel, job.seed})) {
+    std::clog << "Cannot reach coordinator at " << host << ':' << port << '\n';
+    return false;
+  }
+
+  std::vector<std::uint32_t> header(detail::kTileWords);
+  while (detail::receiveWords(socket, header)) {
+    const Tile tile = detail::wordsTile(header);
+    if (tile.width == 0) {
+      return true;
+    }
+    if (!detail::sendTile(socket, tile, renderTile(tile))) {
+      break;
+    }
+  }
+  std::clog << "Lost the connection to the coordinator\n";
+  return false;
+}
+
+} // namespace distributed
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "vec3.hpp"
+#include <bit>
+#include <cstdint>
+#include <string_view>
+
+// 64-bit hash of everything that decides how part of a render comes out, so
+// rendered results can be reused, also across runs, while it stays the same.
+// Objects add their type and parameters in a fixed order. Those that cannot
+// describe themselves mark the fingerprint unknown, and nothing rendered
+// under it is reused.
+class Fingerprint {
+public:
+  void add(std::uint64_t value) { mHash = mix(mHash ^ mix(value)); }
+  void add(int value) { add(static_cast<std::uint64_t>(value)); }
+  void add(double value) { add(std::bit_cast<std::uint64_t>(value)); }
+
+  void add(const Vec3& vector) {
+    add(vector.x());
+    add(vector.y());
+    add(vector.z());
+  }
+
+  void add(std::string_view text) {
+    add(static_cast<std::uint64_t>(text.size()));
+    for (const char character : text) {
+      add(static_cast<std::uint64_t>(static_cast<unsigned char>(character)));
+    }
+  }
+
+  void markUnknown() { mKnown = false; }
+
+  // Material ids are numbered by creation order, so they only count for
+  // renders that write them out; elsewhere materials count by content.
+  void includeMaterialIds(bool include) { mMaterialIds = include; }
+  [[nodiscard]] bool materialIds() const { return mMaterialIds; }
+
+  [[nodiscard]] bool known() const { return mKnown; }
+  [[nodiscard]] std::uint64_t value() const { return mHash; }
+
+private:
+  std::uint64_t mHash{0x9e3779b97f4a7c15ULL};
+  bool mKnown{true};
+  bool mMaterialIds{};
+
+  // SplitMix64's finalizer, offset so that zero does not map to itself.
+  static std::uint64_t mix(std::uint64_t value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27U)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31U);
+  }
+};
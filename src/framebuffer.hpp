@@ -0,0 +1,153 @@
+#pragma once
+
+#include "color.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Rectangle of pixels that is rendered and transferred as a unit.
+struct Tile {
+  int x{};
+  int y{};
+  int width{};
+  int height{};
+};
+
+// Covers a width x height image with tiles of at most tileSize squared, in
+// scanline order.
+inline std::vector<Tile> splitIntoTiles(int width, int height, int tileSize) {
+  std::vector<Tile> tiles;
+  for (int y = 0; y < height; y += tileSize) {
+    for (int x = 0; x < width; x += tileSize) {
+      tiles.push_back(
+          {x, y, std::min(tileSize, width - x), std::min(tileSize, height - y)});
+    }
+  }
+  return tiles;
+}
+
+// Floating point image stored as one contiguous plane per channel, so passes
+// over a single channel run through memory linearly.
+class FrameBuffer {
+public:
+  FrameBuffer() = default;
+  FrameBuffer(int width, int height, int channels = 3)
+      : mWidth{width}, mHeight{height}, mChannels{channels},
+        mData(static_cast<size_t>(width) * static_cast<size_t>(height) *
+              static_cast<size_t>(channels)) {}
+
+  [[nodiscard]] int width() const { return mWidth; }
+  [[nodiscard]] int height() const { return mHeight; }
+  [[nodiscard]] int channels() const { return mChannels; }
+  [[nodiscard]] bool empty() const { return mData.empty(); }
+
+  [[nodiscard]] float* plane(int channel) {
+    return mData.data() + static_cast<size_t>(channel) * planeSize();
+  }
+  [[nodiscard]] const float* plane(int channel) const {
+    return mData.data() + static_cast<size_t>(channel) * planeSize();
+  }
+
+  [[nodiscard]] float& at(int xIndex, int yIndex, int channel) {
+    return plane(channel)[index(xIndex, yIndex)];
+  }
+  [[nodiscard]] float at(int xIndex, int yIndex, int channel) const {
+    return plane(channel)[index(xIndex, yIndex)];
+  }
+
+  void set(int xIndex, int yIndex, const Vec3& value) {
+    for (int channel = 0; channel < mChannels && channel < 3; ++channel) {
+      at(xIndex, yIndex, channel) =
+          static_cast<float>(value[static_cast<size_t>(channel)]);
+    }
+  }
+
+  [[nodiscard]] Vec3 get(int xIndex, int yIndex) const {
+    Vec3 value;
+    for (int channel = 0; channel < mChannels && channel < 3; ++channel) {
+      value[static_cast<size_t>(channel)] = at(xIndex, yIndex, channel);
+    }
+    return value;
+  }
+
+  // Copies a tile-sized buffer into this one at the tile's position.
+  void blit(const FrameBuffer& source, const Tile& tile) {
+    const int channels = std::min(mChannels, source.channels());
+    for (int channel = 0; channel < channels; ++channel) {
+      for (int yIndex = 0; yIndex < tile.height; ++yIndex) {
+        const float* row = source.plane(channel) +
+                           static_cast<size_t>(yIndex) *
+                               static_cast<size_t>(tile.width);
+        std::copy_n(row, tile.width,
+                    plane(channel) + index(tile.x, tile.y + yIndex));
+      }
+    }
+  }
+
+  // Copies the pixels of a tile of this buffer out into a tile-sized one.
+  [[nodiscard]] FrameBuffer crop(const Tile& tile) const {
+    FrameBuffer cropped{tile.width, tile.height, mChannels};
+    for (int channel = 0; channel < mChannels; ++channel) {
+      for (int yIndex = 0; yIndex < tile.height; ++yIndex) {
+        std::copy_n(plane(channel) + index(tile.x, tile.y + yIndex),
+                    tile.width,
+                    cropped.plane(channel) +
+                        static_cast<size_t>(yIndex) *
+                            static_cast<size_t>(tile.width));
+      }
+    }
+    return cropped;
+  }
+
+  // Raw storage, all planes back to back, for sending over the network.
+  [[nodiscard]] float* data() { return mData.data(); }
+  [[nodiscard]] const float* data() const { return mData.data(); }
+  [[nodiscard]] size_t size() const { return mData.size(); }
+
+  // Writes the first three channels as a plain PPM through color::write.
+  void writePPM(std::ostream& out) const {
+    out << "P3\n" << mWidth << ' ' << mHeight << "\n255\n";
+    for (int yIndex = 0; yIndex < mHeight; ++yIndex) {
+      for (int xIndex = 0; xIndex < mWidth; ++xIndex) {
+        color::write(out, get(xIndex, yIndex));
+      }
+    }
+  }
+
+  // Writes a Portable Float Map: "PF" with three channels, "Pf" with one,
+  // little endian floats, bottom row first.
+  void writePFM(std::ostream& out) const {
+    const bool colour = mChannels >= 3;
+    out << (colour ? "PF" : "Pf") << '\n'
+        << mWidth << ' ' << mHeight << "\n-1.0\n";
+    const int channels = colour ? 3 : 1;
+    std::vector<float> row(static_cast<size_t>(mWidth) *
+                           static_cast<size_t>(channels));
+    for (int yIndex = mHeight - 1; yIndex >= 0; --yIndex) {
+      for (int xIndex = 0; xIndex < mWidth; ++xIndex) {
+        for (int channel = 0; channel < channels; ++channel) {
+          row[static_cast<size_t>(xIndex * channels + channel)] =
+              at(xIndex, yIndex, channel);
+        }
+      }
+      out.write(reinterpret_cast<const char*>(row.data()),
+                static_cast<std::streamsize>(row.size() * sizeof(float)));
+    }
+  }
+
+private:
+  int mWidth{};
+  int mHeight{};
+  int mChannels{};
+  std::vector<float> mData;
+
+  [[nodiscard]] size_t planeSize() const {
+    return static_cast<size_t>(mWidth) * static_cast<size_t>(mHeight);
+  }
+
+  [[nodiscard]] size_t index(int xIndex, int yIndex) const {
+    return static_cast<size_t>(yIndex) * static_cast<size_t>(mWidth) +
+           static_cast<size_t>(xIndex);
+  }
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "color.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Per-pixel cost images for finding slow regions of a scene. The camera
+// brackets every pixel with beginPixel()/endPixel() on its normal tracing
+// path; the BVH node and primitive test images read the stats counters and
+// so are only written when built with RAYTRACE_ENABLE_STATS.
+class Heatmap {
+public:
+  Heatmap(int width, int height)
+      : mWidth{width}, mHeight{height},
+        mCosts{std::vector<double>(pixelCount()),
+               std::vector<double>(pixelCount()),
+               std::vector<double>(pixelCount())} {}
+
+  void beginPixel() {
+    mNodesBefore = stats::threadCount(stats::Counter::BVHNodesVisited);
+    mTestsBefore = primitiveTests();
+    mStart = Clock::now();
+  }
+
+  void endPixel(int xIndex, int yIndex) {
+    const auto elapsed = Clock::now() - mStart;
+    const auto pixel = static_cast<size_t>(yIndex) *
+                           static_cast<size_t>(mWidth) +
+                       static_cast<size_t>(xIndex);
+    mCosts[kNodes][pixel] = static_cast<double>(
+        stats::threadCount(stats::Counter::BVHNodesVisited) - mNodesBefore);
+    mCosts[kTests][pixel] =
+        static_cast<double>(primitiveTests() - mTestsBefore);
+    mCosts[kTime][pixel] = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+  // Writes <prefix>_nodes.ppm, <prefix>_tests.ppm and <prefix>_time.ppm;
+  // only the last without the stats counters.
+  void write(const std::string& prefix) const {
+    if constexpr (stats::kEnabled) {
+      writeImage(prefix + "_nodes.ppm", mCosts[kNodes]);
+      writeImage(prefix + "_tests.ppm", mCosts[kTests]);
+    } else {
+      static std::once_flag explained;
+      std::call_once(explained, [] {
+        std::clog << "Heatmap: only the time image is written; the node and "
+                     "test images need a build with RAYTRACE_ENABLE_STATS.\n";
+      });
+    }
+    writeImage(prefix + "_time.ppm", mCosts[kTime]);
+  }
+
+  // Maps t in [0,1] through black, blue, cyan, green, yellow, red to white.
+  [[nodiscard]] static Color falseColor(double t) {
+    constexpr std::array<Color, 7> kRamp{
+        Color{0, 0, 0}, Color{0, 0, 1}, Color{0, 1, 1}, Color{0, 1, 0},
+        Color{1, 1, 0}, Color{1, 0, 0}, Color{1, 1, 1}};
+    const double scaled =
+        std::clamp(t, 0.0, 1.0) * static_cast<double>(kRamp.size() - 1);
+    const auto index =
+        std::min(static_cast<size_t>(scaled), kRamp.size() - 2);
+    const double fraction = scaled - static_cast<double>(index);
+    return (1 - fraction) * kRamp[index] + fraction * kRamp[index + 1];
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+  static constexpr size_t kNodes = 0;
+  static constexpr size_t kTests = 1;
+  static constexpr size_t kTime = 2;
+  // Normalizing to a high percentile instead of the maximum keeps a few
+  // outliers (e.g. a pixel interrupted by the OS) from washing out the image.
+  static constexpr double kNormalizingPercentile = 0.99;
+
+  int mWidth;
+  int mHeight;
+  std::array<std::vector<double>, 3> mCosts;
+  std::uint64_t mNodesBefore{};
+  std::uint64_t mTestsBefore{};
+  Clock::time_point mStart;
+
+  [[nodiscard]] size_t pixelCount() const {
+    return static_cast<size_t>(mWidth) * static_cast<size_t>(mHeight);
+  }
+
+  [[nodiscard]] static std::uint64_t primitiveTests() {
+    return stats::threadCount(stats::Counter::SphereTests) +
+           stats::threadCount(stats::Counter::QuadTests) +
+           stats::threadCount(stats::Counter::BoxPrimitiveTests) +
+           stats::threadCount(stats::Counter::MediumTests);
+  }
+
+  void writeImage(const std::string& path,
+                  const std::vector<double>& costs) const {
+    std::vector<double> sorted = costs;
+    const auto percentile = static_cast<std::ptrdiff_t>(
+        kNormalizingPercentile * static_cast<double>(sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + percentile,
+                     sorted.end());
+    const double scale =
+        sorted[static_cast<size_t>(percentile)] > 0
+            ? 1.0 / sorted[static_cast<size_t>(percentile)]
+            : 0.0;
+
+    std::ofstream out{path};
+    out << "P3\n" << mWidth << ' ' << mHeight << "\n255\n";
+    for (const double cost : costs) {
+      const Color pixel = falseColor(cost * scale);
+      out << int(color::maxIntegerColorValue * pixel.x()) << ' '
+          << int(color::maxIntegerColorValue * pixel.y()) << ' '
+          << int(color::maxIntegerColorValue * pixel.z()) << '\n';
+    }
+  }
+};
@@ -1,26 +1,96 @@
 #pragma once
 
 #include "aabb.hpp"
+#include "fingerprint.hpp"
 #include "interval.hpp"
 #include "ray.hpp"
 #include "utils.hpp"
 #include "vec2.hpp"
 #include "vec3.hpp"
+#include <functional>
 #include <memory>
 
 class IMaterial;
 
+// Bounds of an object at ray times 0 and 1. At any time in between the object
+// lies inside the box interpolated linearly between them, which is much
+// tighter than boundingBox() for fast movers.
+struct MotionBounds {
+  AABB start;
+  AABB end;
+};
+
 struct HitRecord {
   Vec3 position;
   std::shared_ptr<IMaterial> material;
   double t{};
   Vec2<double> uv;
+  // Partial derivatives of the surface position with respect to u and v.
+  Vec3 dpdu;
+  Vec3 dpdv;
+  // Change in uv per pixel step in x and y; zero unless the record came from
+  // a camera ray carrying differentials.
+  Vec2<double> duvdx{0, 0};
+  Vec2<double> duvdy{0, 0};
 
   void setFaceNormal(const Ray& ray, const Vec3& outwardNormal) {
     frontFace = dot(ray.direction(), outwardNormal) < 0;
     mNormal = frontFace ? outwardNormal : -outwardNormal;
   }
 
+  void computeUVDifferentials(const RayDifferential& differential) {
+    // Intersect the offset rays with the tangent plane at the hit point, then
+    // express the offsets from the hit point in terms of dpdu and dpdv.
+    duvdx = {0, 0};
+    duvdy = {0, 0};
+
+    constexpr double kEpsilon = 1e-12;
+    const double planeDistance = dot(mNormal, position);
+    const double xAngle = dot(mNormal, differential.xDirection);
+    const double yAngle = dot(mNormal, differential.yDirection);
+    if (std::fabs(xAngle) < kEpsilon || std::fabs(yAngle) < kEpsilon) {
+      return;
+    }
+
+    const double tx =
+        (planeDistance - dot(mNormal, differential.xOrigin)) / xAngle;
+    const double ty =
+        (planeDistance - dot(mNormal, differential.yOrigin)) / yAngle;
+    const Vec3 dpdx = differential.xOrigin + tx * differential.xDirection -
+                      position;
+    const Vec3 dpdy = differential.yOrigin + ty * differential.yDirection -
+                      position;
+
+    // The system is overdetermined; solve it in the two axes least aligned
+    // with the normal.
+    size_t first = 0;
+    size_t second = 1;
+    const Vec3 absNormal{std::fabs(mNormal.x()), std::fabs(mNormal.y()),
+                         std::fabs(mNormal.z())};
+    if (absNormal.x() > absNormal.y() && absNormal.x() > absNormal.z()) {
+      first = 1;
+      second = 2;
+    } else if (absNormal.y() > absNormal.z()) {
+      second = 2;
+    }
+
+    const double determinant =
+        dpdu[first] * dpdv[second] - dpdv[first] * dpdu[second];
+    if (std::fabs(determinant) < kEpsilon) {
+      return;
+    }
+
+    auto solve = [&](const Vec3& offset) {
+      return Vec2<double>{
+          (dpdv[second] * offset[first] - dpdv[first] * offset[second]) /
+              determinant,
+          (dpdu[first] * offset[second] - dpdu[second] * offset[first]) /
+              determinant};
+    };
+    duvdx = solve(dpdx);
+    duvdy = solve(dpdy);
+  }
+
   [[nodiscard]] const Vec3& normal() const { return mNormal; }
   [[nodiscard]] bool frontFacing() const { return frontFace; }
 
@@ -38,6 +108,74 @@ public:
                    HitRecord& hitInfo) const = 0;
   [[nodiscard]] virtual AABB boundingBox() const = 0;
 
+  // Objects that move during the shutter override this; boundingBox() holds
+  // a still object at every time.
+  [[nodiscard]] virtual MotionBounds motionBounds() const {
+    return {boundingBox(), boundingBox()};
+  }
+
+  // Any-hit query: whether anything lies along the ray within rayRange. Stops
+  // at the first intersection found and skips all shading work, so it is the
+  // query to use for shadow and visibility rays.
+  [[nodiscard]] virtual bool occluded(const Ray& ray,
+                                      Interval rayRange) const {
+    HitRecord hitInfo;
+    return hit(ray, rayRange, hitInfo);
+  }
+
+  // Finds where the ray enters and leaves the object, clipped to rayRange.
+  // The entry may lie behind rayRange.min() (e.g. for rays starting inside),
+  // in which case span starts at rayRange.min(). Convex objects override this
+  // with a single query; the default traces the object twice and is only
+  // exact for the first entry/exit pair of non-convex objects.
+  virtual bool hitSpan(const Ray& ray, Interval rayRange,
+                       Interval& span) const {
+    constexpr double kExitEpsilon = 0.0001;
+    HitRecord entryPoint;
+    HitRecord exitPoint;
+
+    if (!hit(ray, Interval::universe, entryPoint)) {
+      return false;
+    }
+
+    if (!hit(ray,
+             Interval{entryPoint.t + kExitEpsilon, utils::INFINITE_DOUBLE},
+             exitPoint)) {
+      return false;
+    }
+
+    span = Interval{std::fmax(entryPoint.t, rayRange.min()),
+                    std::fmin(exitPoint.t, rayRange.max())};
+    return span.min() < span.max();
+  }
+
+  // Density (per unit solid angle) of random() choosing this direction from
+  // origin. Objects that cannot be sampled as lights return zero.
+  [[nodiscard]] virtual double pdfValue(const Vec3& origin,
+                                        const Vec3& direction) const {
+    (void)origin;
+    (void)direction;
+    return 0.0;
+  }
+
+  // Returns a direction from origin towards a random point on this object.
+  [[nodiscard]] virtual Vec3 random(const Vec3& origin) const {
+    (void)origin;
+    return {1, 0, 0};
+  }
+
+  // Adds everything that decides how the object renders: its type, shape,
+  // placement and material. Renders of objects that do not override this
+  // are never reused.
+  virtual void fingerprint(Fingerprint& print) const { print.markUnknown(); }
+
+  // Calls visit with every object this one groups, or with itself if it is
+  // not a group, e.g. to find the objects seen through part of the image.
+  virtual void
+  forEachObject(const std::function<void(const Hittable&)>& visit) const {
+    visit(*this);
+  }
+
 protected:
   Hittable(const Hittable&) = default;
   Hittable(Hittable&&) = default;
@@ -62,8 +200,31 @@ public:
     return true;
   }
 
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    const Ray offsetRay{ray.origin() - mOffset, ray.direction(), ray.time()};
+    return mObject->occluded(offsetRay, rayRange);
+  }
+
+  bool hitSpan(const Ray& ray, Interval rayRange,
+               Interval& span) const override {
+    const Ray offsetRay{ray.origin() - mOffset, ray.direction(), ray.time()};
+    return mObject->hitSpan(offsetRay, rayRange, span);
+  }
+
   [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
 
+  [[nodiscard]] MotionBounds motionBounds() const override {
+    const MotionBounds bounds = mObject->motionBounds();
+    return {bounds.start + mOffset, bounds.end + mOffset};
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("Translate");
+    print.add(mOffset);
+    mObject->fingerprint(print);
+  }
+
 private:
   std::shared_ptr<Hittable> mObject;
   Vec3 mOffset;
@@ -106,19 +267,7 @@ public:
   }
   bool hit(const Ray& ray, Interval rayRange,
            HitRecord& hitInfo) const override {
-    // Transform the ray from world space to object space.
-
-    auto origin =
-        Vec3((cosTheta * ray.origin().x()) - (sinTheta * ray.origin().z()),
-             ray.origin().y(),
-             (sinTheta * ray.origin().x()) + (cosTheta * ray.origin().z()));
-
-    auto direction = Vec3(
-        (cosTheta * ray.direction().x()) - (sinTheta * ray.direction().z()),
-        ray.direction().y(),
-        (sinTheta * ray.direction().x()) + (cosTheta * ray.direction().z()));
-
-    Ray rotatedRay(origin, direction, ray.time());
+    const Ray rotatedRay = toObject(ray);
 
     // Determine whether an intersection exists in object space (and if so,
     // where).
@@ -129,25 +278,57 @@ public:
 
     // Transform the intersection from object space back to world space.
 
-    hitInfo.position = Vec3{
-        (cosTheta * hitInfo.position.x()) + (sinTheta * hitInfo.position.z()),
-        hitInfo.position.y(),
-        (-sinTheta * hitInfo.position.x()) + (cosTheta * hitInfo.position.z())};
-
-    const auto worldNormal = Vec3{
-        (cosTheta * hitInfo.normal().x()) + (sinTheta * hitInfo.normal().z()),
-        hitInfo.normal().y(),
-        (-sinTheta * hitInfo.normal().x()) + (cosTheta * hitInfo.normal().z())};
+    hitInfo.position = toWorld(hitInfo.position);
+    const auto worldNormal = toWorld(hitInfo.normal());
     hitInfo.setFaceNormal(ray, worldNormal);
+    hitInfo.dpdu = toWorld(hitInfo.dpdu);
+    hitInfo.dpdv = toWorld(hitInfo.dpdv);
 
     return true;
   }
 
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    return mObject->occluded(toObject(ray), rayRange);
+  }
+
+  bool hitSpan(const Ray& ray, Interval rayRange,
+               Interval& span) const override {
+    return mObject->hitSpan(toObject(ray), rayRange, span);
+  }
+
   [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
 
+  void fingerprint(Fingerprint& print) const override {
+    print.add("RotateY");
+    print.add(sinTheta);
+    print.add(cosTheta);
+    mObject->fingerprint(print);
+  }
+
 private:
   std::shared_ptr<Hittable> mObject;
   double sinTheta;
   double cosTheta;
   AABB mBoundingBox;
+
+  [[nodiscard]] Ray toObject(const Ray& ray) const {
+    // Transform the ray from world space to object space.
+    auto origin =
+        Vec3((cosTheta * ray.origin().x()) - (sinTheta * ray.origin().z()),
+             ray.origin().y(),
+             (sinTheta * ray.origin().x()) + (cosTheta * ray.origin().z()));
+
+    auto direction = Vec3(
+        (cosTheta * ray.direction().x()) - (sinTheta * ray.direction().z()),
+        ray.direction().y(),
+        (sinTheta * ray.direction().x()) + (cosTheta * ray.direction().z()));
+
+    return {origin, direction, ray.time()};
+  }
+
+  [[nodiscard]] Vec3 toWorld(const Vec3& local) const {
+    return Vec3{(cosTheta * local.x()) + (sinTheta * local.z()), local.y(),
+                (-sinTheta * local.x()) + (cosTheta * local.z())};
+  }
 };
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "aabb.hpp"
 #include "hittable.hpp"
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -33,8 +35,69 @@ public:
     return hitAnything;
   }
 
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    for (const auto& object : mObjects) {
+      if (object->occluded(ray, rayRange)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
 
+  [[nodiscard]] MotionBounds motionBounds() const override {
+    MotionBounds bounds{AABB::empty, AABB::empty};
+    for (const auto& object : mObjects) {
+      const MotionBounds objectBounds = object->motionBounds();
+      bounds = {AABB{bounds.start, objectBounds.start},
+                AABB{bounds.end, objectBounds.end}};
+    }
+    return bounds;
+  }
+
+  [[nodiscard]] double pdfValue(const Vec3& origin,
+                                const Vec3& direction) const override {
+    if (mObjects.empty()) {
+      return 0.0;
+    }
+    const auto weight = 1.0 / static_cast<double>(mObjects.size());
+    auto sum = 0.0;
+
+    for (const auto& object : mObjects) {
+      sum += weight * object->pdfValue(origin, direction);
+    }
+
+    return sum;
+  }
+
+  [[nodiscard]] Vec3 random(const Vec3& origin) const override {
+    if (mObjects.empty()) {
+      return Hittable::random(origin);
+    }
+    const auto lastIndex = static_cast<int>(mObjects.size()) - 1;
+    return mObjects[static_cast<size_t>(utils::randomInt(0, lastIndex))]
+        ->random(origin);
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("HittableList");
+    print.add(static_cast<std::uint64_t>(mObjects.size()));
+    for (const auto& object : mObjects) {
+      object->fingerprint(print);
+    }
+  }
+
+  void forEachObject(
+      const std::function<void(const Hittable&)>& visit) const override {
+    for (const auto& object : mObjects) {
+      object->forEachObject(visit);
+    }
+  }
+
+  [[nodiscard]] bool empty() const { return mObjects.empty(); }
+
   [[nodiscard]] auto& getObjects() { return mObjects; }
 
 private:
@@ -12,9 +12,19 @@
 #define STBI_FAILURE_USERMSG
 #include "stb_image.h"
 
+#include "tile_cache.hpp"
 #include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <system_error>
+#include <vector>
 
 class Image {
 public:
@@ -25,13 +35,20 @@ public:
   Image& operator=(const Image&) = delete;
   Image& operator=(Image&&) = delete;
   Image(const char* imageFilename) {
-    // Loads image data from the specified file. If the RTW_IMAGES environment
-    // variable is defined, looks only in that directory for the image file. If
-    // the image was not found, searches for the specified image file first from
-    // the current directory, then in the images/ subdirectory, then the
-    // _parent's_ images/ subdirectory, and then _that_ parent, on so on, for
-    // six levels up. If the image was not loaded successfully, width() and
-    // height() will return 0.
+    const auto path = locate(imageFilename);
+    if (path.empty() || !load(path)) {
+      std::cerr << "ERROR: Could not load image file '" << imageFilename
+                << "'.\n";
+    }
+  }
+
+  static std::string locate(const char* imageFilename) {
+    // Returns the path of the specified image file. If the RTW_IMAGES
+    // environment variable is defined, looks first in that directory for the
+    // image file. If the image was not found, searches for the specified image
+    // file first from the current directory, then in the images/ subdirectory,
+    // then the _parent's_ images/ subdirectory, and then _that_ parent, on so
+    // on, for six levels up. Returns an empty string if nothing was found.
 
     auto filename = std::string(imageFilename);
     size_t envLength = 0;
@@ -43,114 +60,365 @@ public:
         std::string(buffer.data(), buffer.data() + envLength);
 
     // Hunt for the image file in some likely locations.
-    if ((envLength != 0) && load(imageDir + "/" + imageFilename)) {
-      return;
-    }
-    if (load(filename)) {
-      return;
-    }
-    if (load("images/" + filename)) {
-      return;
+    if ((envLength != 0) &&
+        std::filesystem::exists(imageDir + "/" + imageFilename)) {
+      return imageDir + "/" + imageFilename;
     }
-    if (load("../images/" + filename)) {
-      return;
+    for (const auto* prefix :
+         {"", "images/", "../images/", "../../images/", "../../../images/"}) {
+      if (std::filesystem::exists(prefix + filename)) {
+        return prefix + filename;
+      }
     }
-    if (load("../../images/" + filename)) {
-      return;
+    return {};
+  }
+
+  bool load(const std::string& filename) {
+    // Loads the 8-bit gamma-encoded image data from the given file name and
+    // builds the tiled mip chain. Returns true if the load succeeded. Texels
+    // stay gamma-encoded in memory and are linearized on lookup with the same
+    // 2.2 gamma that stbi_loadf would have applied.
+
+    auto n = kChannels; // Dummy out parameter: original components per pixel
+    int width = 0;
+    int height = 0;
+    unsigned char* data =
+        stbi_load(filename.c_str(), &width, &height, &n, kChannels);
+    if (data == nullptr) {
+      return false;
     }
-    if (load("../../../images/" + filename)) {
-      return;
+
+    mLevels.clear();
+    mTileFileId = -1;
+    mLevels.push_back(MipLevel{width, height});
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        const auto* source =
+            data + (static_cast<size_t>(y) * static_cast<size_t>(width) +
+                    static_cast<size_t>(x)) *
+                       kChannels;
+        mLevels.front().store(x, y, {source[0], source[1], source[2], 0});
+      }
     }
+    stbi_image_free(data);
 
-    std::cerr << "ERROR: Could not load image file '" << imageFilename
-              << "'.\n";
+    buildMipChain();
+    return true;
   }
 
-  ~Image() {
-    delete[] byteData;
-    STBI_FREE(floatData);
+  bool writeTileFile(const std::string& path) const {
+    // Writes the mip chain as a tiled cache file: a one tile header holding
+    // the level count and level sizes, followed by every tile of every level.
+    // The file is written under a name of its own first, so neither a run
+    // stopped half way nor another process writing the same file at once
+    // leaves a truncated one behind.
+    if (mLevels.empty() || paged()) {
+      return false;
+    }
+    const std::string partial =
+        path + '.' + std::to_string(std::random_device{}()) + ".part";
+    if (!writeTiles(partial)) {
+      std::error_code error;
+      std::filesystem::remove(partial, error);
+      return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(partial, path, error);
+    if (error) {
+      std::filesystem::remove(partial, error);
+      return false;
+    }
+    return true;
   }
 
-  bool load(const std::string& filename) {
-    // Loads the linear (gamma=1) image data from the given file name. Returns
-    // true if the load succeeded. The resulting data buffer contains the three
-    // [0.0, 1.0] floating-point values for the first pixel (red, then green,
-    // then blue). Pixels are contiguous, going left to right for the width of
-    // the image, followed by the next row below, for the full height of the
-    // image.
-
-    auto n =
-        bytesPerPixel; // Dummy out parameter: original components per pixel
-    floatData = stbi_loadf(filename.c_str(), &mImageWidth, &mImageHeight, &n,
-                           bytesPerPixel);
-    if (floatData == nullptr) {
+  bool pageFrom(const std::string& path) {
+    // Replaces any resident texels with tiles paged on demand from a file
+    // written by writeTileFile(). Only the header is read here, but the file
+    // must be as long as the header says.
+    std::ifstream file{path, std::ios::binary};
+    TileHeader header{};
+    file.read(reinterpret_cast<char*>(header.data()), sizeof(header));
+    if (!file || header[0] != kTileFileMagic || header[1] <= 0 ||
+        header[1] > kMaxLevels) {
       return false;
     }
 
-    mBytesPerScanline = mImageWidth * bytesPerPixel;
-    convertToBytes();
+    std::vector<MipLevel> levels;
+    size_t firstTile = 0;
+    for (size_t iLevel = 0; iLevel < static_cast<size_t>(header[1]); ++iLevel) {
+      const int width = header[2 + 2 * iLevel];
+      const int height = header[3 + 2 * iLevel];
+      if (width <= 0 || height <= 0) {
+        return false;
+      }
+      MipLevel mip{width, height, false};
+      mip.firstTile = firstTile;
+      firstTile += mip.tileCount();
+      levels.push_back(std::move(mip));
+    }
+    std::error_code error;
+    const auto fileBytes = std::filesystem::file_size(path, error);
+    if (error || fileBytes != (firstTile + 1) * TileCache::kTileBytes) {
+      return false;
+    }
+
+    const int fileId = TileCache::instance().registerFile(path);
+    if (fileId < 0) {
+      return false;
+    }
+    mLevels = std::move(levels);
+    mTileFileId = fileId;
     return true;
   }
 
+  [[nodiscard]] bool paged() const { return mTileFileId >= 0; }
+
   [[nodiscard]] int width() const {
-    return (floatData == nullptr) ? 0 : mImageWidth;
+    return mLevels.empty() ? 0 : mLevels.front().width;
   }
   [[nodiscard]] int height() const {
-    return (floatData == nullptr) ? 0 : mImageHeight;
+    return mLevels.empty() ? 0 : mLevels.front().height;
+  }
+  [[nodiscard]] int levels() const { return static_cast<int>(mLevels.size()); }
+
+  [[nodiscard]] std::array<float, 3> texel(int level, int x, int y) const {
+    // Returns the linear RGB value of the texel at x,y of the given mip level,
+    // clamping to the level edges. If there is no image data, returns magenta.
+    PagedTile lastTile;
+    return texel(level, x, y, lastTile);
+  }
+
+  [[nodiscard]] std::array<float, 3> bilinear(int level, double u,
+                                              double v) const {
+    // Bilinearly filters the given mip level at texture coordinates u,v in
+    // [0,1], with v = 0 at the top row.
+    const auto& mip =
+        mLevels[static_cast<size_t>(clamp(level, 0, levels() - 1))];
+    const double x = u * mip.width - 0.5;
+    const double y = v * mip.height - 0.5;
+    const double xFloor = std::floor(x);
+    const double yFloor = std::floor(y);
+    const auto fx = static_cast<float>(x - xFloor);
+    const auto fy = static_cast<float>(y - yFloor);
+    const auto x0 = static_cast<int>(xFloor);
+    const auto y0 = static_cast<int>(yFloor);
+
+    PagedTile lastTile;
+    const auto c00 = texel(level, x0, y0, lastTile);
+    const auto c10 = texel(level, x0 + 1, y0, lastTile);
+    const auto c01 = texel(level, x0, y0 + 1, lastTile);
+    const auto c11 = texel(level, x0 + 1, y0 + 1, lastTile);
+
+    std::array<float, 3> result{};
+    for (size_t c = 0; c < 3; ++c) {
+      const float top = c00[c] + fx * (c10[c] - c00[c]);
+      const float bottom = c01[c] + fx * (c11[c] - c01[c]);
+      result[c] = top + fy * (bottom - top);
+    }
+    return result;
   }
 
-  [[nodiscard]] float* pixelData(int x, int y) const {
-    // Return the address of the three RGB bytes of the pixel at x,y. If there
-    // is no image data, returns magenta.
-    static float magenta[] = {1.0f, 0, 1.0f};
-    if (byteData == nullptr) {
-      return magenta;
+  [[nodiscard]] std::array<float, 3> trilinear(double u, double v,
+                                               double lod) const {
+    // Blends bilinear lookups from the two mip levels around lod, where lod 0
+    // is the full resolution image.
+    if (mLevels.empty()) {
+      return texel(0, 0, 0);
     }
 
-    x = clamp(x, 0, mImageWidth);
-    y = clamp(y, 0, mImageHeight);
+    lod = std::clamp(lod, 0.0, static_cast<double>(levels() - 1));
+    const auto lower = static_cast<int>(lod);
+    const auto blend = static_cast<float>(lod - lower);
+    auto result = bilinear(lower, u, v);
+    if (blend <= 0.0f) {
+      return result;
+    }
 
-    return floatData + y * mBytesPerScanline + x * bytesPerPixel;
+    const auto upper = bilinear(lower + 1, u, v);
+    for (size_t c = 0; c < 3; ++c) {
+      result[c] += blend * (upper[c] - result[c]);
+    }
+    return result;
+  }
+
+  [[nodiscard]] size_t memoryBytes() const {
+    size_t total = 0;
+    for (const auto& mip : mLevels) {
+      total += mip.texels.size() * sizeof(Texel);
+    }
+    return total;
   }
 
 private:
+  // Texels are stored as four bytes (RGB plus padding) so an 8x8 tile is 256
+  // bytes and tile rows never straddle more cache lines than necessary.
+  using Texel = TileCache::Texel;
   static constexpr int maxIntegerColorValue = 255;
-  static constexpr int bytesPerPixel = 3;
-  float* floatData{nullptr};        // Linear floating point pixel data
-  unsigned char* byteData{nullptr}; // Linear 8-bit pixel data
-  int mImageWidth = 0;              // Loaded image width
-  int mImageHeight = 0;             // Loaded image height
-  int mBytesPerScanline = 0;
+  static constexpr int kChannels = 3;
+  static constexpr int kTileSize = TileCache::kTileSize;
+  static constexpr int kTexelsPerTile = TileCache::kTexelsPerTile;
+  static constexpr double kGamma = 2.2;
+  static constexpr std::int32_t kTileFileMagic = 0x54575452; // "RTWT"
+  // Level sizes must fit in the one tile header.
+  using TileHeader =
+      std::array<std::int32_t, TileCache::kTileBytes / sizeof(std::int32_t)>;
+  static constexpr int kMaxLevels =
+      static_cast<int>(std::tuple_size_v<TileHeader> - 2) / 2;
+
+  // The tile a paged image fetched last, so the texels of one filtered
+  // lookup that share a tile go to the TileCache only once.
+  struct PagedTile {
+    size_t index{SIZE_MAX};
+    std::shared_ptr<const TileCache::Tile> texels;
+  };
+
+  struct MipLevel {
+    int width = 0;
+    int height = 0;
+    int tilesPerRow = 0;
+    int tileRows = 0;
+    size_t firstTile = 0; // Offset of this level in the tile file
+    std::vector<Texel> texels;
+
+    MipLevel(int levelWidth, int levelHeight, bool resident = true)
+        : width{levelWidth}, height{levelHeight},
+          tilesPerRow{(levelWidth + kTileSize - 1) / kTileSize},
+          tileRows{(levelHeight + kTileSize - 1) / kTileSize} {
+      if (resident) {
+        texels.resize(tileCount() * kTexelsPerTile);
+      }
+    }
+
+    [[nodiscard]] size_t tileCount() const {
+      return static_cast<size_t>(tilesPerRow) * static_cast<size_t>(tileRows);
+    }
+
+    [[nodiscard]] size_t tileIndex(int x, int y) const {
+      return static_cast<size_t>((y / kTileSize) * tilesPerRow +
+                                 (x / kTileSize));
+    }
+
+    [[nodiscard]] static size_t texelIndex(int x, int y) {
+      return static_cast<size_t>((y % kTileSize) * kTileSize +
+                                 (x % kTileSize));
+    }
+
+    [[nodiscard]] const Texel& load(int x, int y) const {
+      return texels[tileIndex(x, y) * kTexelsPerTile + texelIndex(x, y)];
+    }
+    void store(int x, int y, const Texel& value) {
+      texels[tileIndex(x, y) * kTexelsPerTile + texelIndex(x, y)] = value;
+    }
+  };
+
+  std::vector<MipLevel> mLevels;
+  int mTileFileId{-1};
+
+  bool writeTiles(const std::string& path) const {
+    std::ofstream file{path, std::ios::binary};
+    if (!file) {
+      return false;
+    }
+    TileHeader header{};
+    header[0] = kTileFileMagic;
+    header[1] = levels();
+    for (size_t iLevel = 0; iLevel < mLevels.size(); ++iLevel) {
+      header[2 + 2 * iLevel] = mLevels[iLevel].width;
+      header[3 + 2 * iLevel] = mLevels[iLevel].height;
+    }
+    file.write(reinterpret_cast<const char*>(header.data()), sizeof(header));
+
+    for (const auto& mip : mLevels) {
+      file.write(reinterpret_cast<const char*>(mip.texels.data()),
+                 static_cast<std::streamsize>(mip.texels.size() *
+                                              sizeof(Texel)));
+    }
+    file.close();
+    return !file.fail();
+  }
+
+  [[nodiscard]] std::array<float, 3> texel(int level, int x, int y,
+                                           PagedTile& lastTile) const {
+    if (mLevels.empty()) {
+      return {1.0f, 0, 1.0f};
+    }
+
+    const auto& mip =
+        mLevels[static_cast<size_t>(clamp(level, 0, levels() - 1))];
+    x = clamp(x, 0, mip.width - 1);
+    y = clamp(y, 0, mip.height - 1);
+    if (paged()) {
+      const size_t index = mip.firstTile + mip.tileIndex(x, y);
+      if (index != lastTile.index) {
+        lastTile.texels = TileCache::instance().fetch(mTileFileId, index);
+        lastTile.index = index;
+      }
+      if (!lastTile.texels) {
+        return {1.0f, 0, 1.0f};
+      }
+    }
+    const Texel& encoded = paged()
+                               ? (*lastTile.texels)[mip.texelIndex(x, y)]
+                               : mip.load(x, y);
+    const auto& decode = decodeTable();
+    return {decode[encoded[0]], decode[encoded[1]], decode[encoded[2]]};
+  }
 
   static constexpr int clamp(int x, int low, int high) {
     return std::clamp(x, low, high);
   }
 
-  static constexpr unsigned char floatToByte(float value) {
-    if (value <= 0.0) {
+  static const std::array<float, 256>& decodeTable() {
+    static const std::array<float, 256> table = [] {
+      std::array<float, 256> values{};
+      for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = static_cast<float>(
+            std::pow(static_cast<double>(i) / maxIntegerColorValue, kGamma));
+      }
+      return values;
+    }();
+    return table;
+  }
+
+  static unsigned char encode(float linear) {
+    if (linear <= 0.0f) {
       return 0;
     }
-    if (1.0 <= value) {
+    if (1.0f <= linear) {
       return maxIntegerColorValue;
     }
-    return static_cast<unsigned char>(256.0 * value);
+    const auto encoded = std::pow(static_cast<double>(linear), 1.0 / kGamma);
+    return static_cast<unsigned char>(
+        std::lround(encoded * maxIntegerColorValue));
   }
 
-  void convertToBytes() {
-    // Convert the linear floating point pixel data to bytes, storing the
-    // resulting byte data in the `bdata` member.
-
-    const auto totalBytes =
-        static_cast<size_t>(mImageWidth * mImageHeight * bytesPerPixel);
-    byteData = new unsigned char[totalBytes];
+  void buildMipChain() {
+    // Each level halves the previous one with a box filter applied in linear
+    // space, down to a single texel.
+    while (mLevels.back().width > 1 || mLevels.back().height > 1) {
+      const int level = levels() - 1;
+      const auto& source = mLevels.back();
+      MipLevel next{std::max(1, source.width / 2),
+                    std::max(1, source.height / 2)};
 
-    // Iterate through all pixel components, converting from [0.0, 1.0] float
-    // values to unsigned [0, 255] byte values.
+      for (int y = 0; y < next.height; ++y) {
+        for (int x = 0; x < next.width; ++x) {
+          std::array<float, 3> sum{};
+          for (int dy = 0; dy < 2; ++dy) {
+            for (int dx = 0; dx < 2; ++dx) {
+              const auto value = texel(level, 2 * x + dx, 2 * y + dy);
+              for (size_t c = 0; c < 3; ++c) {
+                sum[c] += value[c];
+              }
+            }
+          }
+          next.store(x, y,
+                     {encode(sum[0] / 4), encode(sum[1] / 4),
+                      encode(sum[2] / 4), 0});
+        }
+      }
 
-    auto* bptr = byteData;
-    auto* fptr = floatData;
-    for (size_t i = 0; i < totalBytes; i++, fptr++, bptr++) {
-      *bptr = floatToByte(*fptr);
+      mLevels.push_back(std::move(next));
     }
   }
-};
\ No newline at end of file
+};
@@ -1,18 +1,103 @@
+#include "arena.hpp"
 #include "camera.hpp"
+#include "distributed.hpp"
 #include "hittable_list.hpp"
+#include "render_server.hpp"
 #include "scene.hpp"
+#include "texture_cache.hpp"
+#include <charconv>
 #include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
 
-int main() {
+namespace {
+// The port number text names, or nothing if it is not a valid one.
+std::optional<std::uint16_t> parsePort(std::string_view text) {
+  std::uint16_t port = 0;
+  const auto result =
+      std::from_chars(text.data(), text.data() + text.size(), port);
+  if (result.ec != std::errc{} || result.ptr != text.data() + text.size() ||
+      port == 0) {
+    return std::nullopt;
+  }
+  return port;
+}
+} // namespace
+
+// Without arguments the image is rendered locally. With
+//   --coordinator PORT   tiles are also handed out to workers on PORT,
+//   --worker HOST:PORT   tiles are rendered for the coordinator at HOST:PORT,
+//   --serve PORT         render jobs are taken over HTTP (see RenderServer).
+// Every coordinator and worker must render the same scene with the same camera
+// settings.
+int main(int argc, char* argv[]) {
+  const std::string_view mode = argc > 2 ? argv[1] : "";
+  const std::string address = argc > 2 ? argv[2] : "";
+
+  if (mode == "--serve") {
+    const auto port = parsePort(address);
+    if (!port) {
+      std::clog << "Expected --serve PORT\n";
+      return 1;
+    }
+    RenderServer server{{.port = *port}};
+    return server.run() ? 0 : 1;
+  }
+
+  // Declared first, so it outlives every reference into it.
+  SceneArena arena;
   HittableList world{};
   Camera cam;
 
-  scene::secondBookFinalScene(world, cam, 800, 1000, 50);
+  {
+    const SceneArena::Scope scope{arena};
+    scene::secondBookFinalScene(world, cam, 800, 1000, 50);
+  }
+
+  const distributed::Job job{static_cast<std::uint32_t>(cam.mImageWidth),
+                             static_cast<std::uint32_t>(cam.imageHeight()),
+                             static_cast<std::uint32_t>(cam.mSamplesPerPixel),
+                             cam.mSeed};
+  auto renderTile = [&](const Tile& tile) {
+    return cam.renderTile(world, tile);
+  };
 
   auto t1 = std::chrono::high_resolution_clock::now();
-  cam.render(world);
+  if (mode == "--coordinator") {
+    const auto port = parsePort(address);
+    if (!port) {
+      std::clog << "Expected --coordinator PORT\n";
+      return 1;
+    }
+    distributed::Coordinator coordinator{{.port = *port}};
+    const FrameBuffer image = coordinator.render(job, renderTile);
+    if (image.empty()) {
+      return 1;
+    }
+    image.writePPM(std::cout);
+  } else if (mode == "--worker") {
+    const auto colon = address.rfind(':');
+    const auto port =
+        colon == std::string::npos
+            ? std::nullopt
+            : parsePort(std::string_view{address}.substr(colon + 1));
+    if (!port) {
+      std::clog << "Expected --worker HOST:PORT\n";
+      return 1;
+    }
+    if (!distributed::runWorker(address.substr(0, colon), *port, job,
+                                renderTile)) {
+      return 1;
+    }
+  } else {
+    cam.render(world);
+  }
   auto t2 = std::chrono::high_resolution_clock::now();
   auto ms_int = duration_cast<std::chrono::milliseconds>(t2 - t1);
   std::clog << "Rendering took: " << ms_int << " milliseconds.\n";
-}
\ No newline at end of file
+  TextureCache::instance().report(std::clog);
+}
@@ -1,12 +1,49 @@
 #pragma once
 
+#include "arena.hpp"
 #include "color.hpp"
+#include "fingerprint.hpp"
 #include "hittable.hpp"
+#include "pdf.hpp"
 #include "texture.hpp"
 #include "vec2.hpp"
 #include "vec3.hpp"
 #include <cmath>
+#include <cstdint>
 #include <memory>
+#include <utility>
+#include <variant>
+
+struct ScatterRecord {
+  // Materials with a PDF leave attenuation unused and are weighted through
+  // IMaterial::eval instead. Specular materials set skipPdf and provide the
+  // scattered ray directly.
+  Color attenuation;
+  // Held by value, so scattering allocates nothing per bounce.
+  std::variant<std::monostate, CosinePDF, SpherePDF> pdf;
+  bool skipPdf{};
+  Ray skipPdfRay;
+
+  [[nodiscard]] const PDF* samplingPdf() const {
+    if (const auto* cosine = std::get_if<CosinePDF>(&pdf)) {
+      return cosine;
+    }
+    return std::get_if<SpherePDF>(&pdf);
+  }
+};
+
+// The materials defined below. The integrator switches over them and calls
+// them as their own final types, so the compiler can inline their scattering
+// and drop emission where it is always black. Materials defined elsewhere
+// are Custom and go through the virtual interface.
+enum class MaterialKind : std::uint8_t {
+  Lambertian,
+  Metal,
+  Dielectric,
+  DiffuseLight,
+  Isotropic,
+  Custom
+};
 
 class IMaterial {
 public:
@@ -17,6 +54,13 @@ public:
   IMaterial& operator=(IMaterial&&) = delete;
   virtual ~IMaterial() = default;
 
+  // Unique per material within its scene, numbered in order of creation by
+  // the scene's arena, so building the same scene always gives the same ids,
+  // whatever else the process builds. Outside an arena, numbered per thread.
+  [[nodiscard]] std::uint32_t id() const { return mId; }
+
+  [[nodiscard]] MaterialKind kind() const { return mKind; }
+
   virtual bool scatter(const Ray& incoming, const HitRecord& hitInfo,
                        Color& attenuation, Ray& scattered) const {
     (void)incoming;
@@ -26,18 +70,83 @@ public:
     return false;
   }
 
-  virtual Color emitted(const Vec2<double>& uv, const Vec3& point) {
+  [[nodiscard]] virtual Color emitted(const Vec2<double>& uv,
+                                      const Vec3& point) const {
     (void)uv;
     (void)point;
     return color::Black;
   }
+
+  // Reflectance seen by a camera ray, used as a denoiser feature.
+  [[nodiscard]] virtual Color albedo(const HitRecord& hitInfo) const {
+    (void)hitInfo;
+    return color::White;
+  }
+
+  // Importance sampling interface. The default treats the material as
+  // specular and forwards to scatter().
+  virtual bool sample(const Ray& incoming, const HitRecord& hitInfo,
+                      ScatterRecord& scatterInfo) const {
+    scatterInfo.pdf = std::monostate{};
+    scatterInfo.skipPdf = true;
+    return scatter(incoming, hitInfo, scatterInfo.attenuation,
+                   scatterInfo.skipPdfRay);
+  }
+
+  // BSDF multiplied by the cosine term for the given scattered ray.
+  [[nodiscard]] virtual Color eval(const Ray& incoming,
+                                   const HitRecord& hitInfo,
+                                   const Ray& scattered) const {
+    (void)incoming;
+    (void)hitInfo;
+    (void)scattered;
+    return color::Black;
+  }
+
+  // Density of the PDF returned by sample() for the given scattered ray.
+  [[nodiscard]] virtual double pdf(const Ray& incoming,
+                                   const HitRecord& hitInfo,
+                                   const Ray& scattered) const {
+    (void)incoming;
+    (void)hitInfo;
+    (void)scattered;
+    return 0;
+  }
+
+  // Adds the material's type and parameters; see Hittable::fingerprint().
+  // The id goes in only for renders that write it out as an AOV, so adding a
+  // material does not change every material created after it.
+  virtual void fingerprint(Fingerprint& print) const { print.markUnknown(); }
+
+protected:
+  explicit IMaterial(MaterialKind kind) : mKind{kind} {}
+
+  void addId(Fingerprint& print) const {
+    if (print.materialIds()) {
+      print.add(static_cast<std::uint64_t>(mId));
+    }
+  }
+
+private:
+  std::uint32_t mId{nextId()};
+  MaterialKind mKind{MaterialKind::Custom};
+
+  static std::uint32_t nextId() {
+    if (SceneArena* arena = SceneArena::current()) {
+      return arena->nextMaterialId();
+    }
+    thread_local std::uint32_t next = 0;
+    return next++;
+  }
 };
 
-class Lambertian : public IMaterial {
+class Lambertian final : public IMaterial {
 public:
   Lambertian(const Color& albedo)
-      : mAlbedo{std::make_shared<SolidColor>(albedo)} {};
-  Lambertian(std::shared_ptr<Texture> texture) : mAlbedo{texture} {};
+      : Lambertian{makeShared<SolidColor>(albedo)} {};
+  Lambertian(std::shared_ptr<Texture> texture)
+      : IMaterial{MaterialKind::Lambertian}, mTexture{std::move(texture)},
+        mAlbedo{*mTexture} {};
   bool scatter(const Ray& incoming, const HitRecord& hitInfo,
                Color& attenuation, Ray& scattered) const override {
     Vec3 scatterDirection = hitInfo.normal() + randomUnitVector();
@@ -45,18 +154,59 @@ public:
       scatterDirection = hitInfo.normal();
     }
     scattered = Ray{hitInfo.position, scatterDirection, incoming.time()};
-    attenuation = mAlbedo->value(hitInfo.uv, hitInfo.position);
+    attenuation = mAlbedo.filteredValue(hitInfo.uv, hitInfo.position,
+                                        hitInfo.duvdx, hitInfo.duvdy);
+    return true;
+  }
+
+  [[nodiscard]] Color albedo(const HitRecord& hitInfo) const override {
+    return mAlbedo.filteredValue(hitInfo.uv, hitInfo.position, hitInfo.duvdx,
+                                 hitInfo.duvdy);
+  }
+
+  bool sample(const Ray& incoming, const HitRecord& hitInfo,
+              ScatterRecord& scatterInfo) const override {
+    (void)incoming;
+    scatterInfo.pdf.emplace<CosinePDF>(hitInfo.normal());
+    scatterInfo.skipPdf = false;
     return true;
   }
 
+  [[nodiscard]] Color eval(const Ray& incoming, const HitRecord& hitInfo,
+                           const Ray& scattered) const override {
+    const auto scatteringPdf = pdf(incoming, hitInfo, scattered);
+    if (scatteringPdf <= 0) {
+      return color::Black;
+    }
+    return scatteringPdf * mAlbedo.filteredValue(hitInfo.uv, hitInfo.position,
+                                                 hitInfo.duvdx, hitInfo.duvdy);
+  }
+
+  [[nodiscard]] double pdf(const Ray& incoming, const HitRecord& hitInfo,
+                           const Ray& scattered) const override {
+    (void)incoming;
+    const auto cosTheta =
+        dot(hitInfo.normal(), unitVector(scattered.direction()));
+    return cosTheta < 0 ? 0 : cosTheta / utils::PI;
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("Lambertian");
+    addId(print);
+    mTexture->fingerprint(print);
+  }
+
 private:
-  std::shared_ptr<Texture> mAlbedo;
+  // Owns the nodes the compiled program calls back into.
+  std::shared_ptr<Texture> mTexture;
+  TextureProgram mAlbedo;
 };
 
-class Metal : public IMaterial {
+class Metal final : public IMaterial {
 public:
   Metal(const Color& albedo, double fuzz)
-      : mAlbedo{albedo}, mFuzz{fuzz < 1.0 ? fuzz : 1.0} {};
+      : IMaterial{MaterialKind::Metal}, mAlbedo{albedo},
+        mFuzz{fuzz < 1.0 ? fuzz : 1.0} {};
   bool scatter(const Ray& incoming, const HitRecord& hitInfo,
                Color& attenuation, Ray& scattered) const override {
     Vec3 reflectDirection =
@@ -67,14 +217,28 @@ public:
     return (dot(scattered.direction(), hitInfo.normal()) > 0);
   }
 
+  [[nodiscard]] Color albedo(const HitRecord& hitInfo) const override {
+    (void)hitInfo;
+    return mAlbedo;
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("Metal");
+    addId(print);
+    print.add(mAlbedo);
+    print.add(mFuzz);
+  }
+
 private:
   Color mAlbedo;
   double mFuzz{};
 };
 
-class Dielectric : public IMaterial {
+class Dielectric final : public IMaterial {
 public:
-  Dielectric(double refractionIndex) : mRefractionIndex{refractionIndex} {};
+  Dielectric(double refractionIndex)
+      : IMaterial{MaterialKind::Dielectric},
+        mRefractionIndex{refractionIndex} {};
   bool scatter(const Ray& incoming, const HitRecord& hitInfo,
                Color& attenuation, Ray& scattered) const override {
     attenuation = color::White;
@@ -101,6 +265,12 @@ public:
     return true;
   }
 
+  void fingerprint(Fingerprint& print) const override {
+    print.add("Dielectric");
+    addId(print);
+    print.add(mRefractionIndex);
+  }
+
 private:
   double mRefractionIndex{};
   static double reflectance(double cosine, double refraction_index) {
@@ -111,33 +281,100 @@ private:
   }
 };
 
-class DiffuseLight : public IMaterial {
+class DiffuseLight final : public IMaterial {
 public:
-  DiffuseLight(std::shared_ptr<Texture> texture) : mTexture{texture} {}
+  DiffuseLight(std::shared_ptr<Texture> texture)
+      : IMaterial{MaterialKind::DiffuseLight}, mTexture{std::move(texture)},
+        mEmission{*mTexture} {}
   DiffuseLight(const Color& emit)
-      : mTexture{std::make_shared<SolidColor>(emit)} {}
+      : DiffuseLight{makeShared<SolidColor>(emit)} {}
+
+  [[nodiscard]] Color emitted(const Vec2<double>& uv,
+                              const Vec3& point) const override {
+    return mEmission.value(uv, point);
+  }
 
-  Color emitted(const Vec2<double>& uv, const Vec3& point) override {
-    return mTexture->value(uv, point);
+  void fingerprint(Fingerprint& print) const override {
+    print.add("DiffuseLight");
+    addId(print);
+    mTexture->fingerprint(print);
   }
 
 private:
   std::shared_ptr<Texture> mTexture;
+  TextureProgram mEmission;
 };
 
-class Isotropic : public IMaterial {
+class Isotropic final : public IMaterial {
 public:
   Isotropic(const Color& albedo)
-      : mTexture{std::make_shared<SolidColor>(albedo)} {}
-  Isotropic(std::shared_ptr<Texture> texture) : mTexture{texture} {}
+      : Isotropic{makeShared<SolidColor>(albedo)} {}
+  Isotropic(std::shared_ptr<Texture> texture)
+      : IMaterial{MaterialKind::Isotropic}, mTexture{std::move(texture)},
+        mAlbedo{*mTexture} {}
 
   bool scatter(const Ray& incoming, const HitRecord& hitInfo,
                Color& attenuation, Ray& scattered) const override {
     scattered = Ray{hitInfo.position, randomUnitVector(), incoming.time()};
-    attenuation = mTexture->value(hitInfo.uv, hitInfo.position);
+    attenuation = mAlbedo.value(hitInfo.uv, hitInfo.position);
     return true;
   }
 
+  [[nodiscard]] Color albedo(const HitRecord& hitInfo) const override {
+    return mAlbedo.value(hitInfo.uv, hitInfo.position);
+  }
+
+  bool sample(const Ray& incoming, const HitRecord& hitInfo,
+              ScatterRecord& scatterInfo) const override {
+    (void)incoming;
+    (void)hitInfo;
+    scatterInfo.pdf.emplace<SpherePDF>();
+    scatterInfo.skipPdf = false;
+    return true;
+  }
+
+  [[nodiscard]] Color eval(const Ray& incoming, const HitRecord& hitInfo,
+                           const Ray& scattered) const override {
+    return pdf(incoming, hitInfo, scattered) *
+           mAlbedo.value(hitInfo.uv, hitInfo.position);
+  }
+
+  [[nodiscard]] double pdf(const Ray& incoming, const HitRecord& hitInfo,
+                           const Ray& scattered) const override {
+    (void)incoming;
+    (void)hitInfo;
+    (void)scattered;
+    return 1 / (4 * utils::PI);
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("Isotropic");
+    addId(print);
+    mTexture->fingerprint(print);
+  }
+
 private:
   std::shared_ptr<Texture> mTexture;
-};
\ No newline at end of file
+  TextureProgram mAlbedo;
+};
+
+// Calls visitor with the material as its concrete type when it is one of the
+// materials above, otherwise as an IMaterial.
+template <typename Visitor>
+decltype(auto) visitMaterial(const IMaterial& material, Visitor&& visitor) {
+  switch (material.kind()) {
+  case MaterialKind::Lambertian:
+    return visitor(static_cast<const Lambertian&>(material));
+  case MaterialKind::Metal:
+    return visitor(static_cast<const Metal&>(material));
+  case MaterialKind::Dielectric:
+    return visitor(static_cast<const Dielectric&>(material));
+  case MaterialKind::DiffuseLight:
+    return visitor(static_cast<const DiffuseLight&>(material));
+  case MaterialKind::Isotropic:
+    return visitor(static_cast<const Isotropic&>(material));
+  case MaterialKind::Custom:
+    break;
+  }
+  return visitor(material);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "vec3.hpp"
+#include <cmath>
+
+class OrthonormalBasis {
+public:
+  OrthonormalBasis(const Vec3& normal) : mW{unitVector(normal)} {
+    // Pick the world axis least aligned with the normal as the helper vector.
+    constexpr double kAlignmentThreshold = 0.9;
+    const Vec3 helper = (std::fabs(mW.x()) > kAlignmentThreshold)
+                            ? Vec3{0, 1, 0}
+                            : Vec3{1, 0, 0};
+    mV = unitVector(cross(mW, helper));
+    mU = cross(mW, mV);
+  }
+
+  [[nodiscard]] const Vec3& u() const { return mU; }
+  [[nodiscard]] const Vec3& v() const { return mV; }
+  [[nodiscard]] const Vec3& w() const { return mW; }
+
+  [[nodiscard]] Vec3 transform(const Vec3& local) const {
+    // Maps a vector expressed in basis coordinates to world coordinates.
+    return (local.x() * mU) + (local.y() * mV) + (local.z() * mW);
+  }
+
+private:
+  Vec3 mU, mV, mW;
+};
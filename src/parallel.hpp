@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+inline unsigned int threadCount() {
+  return std::max(1U, std::thread::hardware_concurrency());
+}
+
+// Calls body(i) for every i in [begin, end) across all hardware threads. The
+// indices are handed out one at a time, so uneven work balances itself.
+template <typename Function>
+void parallelFor(int begin, int end, const Function& body) {
+  const auto workers = std::min(
+      threadCount(), static_cast<unsigned int>(std::max(end - begin, 0)));
+  if (workers <= 1) {
+    for (int i = begin; i < end; ++i) {
+      body(i);
+    }
+    return;
+  }
+
+  std::atomic<int> next{begin};
+  auto work = [&] {
+    for (int i = next++; i < end; i = next++) {
+      body(i);
+    }
+  };
+
+  std::vector<std::jthread> threads;
+  threads.reserve(workers - 1);
+  for (unsigned int i = 1; i < workers; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+}
+
+// Long-lived threads that run submitted tasks in the order they arrive, for
+// work that comes in from several sources over time. Tasks still queued when
+// the pool is destroyed are dropped.
+class WorkerPool {
+public:
+  explicit WorkerPool(unsigned int threads = threadCount()) {
+    mThreads.reserve(threads);
+    for (unsigned int i = 0; i < threads; ++i) {
+      mThreads.emplace_back([this](const std::stop_token& stop) { run(stop); });
+    }
+  }
+
+  void submit(std::function<void()> task) {
+    {
+      const std::scoped_lock lock{mMutex};
+      mTasks.push_back(std::move(task));
+    }
+    mChanged.notify_one();
+  }
+
+private:
+  std::mutex mMutex;
+  std::condition_variable_any mChanged;
+  std::deque<std::function<void()>> mTasks;
+  // Declared last, so the threads are stopped and joined first.
+  std::vector<std::jthread> mThreads;
+
+  void run(const std::stop_token& stop) {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock{mMutex};
+        if (!mChanged.wait(lock, stop, [this] { return !mTasks.empty(); })) {
+          return;
+        }
+        task = std::move(mTasks.front());
+        mTasks.pop_front();
+      }
+      task();
+    }
+  }
+};
+
+} // namespace utils
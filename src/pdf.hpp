@@ -0,0 +1,92 @@
+#pragma once
+
+#include "hittable.hpp"
+#include "onb.hpp"
+#include "utils.hpp"
+#include "vec3.hpp"
+#include <memory>
+
+class PDF {
+public:
+  PDF() = default;
+  PDF(const PDF&) = default;
+  PDF(PDF&&) = default;
+  PDF& operator=(const PDF&) = default;
+  PDF& operator=(PDF&&) = default;
+  virtual ~PDF() = default;
+
+  // Density (per unit solid angle) of generating the given direction.
+  [[nodiscard]] virtual double value(const Vec3& direction) const = 0;
+  // Draws a direction distributed according to value().
+  [[nodiscard]] virtual Vec3 generate() const = 0;
+};
+
+class SpherePDF : public PDF {
+public:
+  [[nodiscard]] double value(const Vec3& direction) const override {
+    (void)direction;
+    return 1 / (4 * utils::PI);
+  }
+
+  [[nodiscard]] Vec3 generate() const override { return randomUnitVector(); }
+};
+
+class CosinePDF : public PDF {
+public:
+  CosinePDF(const Vec3& normal) : mBasis{normal} {}
+
+  [[nodiscard]] double value(const Vec3& direction) const override {
+    const auto cosine = dot(unitVector(direction), mBasis.w());
+    return std::fmax(0, cosine / utils::PI);
+  }
+
+  [[nodiscard]] Vec3 generate() const override {
+    return mBasis.transform(randomCosineDirection());
+  }
+
+private:
+  OrthonormalBasis mBasis;
+};
+
+class HittablePDF : public PDF {
+public:
+  HittablePDF(const Hittable& objects, const Vec3& origin)
+      : mObjects{objects}, mOrigin{origin} {}
+
+  [[nodiscard]] double value(const Vec3& direction) const override {
+    return mObjects.pdfValue(mOrigin, direction);
+  }
+
+  [[nodiscard]] Vec3 generate() const override {
+    return mObjects.random(mOrigin);
+  }
+
+private:
+  const Hittable& mObjects;
+  Vec3 mOrigin;
+};
+
+class MixturePDF : public PDF {
+public:
+  // Holds references so a mixture can be built on the stack per bounce; both
+  // PDFs must outlive it.
+  MixturePDF(const PDF& first, const PDF& second, double firstWeight = 0.5)
+      : mFirst{first}, mSecond{second}, mFirstWeight{firstWeight} {}
+
+  [[nodiscard]] double value(const Vec3& direction) const override {
+    return (mFirstWeight * mFirst.value(direction)) +
+           ((1 - mFirstWeight) * mSecond.value(direction));
+  }
+
+  [[nodiscard]] Vec3 generate() const override {
+    if (utils::randomDouble() < mFirstWeight) {
+      return mFirst.generate();
+    }
+    return mSecond.generate();
+  }
+
+private:
+  const PDF& mFirst;
+  const PDF& mSecond;
+  double mFirstWeight;
+};
@@ -1,45 +1,75 @@
 #pragma once
-#include "intVec3.hpp"
+#include "fingerprint.hpp"
 #include "utils.hpp"
 #include "vec3.hpp"
+#include <array>
+#include <cmath>
 #include <cstddef>
 #include <utility>
 
 class Perlin {
 public:
   Perlin() {
-    for (Vec3& i : mRandomValues) {
-      i = unitVector(Vec3::random(-1.0, 1.0));
+    for (size_t i = 0; i < kPointCount; ++i) {
+      const Vec3 gradient = unitVector(Vec3::random(-1.0, 1.0));
+      mGradientX[i] = gradient.x();
+      mGradientY[i] = gradient.y();
+      mGradientZ[i] = gradient.z();
     }
 
-    generatePermutations(mPermutations);
+    generatePermutations();
   }
 
   [[nodiscard]] double noise(const Vec3& p) const {
-    auto u = p.x() - std::floor(p.x());
-    auto v = p.y() - std::floor(p.y());
-    auto w = p.z() - std::floor(p.z());
-
-    auto i = int(std::floor(p.x()));
-    auto j = int(std::floor(p.y()));
-    auto k = int(std::floor(p.z()));
-    Vec3 c[2][2][2];
-
-    for (int di = 0; di < 2; di++) {
-      for (int dj = 0; dj < 2; dj++) {
-        for (int dk = 0; dk < 2; dk++) {
-          size_t xIndex = (i + di) & 255;
-          size_t yIndex = (j + dj) & 255;
-          size_t zIndex = (k + dk) & 255;
-          auto finalIndex =
-              size_t(mPermutations[xIndex].x ^ mPermutations[yIndex].y ^
-                     mPermutations[zIndex].z);
-          c[di][dj][dk] = mRandomValues[finalIndex];
-        }
-      }
+    // All eight lattice corners are evaluated as lanes of flat arrays so the
+    // gather, dot products and weighting vectorize instead of running as a
+    // triple-nested loop over Vec3s.
+    const auto i = fastFloor(p.x());
+    const auto j = fastFloor(p.y());
+    const auto k = fastFloor(p.z());
+    const auto u = p.x() - i;
+    const auto v = p.y() - j;
+    const auto w = p.z() - k;
+
+    const auto uu = u * u * (3 - 2 * u);
+    const auto vv = v * v * (3 - 2 * v);
+    const auto ww = w * w * (3 - 2 * w);
+
+    const std::array<int, 2> xHash{mPermutation[size_t(i & kPointMask)],
+                                   mPermutation[size_t((i + 1) & kPointMask)]};
+    const std::array<int, 2> yHash{mPermutation[size_t(j & kPointMask)],
+                                   mPermutation[size_t((j + 1) & kPointMask)]};
+    const std::array<int, 2> zHash{mPermutation[size_t(k & kPointMask)],
+                                   mPermutation[size_t((k + 1) & kPointMask)]};
+
+    std::array<double, kCorners> gradientX{};
+    std::array<double, kCorners> gradientY{};
+    std::array<double, kCorners> gradientZ{};
+    for (size_t corner = 0; corner < kCorners; ++corner) {
+      const auto index = size_t(xHash[cornerBit(corner, 2)] ^
+                                yHash[cornerBit(corner, 1)] ^
+                                zHash[cornerBit(corner, 0)]);
+      gradientX[corner] = mGradientX[index];
+      gradientY[corner] = mGradientY[index];
+      gradientZ[corner] = mGradientZ[index];
     }
 
-    return perlinInterpolation(c, u, v, w);
+    const std::array<double, 2> uWeight{1 - uu, uu};
+    const std::array<double, 2> vWeight{1 - vv, vv};
+    const std::array<double, 2> wWeight{1 - ww, ww};
+
+    auto accum = 0.0;
+    for (size_t corner = 0; corner < kCorners; ++corner) {
+      const auto di = cornerBit(corner, 2);
+      const auto dj = cornerBit(corner, 1);
+      const auto dk = cornerBit(corner, 0);
+      const auto dotProduct = gradientX[corner] * (u - double(di)) +
+                              gradientY[corner] * (v - double(dj)) +
+                              gradientZ[corner] * (w - double(dk));
+      accum += uWeight[di] * vWeight[dj] * wWeight[dk] * dotProduct;
+    }
+
+    return accum;
   }
 
   [[nodiscard]] double turbulence(const Vec3& p, int depth) const {
@@ -56,44 +86,50 @@ public:
     return std::fabs(accum);
   }
 
+  // The random gradients and permutation make the pattern.
+  void fingerprint(Fingerprint& print) const {
+    for (size_t i = 0; i < kPointCount; ++i) {
+      print.add(mGradientX[i]);
+      print.add(mGradientY[i]);
+      print.add(mGradientZ[i]);
+      print.add(mPermutation[i]);
+    }
+  }
+
 private:
-  static const int kPointCount = 256;
-  std::array<Vec3, kPointCount> mRandomValues;
-  std::array<TVec3<int>, kPointCount> mPermutations;
-
-  static void
-  generatePermutations(std::array<TVec3<int>, kPointCount>& points) {
-    for (int i = 0; i < kPointCount; i++) {
-      points[size_t(i)] = TVec3<int>{i, i, i};
+  static constexpr size_t kPointCount = 256;
+  static constexpr int kPointMask = kPointCount - 1;
+  static constexpr size_t kCorners = 8;
+  std::array<double, kPointCount> mGradientX{};
+  std::array<double, kPointCount> mGradientY{};
+  std::array<double, kPointCount> mGradientZ{};
+  std::array<int, kPointCount> mPermutation{};
+
+  static int fastFloor(double x) {
+    // std::floor is a library call unless the target has SSE4.1.
+    const auto truncated = static_cast<int>(x);
+    return x < truncated ? truncated - 1 : truncated;
+  }
+
+  // Corner c of the lattice cell has offsets (c >> 2, c >> 1, c) & 1.
+  static constexpr size_t cornerBit(size_t corner, size_t shift) {
+    return (corner >> shift) & 1U;
+  }
+
+  void generatePermutations() {
+    // The x, y and z axes have always been shuffled together as triples, so a
+    // single table serves all three.
+    for (size_t i = 0; i < kPointCount; i++) {
+      mPermutation[i] = int(i);
     }
 
-    permute(points, kPointCount);
+    permute(mPermutation, kPointCount);
   }
 
-  static void permute(std::array<TVec3<int>, kPointCount>& points, size_t n) {
+  static void permute(std::array<int, kPointCount>& points, size_t n) {
     for (size_t i = n - 1; i > 0; i--) {
       auto target = static_cast<size_t>(utils::randomInt(0, int(i)));
       std::swap(points[i], points[target]);
     }
   }
-  static double perlinInterpolation(const Vec3 c[2][2][2], double u, double v,
-                                    double w) {
-    auto uu = u * u * (3 - 2 * u);
-    auto vv = v * v * (3 - 2 * v);
-    auto ww = w * w * (3 - 2 * w);
-    auto accum = 0.0;
-
-    for (int i = 0; i < 2; i++) {
-      for (int j = 0; j < 2; j++) {
-        for (int k = 0; k < 2; k++) {
-          Vec3 weight_v(u - i, v - j, w - k);
-          accum += (i * uu + (1 - i) * (1 - uu)) *
-                   (j * vv + (1 - j) * (1 - vv)) *
-                   (k * ww + (1 - k) * (1 - ww)) * dot(c[i][j][k], weight_v);
-        }
-      }
-    }
-
-    return accum;
-  }
 };
\ No newline at end of file
@@ -1,10 +1,13 @@
 #pragma once
 
+#include "arena.hpp"
 #include "hittable.hpp"
-#include "hittable_list.hpp"
 #include "material.hpp"
+#include "stats.hpp"
 #include "vec3.hpp"
+#include <cmath>
 #include <memory>
+#include <utility>
 
 class Quad : public Hittable {
 public:
@@ -15,44 +18,75 @@ public:
         mNormal{cross(mWidthVector, mHeightVector)},
         mW{mNormal / dot(mNormal, mNormal)}, mMaterial{material} {
     setBoundingBox();
+    mArea = mNormal.length();
     mNormal = unitVector(mNormal);
     mDistanceFromOrigin = {dot(mNormal, mPosition)};
   }
 
   bool hit(const Ray& ray, Interval rayRange,
            HitRecord& hitInfo) const override {
-    const auto rayPlaneAngle = dot(mNormal, ray.direction());
-
-    if (std::fabs(rayPlaneAngle) < kEpsilon) {
+    double t = 0;
+    double alpha = 0;
+    double beta = 0;
+    if (!intersect(ray, rayRange, t, alpha, beta)) {
       return false;
     }
 
-    const auto t =
-        (mDistanceFromOrigin - dot(mNormal, ray.origin())) / rayPlaneAngle;
+    hitInfo.t = t;
+    hitInfo.position = ray.at(t);
+    hitInfo.uv = {alpha, beta};
+    hitInfo.material = mMaterial;
+    hitInfo.setFaceNormal(ray, mNormal);
+    hitInfo.dpdu = mWidthVector;
+    hitInfo.dpdv = mHeightVector;
 
-    if (!rayRange.contains(t)) {
-      return false;
-    }
+    return true;
+  }
 
-    const auto intersection = ray.at(t);
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    double t = 0;
+    double alpha = 0;
+    double beta = 0;
+    return intersect(ray, rayRange, t, alpha, beta);
+  }
 
-    Vec3 planeHitVector = intersection - mPosition;
-    auto alpha = dot(mW, cross(planeHitVector, mHeightVector));
-    auto beta = dot(mW, cross(mWidthVector, planeHitVector));
+  [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
 
-    if (!isInterior(alpha, beta, hitInfo)) {
-      return false;
+  [[nodiscard]] double pdfValue(const Vec3& origin,
+                                const Vec3& direction) const override {
+    HitRecord hitInfo;
+    if (!hit(Ray{origin, direction}, Interval{0.001, utils::INFINITE_DOUBLE},
+             hitInfo)) {
+      return 0;
     }
 
-    hitInfo.t = t;
-    hitInfo.position = intersection;
-    hitInfo.material = mMaterial;
-    hitInfo.setFaceNormal(ray, mNormal);
+    // Convert the uniform area density to a solid angle density.
+    const auto distanceSquared =
+        hitInfo.t * hitInfo.t * direction.length_squared();
+    const auto cosine =
+        std::fabs(dot(direction, hitInfo.normal()) / direction.length());
 
-    return true;
+    return distanceSquared / (cosine * mArea);
   }
 
-  [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
+  [[nodiscard]] Vec3 random(const Vec3& origin) const override {
+    const auto [r1, r2] = utils::randomPair();
+    const auto point =
+        mPosition + (r1 * mWidthVector) + (r2 * mHeightVector);
+    return point - origin;
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("Quad");
+    print.add(mPosition);
+    print.add(mWidthVector);
+    print.add(mHeightVector);
+    // Shapes that only guide light sampling have no material.
+    if (mMaterial) {
+      mMaterial->fingerprint(print);
+    }
+  }
 
 private:
   Vec3 mPosition;
@@ -61,6 +95,7 @@ private:
   Vec3 mNormal;
   Vec3 mW;
   double mDistanceFromOrigin{0};
+  double mArea{0};
   std::shared_ptr<IMaterial> mMaterial;
   AABB mBoundingBox;
 
@@ -74,47 +109,227 @@ private:
     mBoundingBox = {firstDiagonal, secondDiagonal};
   }
 
-  static bool isInterior(double a, double b, HitRecord& hitInfo) {
+  bool intersect(const Ray& ray, Interval rayRange, double& t, double& alpha,
+                 double& beta) const {
+    stats::add(stats::Counter::QuadTests);
+    const auto rayPlaneAngle = dot(mNormal, ray.direction());
+
+    if (std::fabs(rayPlaneAngle) < kEpsilon) {
+      return false;
+    }
+
+    t = (mDistanceFromOrigin - dot(mNormal, ray.origin())) / rayPlaneAngle;
+
+    if (!rayRange.contains(t)) {
+      return false;
+    }
+
+    Vec3 planeHitVector = ray.at(t) - mPosition;
+    alpha = dot(mW, cross(planeHitVector, mHeightVector));
+    beta = dot(mW, cross(mWidthVector, planeHitVector));
+
+    return isInterior(alpha, beta);
+  }
+
+  static bool isInterior(double a, double b) {
     const auto unitInterval = Interval(0, 1);
 
-    if (!unitInterval.contains(a) || !unitInterval.contains(b)) {
+    return unitInterval.contains(a) && unitInterval.contains(b);
+  }
+};
+
+// Rectangular box, rotated about its local y axis and then translated. Found
+// with a single slab test in local space; the face that was hit follows from
+// the axis on which the ray entered (or left, when it starts inside). Each
+// face is parameterized like the quads box() used to build from.
+class Box final : public Hittable {
+public:
+  Box(const Vec3& min, const Vec3& max, std::shared_ptr<IMaterial> material,
+      double rotationY = 0, const Vec3& translation = Vec3{})
+      : mMin{min}, mMax{max}, mSize{max - min}, mTranslation{translation},
+        mMaterial{std::move(material)} {
+    const double radians = utils::toRadians(rotationY);
+    mSinTheta = std::sin(radians);
+    mCosTheta = std::cos(radians);
+
+    Vec3 low{utils::INFINITE_DOUBLE};
+    Vec3 high{-utils::INFINITE_DOUBLE};
+    for (int corner = 0; corner < 8; ++corner) {
+      const Vec3 point = toWorld(Vec3{(corner & 1) != 0 ? max.x() : min.x(),
+                                      (corner & 2) != 0 ? max.y() : min.y(),
+                                      (corner & 4) != 0 ? max.z() : min.z()});
+      for (size_t axis = 0; axis < 3; ++axis) {
+        low[axis] = std::fmin(low[axis], point[axis]);
+        high[axis] = std::fmax(high[axis], point[axis]);
+      }
+    }
+    mBoundingBox = AABB{low + mTranslation, high + mTranslation};
+  }
+
+  bool hit(const Ray& ray, Interval rayRange,
+           HitRecord& hitInfo) const override {
+    const Ray local = toObject(ray);
+    Slabs slabs;
+    if (!intersect(local, slabs)) {
       return false;
     }
-    hitInfo.uv = {a, b};
+
+    size_t axis = slabs.entryAxis;
+    bool maxSide = slabs.entryMaxSide;
+    double t = slabs.entry;
+    if (!rayRange.contains(t)) {
+      axis = slabs.exitAxis;
+      maxSide = slabs.exitMaxSide;
+      t = slabs.exit;
+      if (!rayRange.contains(t)) {
+        return false;
+      }
+    }
+
+    const Vec3 position = local.at(t);
+    const Face& face = kFaces[axis][maxSide ? 1 : 0];
+    const auto faceCoordinate = [&](size_t faceAxis, double sign) {
+      const double offset = sign > 0 ? position[faceAxis] - mMin[faceAxis]
+                                     : mMax[faceAxis] - position[faceAxis];
+      return offset / mSize[faceAxis];
+    };
+    const auto faceEdge = [&](size_t faceAxis, double sign) {
+      Vec3 edge;
+      edge[faceAxis] = sign * mSize[faceAxis];
+      return edge;
+    };
+    Vec3 outwardNormal;
+    outwardNormal[axis] = maxSide ? 1 : -1;
+
+    hitInfo.t = t;
+    hitInfo.position = toWorld(position) + mTranslation;
+    hitInfo.uv = {faceCoordinate(face.uAxis, face.uSign),
+                  faceCoordinate(face.vAxis, face.vSign)};
+    hitInfo.material = mMaterial;
+    hitInfo.setFaceNormal(ray, toWorld(outwardNormal));
+    hitInfo.dpdu = toWorld(faceEdge(face.uAxis, face.uSign));
+    hitInfo.dpdv = toWorld(faceEdge(face.vAxis, face.vSign));
     return true;
   }
+
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    // The surface is crossed inside rayRange if the ray enters or leaves the
+    // box there.
+    Slabs slabs;
+    if (!intersect(toObject(ray), slabs)) {
+      return false;
+    }
+    return rayRange.contains(slabs.entry) || rayRange.contains(slabs.exit);
+  }
+
+  bool hitSpan(const Ray& ray, Interval rayRange,
+               Interval& span) const override {
+    Slabs slabs;
+    if (!intersect(toObject(ray), slabs)) {
+      return false;
+    }
+    span = Interval{std::fmax(slabs.entry, rayRange.min()),
+                    std::fmin(slabs.exit, rayRange.max())};
+    return span.min() < span.max();
+  }
+
+  [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("Box");
+    print.add(mMin);
+    print.add(mMax);
+    print.add(mTranslation);
+    print.add(mSinTheta);
+    print.add(mCosTheta);
+    if (mMaterial) {
+      mMaterial->fingerprint(print);
+    }
+  }
+
+private:
+  // Where the ray crosses the box boundary, and through which face.
+  struct Slabs {
+    double entry{-utils::INFINITE_DOUBLE};
+    double exit{utils::INFINITE_DOUBLE};
+    size_t entryAxis{};
+    size_t exitAxis{};
+    bool entryMaxSide{};
+    bool exitMaxSide{};
+  };
+
+  // Directions of u and v across a face, indexed by [axis][min or max side].
+  struct Face {
+    size_t uAxis;
+    double uSign;
+    size_t vAxis;
+    double vSign;
+  };
+  static constexpr Face kFaces[3][2]{{{2, 1, 1, 1}, {2, -1, 1, 1}},
+                                     {{0, 1, 2, 1}, {0, 1, 2, -1}},
+                                     {{0, -1, 1, 1}, {0, 1, 1, 1}}};
+
+  Vec3 mMin;
+  Vec3 mMax;
+  Vec3 mSize;
+  Vec3 mTranslation;
+  double mSinTheta{};
+  double mCosTheta{1};
+  std::shared_ptr<IMaterial> mMaterial;
+  AABB mBoundingBox;
+
+  bool intersect(const Ray& local, Slabs& slabs) const {
+    stats::add(stats::Counter::BoxPrimitiveTests);
+    for (size_t axis = 0; axis < 3; ++axis) {
+      const double inverse = 1.0 / local.direction()[axis];
+      const double toMin = (mMin[axis] - local.origin()[axis]) * inverse;
+      const double toMax = (mMax[axis] - local.origin()[axis]) * inverse;
+      // A ray travelling towards -axis enters through the max side.
+      const bool entersMaxSide = inverse < 0;
+      const double near = entersMaxSide ? toMax : toMin;
+      const double far = entersMaxSide ? toMin : toMax;
+      if (near > slabs.entry) {
+        slabs.entry = near;
+        slabs.entryAxis = axis;
+        slabs.entryMaxSide = entersMaxSide;
+      }
+      if (far < slabs.exit) {
+        slabs.exit = far;
+        slabs.exitAxis = axis;
+        slabs.exitMaxSide = !entersMaxSide;
+      }
+    }
+    return slabs.entry <= slabs.exit;
+  }
+
+  [[nodiscard]] Ray toObject(const Ray& ray) const {
+    return {toObjectRotation(ray.origin() - mTranslation),
+            toObjectRotation(ray.direction()), ray.time()};
+  }
+
+  [[nodiscard]] Vec3 toObjectRotation(const Vec3& world) const {
+    return {mCosTheta * world.x() - mSinTheta * world.z(), world.y(),
+            mSinTheta * world.x() + mCosTheta * world.z()};
+  }
+
+  [[nodiscard]] Vec3 toWorld(const Vec3& local) const {
+    return {mCosTheta * local.x() + mSinTheta * local.z(), local.y(),
+            -mSinTheta * local.x() + mCosTheta * local.z()};
+  }
 };
 
-inline std::shared_ptr<HittableList> box(const Vec3& a, const Vec3& b,
-                                         std::shared_ptr<IMaterial> material) {
-  // Returns the 3D box (six sides) that contains the two opposite vertices a &
-  // b.
-
-  auto sides = std::make_shared<HittableList>();
-
-  // Construct the two opposite vertices with the minimum and maximum
-  // coordinates.
-  auto min = Vec3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()),
-                  std::fmin(a.z(), b.z()));
-  auto max = Vec3(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()),
-                  std::fmax(a.z(), b.z()));
-
-  auto dx = Vec3(max.x() - min.x(), 0, 0);
-  auto dy = Vec3(0, max.y() - min.y(), 0);
-  auto dz = Vec3(0, 0, max.z() - min.z());
-
-  sides->add(make_shared<Quad>(Vec3(min.x(), min.y(), max.z()), dx, dy,
-                               material)); // front
-  sides->add(make_shared<Quad>(Vec3(max.x(), min.y(), max.z()), -dz, dy,
-                               material)); // right
-  sides->add(make_shared<Quad>(Vec3(max.x(), min.y(), min.z()), -dx, dy,
-                               material)); // back
-  sides->add(make_shared<Quad>(Vec3(min.x(), min.y(), min.z()), dz, dy,
-                               material)); // left
-  sides->add(make_shared<Quad>(Vec3(min.x(), max.y(), max.z()), dx, -dz,
-                               material)); // top
-  sides->add(make_shared<Quad>(Vec3(min.x(), min.y(), min.z()), dx, dz,
-                               material)); // bottom
-
-  return sides;
-}
\ No newline at end of file
+// Returns the 3D box that contains the two opposite vertices a & b, rotated
+// by rotationY degrees about the y axis through the origin and then moved by
+// translation.
+inline std::shared_ptr<Box> box(const Vec3& a, const Vec3& b,
+                                std::shared_ptr<IMaterial> material,
+                                double rotationY = 0,
+                                const Vec3& translation = Vec3{}) {
+  const auto min = Vec3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()),
+                        std::fmin(a.z(), b.z()));
+  const auto max = Vec3(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()),
+                        std::fmax(a.z(), b.z()));
+  return makeShared<Box>(min, max, std::move(material), rotationY,
+                         translation);
+}
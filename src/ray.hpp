@@ -2,12 +2,26 @@
 #include "utils.hpp"
 #include "vec3.hpp"
 
+// Offset rays through the neighbouring pixels in x and y, used to estimate
+// the footprint of a camera ray on the surfaces it hits.
+struct RayDifferential {
+  Vec3 xOrigin;
+  Vec3 xDirection;
+  Vec3 yOrigin;
+  Vec3 yDirection;
+};
+
 class Ray {
 public:
   Ray() = default;
 
   Ray(const Vec3 origin, const Vec3 direction, double time)
       : mOrigin{origin}, mDirection{direction}, mTime{time} {};
+  // The differential is not owned and must outlive the ray.
+  Ray(const Vec3 origin, const Vec3 direction, double time,
+      const RayDifferential* differential)
+      : mOrigin{origin}, mDirection{direction}, mTime{time},
+        mDifferential{differential} {};
   Ray(const Vec3 origin, const Vec3 direction)
       : mOrigin{origin}, mDirection{direction} {};
 
@@ -16,6 +30,10 @@ public:
 
   [[nodiscard]] double time() const { return mTime; }
 
+  [[nodiscard]] const RayDifferential* differential() const {
+    return mDifferential;
+  }
+
   [[nodiscard]] Vec3 at(double t) const { return mOrigin + t * mDirection; }
 
   double hitSphere(const Vec3& sphereCenter, double radius) {
@@ -31,4 +49,5 @@ private:
   Vec3 mOrigin;
   Vec3 mDirection;
   double mTime{};
+  const RayDifferential* mDifferential{nullptr};
 };
\ No newline at end of file
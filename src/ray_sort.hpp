@@ -0,0 +1,106 @@
+#pragma once
+
+#include "ray.hpp"
+#include "utils.hpp"
+#include "vec3.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Orders a batch of rays so that rays traced one after another point into the
+// same octant and start close together: sorted by direction octant, then
+// along a Morton (Z-order) curve through the bounds of the batch's origins.
+// Such rays visit mostly the same BVH nodes and objects, which then stay in
+// cache between them.
+class RaySorter {
+public:
+  // Reorders indices, each naming the ray rayOf(index) returns.
+  template <typename RayOf>
+  void sort(std::vector<std::uint32_t>& indices, RayOf&& rayOf) {
+    Vec3 low{utils::INFINITE_DOUBLE};
+    Vec3 high{-utils::INFINITE_DOUBLE};
+    for (const std::uint32_t index : indices) {
+      const Vec3& origin = rayOf(index).origin();
+      for (size_t axis = 0; axis < 3; ++axis) {
+        low[axis] = std::min(low[axis], origin[axis]);
+        high[axis] = std::max(high[axis], origin[axis]);
+      }
+    }
+    Vec3 scale;
+    for (size_t axis = 0; axis < 3; ++axis) {
+      const double extent = high[axis] - low[axis];
+      scale[axis] = extent > 0 ? kCells / extent : 0.0;
+    }
+
+    // The 30-bit key goes in the high half and the index in the low half, so
+    // one integer sort orders both.
+    mKeys.clear();
+    for (const std::uint32_t index : indices) {
+      const Ray& ray = rayOf(index);
+      std::uint64_t key = octant(ray.direction()) << (3 * kBitsPerAxis);
+      for (size_t axis = 0; axis < 3; ++axis) {
+        const double cell = (ray.origin()[axis] - low[axis]) * scale[axis];
+        key |= spreadBits(static_cast<std::uint64_t>(
+                   std::clamp(cell, 0.0, kCells - 1)))
+               << (2 - axis);
+      }
+      mKeys.push_back(key << 32U | index);
+    }
+    radixSort();
+    for (size_t i = 0; i < mKeys.size(); ++i) {
+      indices[i] = static_cast<std::uint32_t>(mKeys[i]);
+    }
+  }
+
+private:
+  static constexpr unsigned kBitsPerAxis = 9;
+  static constexpr double kCells = 1U << kBitsPerAxis;
+
+  // Three 10-bit digits cover the 30-bit key.
+  static constexpr unsigned kDigitBits = 10;
+  static constexpr unsigned kDigitCount = 3;
+
+  std::vector<std::uint64_t> mKeys;
+  std::vector<std::uint64_t> mScratch;
+  std::vector<std::uint32_t> mCounts;
+
+  // Sorts mKeys by key, least significant digit first. Stable, so equal keys
+  // keep their index order, and much cheaper than std::sort for the batch
+  // sizes the camera uses.
+  void radixSort() {
+    constexpr size_t kBuckets = size_t{1} << kDigitBits;
+    mScratch.resize(mKeys.size());
+    for (unsigned digit = 0; digit < kDigitCount; ++digit) {
+      const unsigned shift = 32 + digit * kDigitBits;
+      mCounts.assign(kBuckets, 0);
+      for (const std::uint64_t key : mKeys) {
+        ++mCounts[key >> shift & (kBuckets - 1)];
+      }
+      std::uint32_t offset = 0;
+      for (std::uint32_t& count : mCounts) {
+        offset += std::exchange(count, offset);
+      }
+      for (const std::uint64_t key : mKeys) {
+        mScratch[mCounts[key >> shift & (kBuckets - 1)]++] = key;
+      }
+      std::swap(mKeys, mScratch);
+    }
+  }
+
+  static std::uint64_t octant(const Vec3& direction) {
+    return (direction.x() < 0 ? 4U : 0U) | (direction.y() < 0 ? 2U : 0U) |
+           (direction.z() < 0 ? 1U : 0U);
+  }
+
+  // Spreads the low 10 bits out to every third bit.
+  static std::uint64_t spreadBits(std::uint64_t value) {
+    value = (value | value << 16U) & 0x030000ffU;
+    value = (value | value << 8U) & 0x0300f00fU;
+    value = (value | value << 4U) & 0x030c30c3U;
+    value = (value | value << 2U) & 0x09249249U;
+    return value;
+  }
+};
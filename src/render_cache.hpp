@@ -0,0 +1,91 @@
+#pragma once
+
+#include "framebuffer.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// Rendered tiles kept on disk, each in a file named after the fingerprint of
+// everything that went into it, so a later render, also in another run, can
+// reuse every tile a change did not touch. A tile is stored as one or more
+// tile-sized layers, colour first.
+class RenderCache {
+public:
+  explicit RenderCache(std::filesystem::path directory)
+      : mDirectory{std::move(directory)} {
+    std::error_code error;
+    std::filesystem::create_directories(mDirectory, error);
+  }
+
+  // Fills layers, which give the size and channels expected of each, from
+  // the tile stored under key. Returns false if there is none that matches.
+  bool load(std::uint64_t key, std::vector<FrameBuffer>& layers) const {
+    std::ifstream file{path(key), std::ios::binary};
+    if (!file || readValue(file) != kMagic ||
+        readValue(file) != static_cast<std::uint32_t>(layers.size())) {
+      return false;
+    }
+    for (FrameBuffer& layer : layers) {
+      if (readValue(file) != static_cast<std::uint32_t>(layer.width()) ||
+          readValue(file) != static_cast<std::uint32_t>(layer.height()) ||
+          readValue(file) != static_cast<std::uint32_t>(layer.channels())) {
+        return false;
+      }
+      file.read(reinterpret_cast<char*>(layer.data()),
+                static_cast<std::streamsize>(layer.size() * sizeof(float)));
+    }
+    return static_cast<bool>(file);
+  }
+
+  void store(std::uint64_t key, const std::vector<FrameBuffer>& layers) const {
+    // Written under another name first, so a render stopped half way never
+    // leaves a truncated tile behind.
+    const auto target = path(key);
+    auto partial = target;
+    partial += ".part";
+    {
+      std::ofstream file{partial, std::ios::binary};
+      writeValue(file, kMagic);
+      writeValue(file, static_cast<std::uint32_t>(layers.size()));
+      for (const FrameBuffer& layer : layers) {
+        writeValue(file, static_cast<std::uint32_t>(layer.width()));
+        writeValue(file, static_cast<std::uint32_t>(layer.height()));
+        writeValue(file, static_cast<std::uint32_t>(layer.channels()));
+        file.write(reinterpret_cast<const char*>(layer.data()),
+                   static_cast<std::streamsize>(layer.size() * sizeof(float)));
+      }
+      if (!file) {
+        return;
+      }
+    }
+    std::error_code error;
+    std::filesystem::rename(partial, target, error);
+  }
+
+private:
+  // "RTC1": render tile cache, format 1.
+  static constexpr std::uint32_t kMagic = 0x31435452;
+
+  std::filesystem::path mDirectory;
+
+  [[nodiscard]] std::filesystem::path path(std::uint64_t key) const {
+    std::ostringstream name;
+    name << std::hex << std::setfill('0') << std::setw(16) << key << ".tile";
+    return mDirectory / name.str();
+  }
+
+  static std::uint32_t readValue(std::ifstream& file) {
+    std::uint32_t value{};
+    file.read(reinterpret_cast<char*>(&value), sizeof(value));
+    return value;
+  }
+
+  static void writeValue(std::ofstream& file, std::uint32_t value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+};
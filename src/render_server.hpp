@@ -0,0 +1,474 @@
+#pragma once
+
+#include "arena.hpp"
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "hittable_list.hpp"
+#include "parallel.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "socket.hpp"
+#include "utils.hpp"
+#include "vec3.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Long-lived render server. A scene is built the first time a job asks for
+// it and then stays resident with its BVHs and textures, so later jobs only
+// pay for tracing. Jobs arrive as HTTP requests from this machine:
+//
+//   GET  /scenes   names of the scenes, one per line
+//   POST /render?scene=cornellBox&output=box.ppm[&width=400][&spp=64]
+//        [&depth=50][&lookfrom=x,y,z][&lookat=x,y,z][&vfov=40][&seed=7]
+//        [&sampler=independent|stratified|sobol|blueNoise]
+//
+// A render answers with a plain text stream: "tile x y width height" for
+// every finished tile, then "done <milliseconds>" once the image is written,
+// or "error <reason>". The tiles of all jobs share one worker pool. Outputs
+// are relative paths inside the output directory, so a request cannot
+// overwrite files elsewhere.
+class RenderServer {
+public:
+  struct Settings {
+    std::uint16_t port = 8080;
+    int tileSize = 32;
+    std::filesystem::path outputDirectory = ".";
+  };
+
+  explicit RenderServer(Settings settings)
+      : mSettings{settings}, mScenes{scene::all()} {}
+
+  // Serves until the process ends; false if the port cannot be opened.
+  bool run() {
+    const Socket listener = Socket::listen(mSettings.port, true);
+    if (!listener.valid()) {
+      std::clog << "Cannot listen on port " << mSettings.port << '\n';
+      return false;
+    }
+    std::clog << "Serving renders on port " << mSettings.port << '\n';
+
+    std::list<Connection> connections;
+    while (true) {
+      std::erase_if(connections, [](const Connection& connection) {
+        return connection.finished->load();
+      });
+      if (auto socket = listener.accept(kAcceptPollMilliseconds)) {
+        auto& connection = connections.emplace_back();
+        connection.thread = std::jthread{
+            [this, finished = connection.finished](const Socket& client) {
+              // One failing job must not take the server down with it.
+              try {
+                serve(client);
+              } catch (const std::exception& error) {
+                std::clog << "Request failed: " << error.what() << '\n';
+                (void)send(client, "error internal failure\n");
+              }
+              *finished = true;
+            },
+            std::move(*socket)};
+      }
+    }
+  }
+
+private:
+  static constexpr int kAcceptPollMilliseconds = 200;
+  static constexpr int kRequestTimeoutSeconds = 10;
+  static constexpr size_t kMaximumRequestBytes = 16384;
+  // Bounds on what one job may ask for, so it cannot exhaust memory or hold
+  // the workers indefinitely.
+  static constexpr int kMaximumImageSize = 8192;
+  static constexpr int kMaximumSamplesPerPixel = 1 << 16;
+  static constexpr int kMaximumDepth = 1024;
+
+  using Clock = std::chrono::steady_clock;
+  using Query = std::map<std::string, std::string, std::less<>>;
+
+  struct Resident {
+    SceneArena arena;
+    HittableList world;
+    HittableList lights;
+    Camera camera;
+  };
+
+  struct Connection {
+    std::jthread thread;
+    std::shared_ptr<std::atomic<bool>> finished =
+        std::make_shared<std::atomic<bool>>(false);
+  };
+
+  struct Request {
+    std::string method;
+    std::string path;
+    Query query;
+  };
+
+  Settings mSettings;
+  std::vector<scene::Entry> mScenes;
+  std::mutex mResidentMutex;
+  std::map<std::string, std::unique_ptr<Resident>, std::less<>> mResident;
+  utils::WorkerPool mPool;
+
+  void serve(const Socket& socket) {
+    socket.setReceiveTimeout(kRequestTimeoutSeconds);
+    const auto request = receiveRequest(socket);
+    if (!request) {
+      return;
+    }
+    if (request->method == "GET" && request->path == "/scenes") {
+      std::string names;
+      for (const auto& entry : mScenes) {
+        names += entry.name + '\n';
+      }
+      (void)respond(socket, "200 OK", names);
+    } else if (request->method == "POST" && request->path == "/render") {
+      render(socket, request->query);
+    } else {
+      (void)respond(socket, "404 Not Found", "error unknown request\n");
+    }
+  }
+
+  void render(const Socket& socket, const Query& query) {
+    const auto name = query.find("scene");
+    const auto output = query.find("output");
+    if (name == query.end() || output == query.end()) {
+      (void)respond(socket, "400 Bad Request",
+                    "error scene and output are required\n");
+      return;
+    }
+    const Resident* loaded = resident(name->second);
+    if (loaded == nullptr) {
+      (void)respond(socket, "404 Not Found",
+                    "error unknown scene " + name->second + '\n');
+      return;
+    }
+    Camera camera = loaded->camera;
+    if (const std::string reason = configure(query, camera); !reason.empty()) {
+      (void)respond(socket, "400 Bad Request", "error " + reason + '\n');
+      return;
+    }
+    const auto path = outputPath(output->second);
+    if (!path) {
+      (void)respond(socket, "400 Bad Request",
+                    "error output must be a relative path without ..\n");
+      return;
+    }
+    std::ofstream file{*path};
+    if (!file) {
+      (void)respond(socket, "400 Bad Request",
+                    "error cannot write " + output->second + '\n');
+      return;
+    }
+    if (!respond(socket, "200 OK", "")) {
+      return;
+    }
+
+    const auto start = Clock::now();
+    const auto tiles = splitIntoTiles(camera.mImageWidth, camera.imageHeight(),
+                                      mSettings.tileSize);
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Tile> finished;
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> failed{false};
+    FrameBuffer image{camera.mImageWidth, camera.imageHeight()};
+    for (const Tile& tile : tiles) {
+      mPool.submit([&, tile] {
+        if (!cancelled) {
+          // An exception would end the worker thread and with it the server.
+          try {
+            Camera tileCamera = camera;
+            const FrameBuffer pixels =
+                loaded->lights.empty()
+                    ? tileCamera.renderTile(loaded->world, tile)
+                    : tileCamera.renderTile(loaded->world, loaded->lights,
+                                            tile);
+            const std::scoped_lock lock{mutex};
+            image.blit(pixels, tile);
+          } catch (const std::exception&) {
+            failed = true;
+            cancelled = true;
+          }
+        }
+        {
+          const std::scoped_lock lock{mutex};
+          finished.push_back(tile);
+        }
+        changed.notify_one();
+      });
+    }
+
+    // Every task refers to this frame, so wait for all of them even when the
+    // client has gone; the remaining tiles are then skipped.
+    for (size_t count = 0; count < tiles.size(); ++count) {
+      Tile tile;
+      {
+        std::unique_lock lock{mutex};
+        changed.wait(lock, [&] { return !finished.empty(); });
+        tile = finished.front();
+        finished.pop_front();
+      }
+      std::ostringstream line;
+      line << "tile " << tile.x << ' ' << tile.y << ' ' << tile.width << ' '
+           << tile.height << '\n';
+      if (!cancelled && !send(socket, line.str())) {
+        cancelled = true;
+      }
+    }
+    if (failed) {
+      std::clog << "Render of " << name->second << " failed\n";
+      (void)send(socket, "error render failed\n");
+      return;
+    }
+    if (cancelled) {
+      std::clog << "Client left; render of " << name->second
+                << " cancelled\n";
+      return;
+    }
+
+    image.writePPM(file);
+    const auto milliseconds =
+        std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                              start);
+    (void)send(socket, "done " + std::to_string(milliseconds.count()) + '\n');
+  }
+
+  // Builds a scene on first use; null for an unknown name. The build runs
+  // outside the lock, so jobs for resident scenes go on meanwhile. Two jobs
+  // that miss the same scene both build it, and the first one kept wins.
+  const Resident* resident(const std::string& name) {
+    {
+      const std::scoped_lock lock{mResidentMutex};
+      if (const auto found = mResident.find(name); found != mResident.end()) {
+        return found->second.get();
+      }
+    }
+    const auto entry = std::find_if(
+        mScenes.begin(), mScenes.end(),
+        [&](const scene::Entry& known) { return known.name == name; });
+    if (entry == mScenes.end()) {
+      return nullptr;
+    }
+
+    const auto start = Clock::now();
+    auto loaded = std::make_unique<Resident>();
+    // The same scene a fresh process would build.
+    utils::seedRandom(0);
+    {
+      const SceneArena::Scope scope{loaded->arena};
+      entry->build(loaded->world, loaded->lights, loaded->camera);
+    }
+    std::clog << "Loaded " << name << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     Clock::now() - start)
+                     .count()
+              << " ms\n";
+    const std::scoped_lock lock{mResidentMutex};
+    return mResident.try_emplace(name, std::move(loaded)).first->second.get();
+  }
+
+  // Where a job's output goes inside the output directory; nothing for paths
+  // that are absolute or climb out of it.
+  [[nodiscard]] std::optional<std::filesystem::path>
+  outputPath(const std::string& output) const {
+    const std::filesystem::path relative{output};
+    if (relative.empty() || relative.has_root_name() ||
+        relative.has_root_directory() || !relative.has_filename()) {
+      return std::nullopt;
+    }
+    for (const auto& part : relative) {
+      if (part == "..") {
+        return std::nullopt;
+      }
+    }
+    return mSettings.outputDirectory / relative;
+  }
+
+  // Applies the job's parameters to a copy of the scene's camera. Returns
+  // why they are invalid, or nothing.
+  static std::string configure(const Query& query, Camera& camera) {
+    for (const auto& [key, value] : query) {
+      bool valid = true;
+      if (key == "width") {
+        valid = parse(value, camera.mImageWidth) && camera.mImageWidth > 0 &&
+                camera.mImageWidth <= kMaximumImageSize;
+      } else if (key == "spp") {
+        valid = parse(value, camera.mSamplesPerPixel) &&
+                camera.mSamplesPerPixel > 0 &&
+                camera.mSamplesPerPixel <= kMaximumSamplesPerPixel;
+      } else if (key == "depth") {
+        valid = parse(value, camera.mMaxDepth) && camera.mMaxDepth > 0 &&
+                camera.mMaxDepth <= kMaximumDepth;
+      } else if (key == "vfov") {
+        valid = parse(value, camera.mVerticalFov) &&
+                camera.mVerticalFov > 0 && camera.mVerticalFov < 180;
+      } else if (key == "lookfrom") {
+        valid = parse(value, camera.mLookFrom);
+      } else if (key == "lookat") {
+        valid = parse(value, camera.mLookAt);
+      } else if (key == "seed") {
+        valid = parse(value, camera.mSeed);
+      } else if (key == "sampler") {
+        valid = parse(value, camera.mSamplerType);
+      } else if (key != "scene" && key != "output") {
+        return "unknown parameter " + key;
+      }
+      if (!valid) {
+        return "invalid " + key;
+      }
+    }
+    // The height follows from the width and the scene's aspect ratio.
+    if (camera.imageHeight() > kMaximumImageSize) {
+      return "invalid width";
+    }
+    // The camera must look somewhere, and not along its up direction.
+    const Vec3 forward = camera.mLookAt - camera.mLookFrom;
+    const double distanceSquared = forward.length_squared();
+    if (!(distanceSquared > 0) || !std::isfinite(distanceSquared) ||
+        cross(unitVector(forward), unitVector(camera.mUp)).near_zero()) {
+      return query.contains("lookat") ? "invalid lookat" : "invalid lookfrom";
+    }
+    return {};
+  }
+
+  template <typename Number>
+  static bool parse(std::string_view text, Number& value) {
+    const auto result =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == std::errc{} && result.ptr == text.data() + text.size();
+  }
+
+  // Finite numbers only; from_chars also reads "nan" and "inf".
+  static bool parse(std::string_view text, double& value) {
+    const auto result =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == std::errc{} &&
+           result.ptr == text.data() + text.size() && std::isfinite(value);
+  }
+
+  static bool parse(std::string_view text, Vec3& value) {
+    for (size_t axis = 0; axis < 3; ++axis) {
+      const auto comma = text.find(',');
+      if ((comma == std::string_view::npos) != (axis == 2) ||
+          !parse(text.substr(0, comma), value[axis])) {
+        return false;
+      }
+      text.remove_prefix(axis == 2 ? text.size() : comma + 1);
+    }
+    return true;
+  }
+
+  static bool parse(std::string_view text, SamplerType& value) {
+    constexpr std::array<std::pair<std::string_view, SamplerType>, 4> kNames{{
+        {"independent", SamplerType::Independent},
+        {"stratified", SamplerType::Stratified},
+        {"sobol", SamplerType::Sobol},
+        {"blueNoise", SamplerType::BlueNoise},
+    }};
+    for (const auto& [name, type] : kNames) {
+      if (text == name) {
+        value = type;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Reads the request line and headers; a body is not expected.
+  static std::optional<Request> receiveRequest(const Socket& socket) {
+    std::string received;
+    std::array<char, 1024> buffer{};
+    while (received.find("\r\n\r\n") == std::string::npos) {
+      const size_t size = socket.receiveSome(buffer.data(), buffer.size());
+      if (size == 0 || received.size() + size > kMaximumRequestBytes) {
+        return std::nullopt;
+      }
+      received.append(buffer.data(), size);
+    }
+
+    std::istringstream line{received.substr(0, received.find("\r\n"))};
+    Request request;
+    std::string target;
+    if (!(line >> request.method >> target)) {
+      return std::nullopt;
+    }
+    const auto question = target.find('?');
+    request.path = target.substr(0, question);
+    if (question == std::string::npos) {
+      return request;
+    }
+
+    std::string_view parameters{target};
+    parameters.remove_prefix(question + 1);
+    while (!parameters.empty()) {
+      const auto ampersand = parameters.find('&');
+      const auto parameter = parameters.substr(0, ampersand);
+      const auto equals = parameter.find('=');
+      if (equals != std::string_view::npos) {
+        request.query[decode(parameter.substr(0, equals))] =
+            decode(parameter.substr(equals + 1));
+      }
+      parameters.remove_prefix(ampersand == std::string_view::npos
+                                   ? parameters.size()
+                                   : ampersand + 1);
+    }
+    return request;
+  }
+
+  // Undoes the percent encoding of a query component.
+  static std::string decode(std::string_view text) {
+    std::string decoded;
+    for (size_t i = 0; i < text.size(); ++i) {
+      unsigned int byte = 0;
+      if (text[i] == '+') {
+        decoded += ' ';
+      } else if (text[i] == '%' && i + 2 < text.size() &&
+                 std::from_chars(text.data() + i + 1, text.data() + i + 3,
+                                 byte, 16)
+                         .ptr == text.data() + i + 3) {
+        decoded += static_cast<char>(byte);
+        i += 2;
+      } else {
+        decoded += text[i];
+      }
+    }
+    return decoded;
+  }
+
+  // Sends the status line and headers, then the start of the body. The
+  // connection closes after the response, so it needs no length.
+  static bool respond(const Socket& socket, std::string_view status,
+                      const std::string& body) {
+    std::string response{"HTTP/1.1 "};
+    response += status;
+    response += "\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n";
+    response += body;
+    return send(socket, response);
+  }
+
+  static bool send(const Socket& socket, const std::string& text) {
+    return socket.sendAll(text.data(), text.size());
+  }
+};
@@ -0,0 +1,386 @@
+#pragma once
+
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Sample generators for the camera. A sample of a pixel is a point in a
+// high-dimensional unit cube: the pixel offset takes its first two
+// dimensions, then the lens, the time and every random choice along the
+// path. Each get1D() or get2D() call takes the next dimension; a 2D
+// dimension is stratified jointly, a 1D one uses its first coordinate.
+// Within a dimension the samples of a pixel are spread evenly (except for
+// the independent sampler), and sequences of different pixels and
+// dimensions are decorrelated by hashing, so any pixel can be rendered on
+// its own.
+class Sampler : public utils::SampleSource {
+public:
+  // Starts sample sampleIndex of the pixel, at the first dimension.
+  virtual void startPixelSample(int xIndex, int yIndex, int sampleIndex) = 0;
+
+  // The dimension the next call takes. Saving and restoring it lets the
+  // camera interleave the samples of many paths.
+  [[nodiscard]] virtual std::uint32_t dimension() const = 0;
+  virtual void setDimension(std::uint32_t dimension) = 0;
+};
+
+enum class SamplerType : std::uint8_t {
+  // Independent uniform values: no sampler at all, so utils::randomDouble()
+  // keeps drawing from the generator the camera seeds for every pixel.
+  Independent,
+  // Jittered strata, randomly permuted per pixel and dimension.
+  Stratified,
+  // Owen-scrambled Sobol points (Burley 2020), shuffled per pixel and
+  // dimension.
+  Sobol,
+  // One Owen-scrambled Sobol sequence shared by all pixels and shifted per
+  // pixel by a blue-noise mask, so the remaining error looks like blue noise
+  // rather than white noise (Georgiev and Fajardo 2016).
+  BlueNoise,
+};
+
+namespace sampling {
+
+// Murmur3 finalizer.
+inline std::uint32_t hash(std::uint32_t value) {
+  value ^= value >> 16U;
+  value *= 0x85ebca6bU;
+  value ^= value >> 13U;
+  value *= 0xc2b2ae35U;
+  value ^= value >> 16U;
+  return value;
+}
+
+inline std::uint32_t hash(std::uint32_t first, std::uint32_t second) {
+  return hash(first ^ (hash(second) + 0x9e3779b9U + (first << 6U) +
+                       (first >> 2U)));
+}
+
+inline double toUnit(std::uint32_t value) {
+  constexpr double kScale = 1.0 / 4294967296.0;
+  return value * kScale;
+}
+
+inline std::uint32_t reverseBits(std::uint32_t value) {
+  value = ((value >> 1U) & 0x55555555U) | ((value & 0x55555555U) << 1U);
+  value = ((value >> 2U) & 0x33333333U) | ((value & 0x33333333U) << 2U);
+  value = ((value >> 4U) & 0x0f0f0f0fU) | ((value & 0x0f0f0f0fU) << 4U);
+  value = ((value >> 8U) & 0x00ff00ffU) | ((value & 0x00ff00ffU) << 8U);
+  return (value >> 16U) | (value << 16U);
+}
+
+// Owen scrambling: a random permutation of the values that keeps every
+// elementary interval together, so stratification survives. Hash-based
+// version by Burley, after Laine and Karras.
+inline std::uint32_t owenScramble(std::uint32_t value, std::uint32_t seed) {
+  value = reverseBits(value);
+  value += seed;
+  value ^= value * 0x6c50b47cU;
+  value ^= value * 0xb82f1e52U;
+  value ^= value * 0xc7afe638U;
+  value ^= value * 0x8d22f6e6U;
+  return reverseBits(value);
+}
+
+// The first two Sobol dimensions, which together form a (0,2)-sequence: every
+// power-of-two prefix is stratified in all elementary intervals.
+inline std::pair<std::uint32_t, std::uint32_t> sobol2D(std::uint32_t index) {
+  std::uint32_t first = 0;
+  std::uint32_t second = 0;
+  std::uint32_t direction = 1U << 31U;
+  for (std::uint32_t bit = 1U << 31U; index != 0; index >>= 1U, bit >>= 1U) {
+    if ((index & 1U) != 0) {
+      first ^= bit;
+      second ^= direction;
+    }
+    direction ^= direction >> 1U;
+  }
+  return {first, second};
+}
+
+// Bijective permutation of [0, size) selected by seed (Kensler 2013).
+inline std::uint32_t permute(std::uint32_t index, std::uint32_t size,
+                             std::uint32_t seed) {
+  std::uint32_t mask = size - 1;
+  mask |= mask >> 1U;
+  mask |= mask >> 2U;
+  mask |= mask >> 4U;
+  mask |= mask >> 8U;
+  mask |= mask >> 16U;
+  do {
+    index ^= seed;
+    index *= 0xe170893dU;
+    index ^= seed >> 16U;
+    index ^= (index & mask) >> 4U;
+    index ^= seed >> 8U;
+    index *= 0x0929eb3fU;
+    index ^= seed >> 23U;
+    index ^= (index & mask) >> 1U;
+    index *= 1U | seed >> 27U;
+    index *= 0x6935fa69U;
+    index ^= (index & mask) >> 11U;
+    index *= 0x74dcb303U;
+    index ^= (index & mask) >> 2U;
+    index *= 0x9e501cc3U;
+    index ^= (index & mask) >> 2U;
+    index *= 0xc860a3dfU;
+    index &= mask;
+    index ^= index >> 5U;
+  } while (index >= size);
+  return (index + seed) % size;
+}
+
+// Tileable blue-noise mask of kSize squared ranks, built once by Ulichney's
+// void-and-cluster method: pixels are ranked by repeatedly filling the
+// largest void, so every threshold of the mask is evenly spread.
+class BlueNoiseMask {
+public:
+  static constexpr int kSize = 64;
+
+  static const BlueNoiseMask& instance() {
+    static const BlueNoiseMask mask;
+    return mask;
+  }
+
+  // Value in [0, 1) at the pixel, wrapping around the edges.
+  [[nodiscard]] double value(std::uint32_t xIndex, std::uint32_t yIndex) const {
+    return mValues[(yIndex % kSize) * kSize + xIndex % kSize];
+  }
+
+private:
+  static constexpr size_t kCount = size_t{kSize} * kSize;
+  static constexpr double kSigma = 1.9;
+
+  std::array<double, kCount> mValues{};
+  std::array<double, kCount> mKernel{};
+  std::array<double, kCount> mEnergy{};
+  std::array<bool, kCount> mSet{};
+
+  BlueNoiseMask() {
+    for (int dy = 0; dy < kSize; ++dy) {
+      for (int dx = 0; dx < kSize; ++dx) {
+        const int x = std::min(dx, kSize - dx);
+        const int y = std::min(dy, kSize - dy);
+        mKernel[index(dx, dy)] =
+            std::exp(-(x * x + y * y) / (2 * kSigma * kSigma));
+      }
+    }
+
+    // Start from a random tenth of the pixels, relaxed until the tightest
+    // cluster is also the largest void.
+    utils::RandomGenerator random{kSize};
+    const size_t initialCount = kCount / 10;
+    for (size_t i = 0; i < initialCount;) {
+      const size_t pixel = random() % kCount;
+      if (!mSet[pixel]) {
+        toggle(pixel);
+        ++i;
+      }
+    }
+    while (true) {
+      const size_t cluster = extreme(true);
+      toggle(cluster);
+      const size_t emptiest = extreme(false);
+      toggle(emptiest);
+      if (emptiest == cluster) {
+        break;
+      }
+    }
+
+    // Rank the initial pixels by removing the tightest clusters, then the
+    // rest by filling the largest voids.
+    const auto initialSet = mSet;
+    const auto initialEnergy = mEnergy;
+    std::array<size_t, kCount> rank{};
+    for (size_t r = initialCount; r-- > 0;) {
+      const size_t cluster = extreme(true);
+      toggle(cluster);
+      rank[cluster] = r;
+    }
+    mSet = initialSet;
+    mEnergy = initialEnergy;
+    for (size_t r = initialCount; r < kCount; ++r) {
+      const size_t emptiest = extreme(false);
+      toggle(emptiest);
+      rank[emptiest] = r;
+    }
+
+    for (size_t pixel = 0; pixel < kCount; ++pixel) {
+      mValues[pixel] = (static_cast<double>(rank[pixel]) + 0.5) / kCount;
+    }
+  }
+
+  static size_t index(int xIndex, int yIndex) {
+    return static_cast<size_t>(yIndex) * kSize + static_cast<size_t>(xIndex);
+  }
+
+  void toggle(size_t pixel) {
+    mSet[pixel] = !mSet[pixel];
+    const double sign = mSet[pixel] ? 1.0 : -1.0;
+    const int px = static_cast<int>(pixel % kSize);
+    const int py = static_cast<int>(pixel / kSize);
+    for (int y = 0; y < kSize; ++y) {
+      for (int x = 0; x < kSize; ++x) {
+        mEnergy[index(x, y)] +=
+            sign * mKernel[index((x - px + kSize) % kSize,
+                                 (y - py + kSize) % kSize)];
+      }
+    }
+  }
+
+  // The set pixel with the most energy, or the unset one with the least.
+  [[nodiscard]] size_t extreme(bool tightestCluster) const {
+    size_t best = 0;
+    double bestEnergy = tightestCluster ? -utils::INFINITE_DOUBLE
+                                        : utils::INFINITE_DOUBLE;
+    for (size_t pixel = 0; pixel < kCount; ++pixel) {
+      if (mSet[pixel] != tightestCluster) {
+        continue;
+      }
+      if (tightestCluster ? mEnergy[pixel] > bestEnergy
+                          : mEnergy[pixel] < bestEnergy) {
+        best = pixel;
+        bestEnergy = mEnergy[pixel];
+      }
+    }
+    return best;
+  }
+};
+
+// Tracks the pixel, sample and dimension; subclasses map them to values.
+class DimensionSampler : public Sampler {
+public:
+  DimensionSampler(int samplesPerPixel, std::uint32_t seed)
+      : mSamplesPerPixel{
+            static_cast<std::uint32_t>(std::max(1, samplesPerPixel))},
+        mSeed{seed} {}
+
+  void startPixelSample(int xIndex, int yIndex, int sampleIndex) override {
+    mX = static_cast<std::uint32_t>(xIndex);
+    mY = static_cast<std::uint32_t>(yIndex);
+    mPixelSeed = hash(hash(mSeed, mX), mY);
+    mSampleIndex = static_cast<std::uint32_t>(sampleIndex);
+    mDimension = 0;
+  }
+
+  double get1D() override { return sample1D(mDimension++); }
+
+  std::pair<double, double> get2D() override { return sample(mDimension++); }
+
+  [[nodiscard]] std::uint32_t dimension() const override { return mDimension; }
+  void setDimension(std::uint32_t dimension) override {
+    mDimension = dimension;
+  }
+
+protected:
+  std::uint32_t mSamplesPerPixel;
+  std::uint32_t mSeed;
+  std::uint32_t mX{};
+  std::uint32_t mY{};
+  std::uint32_t mPixelSeed{};
+  std::uint32_t mSampleIndex{};
+  std::uint32_t mDimension{};
+
+  virtual std::pair<double, double> sample(std::uint32_t dimension) = 0;
+
+  virtual double sample1D(std::uint32_t dimension) {
+    return sample(dimension).first;
+  }
+};
+
+class StratifiedSampler : public DimensionSampler {
+public:
+  StratifiedSampler(int samplesPerPixel, std::uint32_t seed)
+      : DimensionSampler{samplesPerPixel, seed},
+        mSide{static_cast<std::uint32_t>(
+            std::ceil(std::sqrt(static_cast<double>(mSamplesPerPixel))))} {}
+
+protected:
+  std::pair<double, double> sample(std::uint32_t dimension) override {
+    // The samples take distinct cells of a side x side grid, in an order
+    // permuted per pixel and dimension, jittered within their cell.
+    const std::uint32_t seed = hash(mPixelSeed, dimension);
+    const std::uint32_t cell = permute(mSampleIndex, mSide * mSide, seed);
+    const std::uint32_t jitter = hash(seed, mSampleIndex);
+    return {(cell % mSide + toUnit(hash(jitter, 1))) / mSide,
+            (cell / mSide + toUnit(hash(jitter, 2))) / mSide};
+  }
+
+  double sample1D(std::uint32_t dimension) override {
+    // A single value gets one stratum per sample rather than per column.
+    const std::uint32_t seed = hash(mPixelSeed, dimension);
+    const std::uint32_t stratum = permute(mSampleIndex, mSamplesPerPixel, seed);
+    return (stratum + toUnit(hash(seed, mSampleIndex))) / mSamplesPerPixel;
+  }
+
+private:
+  std::uint32_t mSide;
+};
+
+class SobolSampler : public DimensionSampler {
+public:
+  using DimensionSampler::DimensionSampler;
+
+protected:
+  std::pair<double, double> sample(std::uint32_t dimension) override {
+    // Every dimension uses the same 2D Sobol points, decorrelated by
+    // shuffling their order (Owen scrambling the index) and scrambling the
+    // values, with seeds from the pixel and dimension.
+    const std::uint32_t seed = hash(mPixelSeed, dimension);
+    const auto [first, second] = sobol2D(owenScramble(mSampleIndex, seed));
+    return {toUnit(owenScramble(first, hash(seed, 1))),
+            toUnit(owenScramble(second, hash(seed, 2)))};
+  }
+};
+
+class BlueNoiseSampler : public DimensionSampler {
+public:
+  BlueNoiseSampler(int samplesPerPixel, std::uint32_t seed)
+      : DimensionSampler{samplesPerPixel, seed},
+        mMask{BlueNoiseMask::instance()} {}
+
+protected:
+  std::pair<double, double> sample(std::uint32_t dimension) override {
+    // The sequence depends only on the dimension; each pixel shifts it
+    // toroidally by the mask, read at an offset per dimension and axis.
+    const std::uint32_t seed = hash(mSeed, dimension);
+    const auto [first, second] = sobol2D(owenScramble(mSampleIndex, seed));
+    return {shift(toUnit(owenScramble(first, hash(seed, 1))), hash(seed, 3)),
+            shift(toUnit(owenScramble(second, hash(seed, 2))), hash(seed, 4))};
+  }
+
+private:
+  const BlueNoiseMask& mMask;
+
+  [[nodiscard]] double shift(double value, std::uint32_t offsetSeed) const {
+    const double shifted = value + mMask.value(mX + (offsetSeed & 0xffffU),
+                                               mY + (offsetSeed >> 16U));
+    return shifted < 1.0 ? shifted : shifted - 1.0;
+  }
+};
+
+} // namespace sampling
+
+// Returns nothing for SamplerType::Independent, which is what
+// utils::randomDouble() does without a sampler.
+inline std::unique_ptr<Sampler> makeSampler(SamplerType type,
+                                            int samplesPerPixel,
+                                            std::uint32_t seed) {
+  switch (type) {
+  case SamplerType::Stratified:
+    return std::make_unique<sampling::StratifiedSampler>(samplesPerPixel, seed);
+  case SamplerType::Sobol:
+    return std::make_unique<sampling::SobolSampler>(samplesPerPixel, seed);
+  case SamplerType::BlueNoise:
+    return std::make_unique<sampling::BlueNoiseSampler>(samplesPerPixel, seed);
+  case SamplerType::Independent:
+    break;
+  }
+  return nullptr;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "animation.hpp"
+#include "arena.hpp"
 #include "bvh.hpp"
 #include "camera.hpp"
 #include "color.hpp"
@@ -12,24 +14,26 @@
 #include "texture.hpp"
 #include "utils.hpp"
 #include "vec3.hpp"
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 // NOLINTBEGIN(*magic-numbers)
 namespace scene {
-using std::make_shared;
 using std::shared_ptr;
 void defaultScene(HittableList& world, Camera& cam) {
-  auto materialGround = make_shared<Lambertian>(Color(0.8, 0.8, 0.0));
-  auto materialCenter = make_shared<Lambertian>(Color(0.1, 0.2, 0.5));
-  auto materialLeft = make_shared<Dielectric>(1.51);
-  auto materialBubble = make_shared<Dielectric>(1.00 / 1.51);
-  auto materialRight = make_shared<Metal>(Color(0.8, 0.6, 0.2), 1.0);
+  auto materialGround = makeShared<Lambertian>(Color(0.8, 0.8, 0.0));
+  auto materialCenter = makeShared<Lambertian>(Color(0.1, 0.2, 0.5));
+  auto materialLeft = makeShared<Dielectric>(1.51);
+  auto materialBubble = makeShared<Dielectric>(1.00 / 1.51);
+  auto materialRight = makeShared<Metal>(Color(0.8, 0.6, 0.2), 1.0);
 
   world.add(
-      make_shared<Sphere>(Vec3(0.0, -100.5, -1.0), 100.0, materialGround));
-  world.add(make_shared<Sphere>(Vec3(0.0, 0.0, -1.2), 0.5, materialCenter));
-  world.add(make_shared<Sphere>(Vec3(-1.0, 0.0, -1.0), 0.5, materialLeft));
-  world.add(make_shared<Sphere>(Vec3(-1.0, 0.0, -1.0), 0.4, materialBubble));
-  world.add(make_shared<Sphere>(Vec3(1.0, 0.0, -1.0), 0.5, materialRight));
+      makeShared<Sphere>(Vec3(0.0, -100.5, -1.0), 100.0, materialGround));
+  world.add(makeShared<Sphere>(Vec3(0.0, 0.0, -1.2), 0.5, materialCenter));
+  world.add(makeShared<Sphere>(Vec3(-1.0, 0.0, -1.0), 0.5, materialLeft));
+  world.add(makeShared<Sphere>(Vec3(-1.0, 0.0, -1.0), 0.4, materialBubble));
+  world.add(makeShared<Sphere>(Vec3(1.0, 0.0, -1.0), 0.5, materialRight));
 
   constexpr double aspectRatio = 16.0 / 9.0;
   constexpr double cameraFov = 20;
@@ -55,18 +59,18 @@ void defaultScene(HittableList& world, Camera& cam) {
 void twoOppositeSphere(HittableList& world) {
   auto R = std::cos(utils::PI / 4);
 
-  auto material_left = make_shared<Lambertian>(Color(0, 0, 1));
-  auto material_right = make_shared<Lambertian>(Color(1, 0, 0));
+  auto material_left = makeShared<Lambertian>(Color(0, 0, 1));
+  auto material_right = makeShared<Lambertian>(Color(1, 0, 0));
 
-  world.add(make_shared<Sphere>(Vec3(-R, 0, -1), R, material_left));
-  world.add(make_shared<Sphere>(Vec3(R, 0, -1), R, material_right));
+  world.add(makeShared<Sphere>(Vec3(-R, 0, -1), R, material_left));
+  world.add(makeShared<Sphere>(Vec3(R, 0, -1), R, material_right));
 }
 
 void oneWeekendFinalScene(HittableList& world, Camera& cam) {
-  auto checkerTexture = make_shared<CheckerTexture>(0.32, Color{.65, 0.3, .3},
+  auto checkerTexture = makeShared<CheckerTexture>(0.32, Color{.65, 0.3, .3},
                                                     Color{.3, .3, .65});
-  auto ground_material = make_shared<Lambertian>(checkerTexture);
-  world.add(make_shared<Sphere>(Vec3(0, -1000, 0), 1000, ground_material));
+  auto ground_material = makeShared<Lambertian>(checkerTexture);
+  world.add(makeShared<Sphere>(Vec3(0, -1000, 0), 1000, ground_material));
 
   for (int a = -11; a < 11; a++) {
     for (int b = -11; b < 11; b++) {
@@ -80,35 +84,35 @@ void oneWeekendFinalScene(HittableList& world, Camera& cam) {
         if (choose_mat < 0.8) {
           // diffuse
           auto albedo = Color::random() * Color::random();
-          sphere_material = make_shared<Lambertian>(albedo);
+          sphere_material = makeShared<Lambertian>(albedo);
           auto endCenter = center + Vec3{0, utils::randomDouble(0, 0.5), 0};
-          world.add(
-              make_shared<Sphere>(center, endCenter, 0.2, sphere_material));
+          world.add(makeShared<MovingSphere>(center, endCenter, 0.2,
+                                             sphere_material));
         } else if (choose_mat < 0.95) {
           // metal
           auto albedo = Color::random(0.5, 1);
           auto fuzz = utils::randomDouble(0, 0.5);
-          sphere_material = make_shared<Metal>(albedo, fuzz);
-          world.add(make_shared<Sphere>(center, 0.2, sphere_material));
+          sphere_material = makeShared<Metal>(albedo, fuzz);
+          world.add(makeShared<Sphere>(center, 0.2, sphere_material));
         } else {
           // glass
-          sphere_material = make_shared<Dielectric>(1.5);
-          world.add(make_shared<Sphere>(center, 0.2, sphere_material));
+          sphere_material = makeShared<Dielectric>(1.5);
+          world.add(makeShared<Sphere>(center, 0.2, sphere_material));
         }
       }
     }
   }
 
-  auto material1 = make_shared<Dielectric>(1.5);
-  world.add(make_shared<Sphere>(Vec3(0, 1, 0), 1.0, material1));
+  auto material1 = makeShared<Dielectric>(1.5);
+  world.add(makeShared<Sphere>(Vec3(0, 1, 0), 1.0, material1));
 
-  auto material2 = make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-  world.add(make_shared<Sphere>(Vec3(-4, 1, 0), 1.0, material2));
+  auto material2 = makeShared<Lambertian>(Color(0.4, 0.2, 0.1));
+  world.add(makeShared<Sphere>(Vec3(-4, 1, 0), 1.0, material2));
 
-  auto material3 = make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-  world.add(make_shared<Sphere>(Vec3(4, 1, 0), 1.0, material3));
+  auto material3 = makeShared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+  world.add(makeShared<Sphere>(Vec3(4, 1, 0), 1.0, material3));
 
-  world = HittableList(make_shared<BVHNode>(world));
+  world = HittableList(makeShared<BVHNode>(world));
 
   cam.mAspectRatio = 16.0 / 9.0;
   cam.mImageWidth = 600;
@@ -127,12 +131,12 @@ void oneWeekendFinalScene(HittableList& world, Camera& cam) {
 
 void checkeredSpheres(HittableList& world, Camera& cam) {
   auto checker =
-      make_shared<CheckerTexture>(0.32, Color{.2, .3, .1}, Color{.9, .9, .9});
+      makeShared<CheckerTexture>(0.32, Color{.2, .3, .1}, Color{.9, .9, .9});
 
-  world.add(make_shared<Sphere>(Vec3{0, -10, 0}, 10,
-                                make_shared<Lambertian>(checker)));
-  world.add(make_shared<Sphere>(Vec3{0, 10, 0}, 10,
-                                make_shared<Lambertian>(checker)));
+  world.add(makeShared<Sphere>(Vec3{0, -10, 0}, 10,
+                                makeShared<Lambertian>(checker)));
+  world.add(makeShared<Sphere>(Vec3{0, 10, 0}, 10,
+                                makeShared<Lambertian>(checker)));
 
   cam.mAspectRatio = 16.0 / 9.0;
   cam.mImageWidth = 400;
@@ -149,39 +153,39 @@ void checkeredSpheres(HittableList& world, Camera& cam) {
 }
 
 void coolSpheres(HittableList& world, Camera& cam) {
-  auto materialGround = make_shared<Lambertian>(Color(0.8, 0.8, 0.0));
-  auto materialCenter = make_shared<Lambertian>(Color(0.1, 0.2, 0.5));
-  auto materialLeft = make_shared<Dielectric>(1.51);
-  auto materialBubble = make_shared<Dielectric>(1.00 / 1.51);
-  auto materialRight = make_shared<Metal>(Color(0.75, 0.2, 0.2), 0.05);
+  auto materialGround = makeShared<Lambertian>(Color(0.8, 0.8, 0.0));
+  auto materialCenter = makeShared<Lambertian>(Color(0.1, 0.2, 0.5));
+  auto materialLeft = makeShared<Dielectric>(1.51);
+  auto materialBubble = makeShared<Dielectric>(1.00 / 1.51);
+  auto materialRight = makeShared<Metal>(Color(0.75, 0.2, 0.2), 0.05);
   auto checker =
-      make_shared<CheckerTexture>(0.32, Color{.2, .3, .1}, Color{.9, .9, .9});
+      makeShared<CheckerTexture>(0.32, Color{.2, .3, .1}, Color{.9, .9, .9});
 
   auto albedo = Color::random(0.5, 1);
-  auto materialRandA = make_shared<Lambertian>(albedo);
+  auto materialRandA = makeShared<Lambertian>(albedo);
   albedo = Color::random(0.5, 1);
-  auto materialRandB = make_shared<Lambertian>(albedo);
+  auto materialRandB = makeShared<Lambertian>(albedo);
   albedo = Color::random(0.5, 1);
-  auto materialRandC = make_shared<Lambertian>(albedo);
+  auto materialRandC = makeShared<Lambertian>(albedo);
   albedo = Color::random(0.5, 1);
-  auto materialRandD = make_shared<Lambertian>(albedo);
+  auto materialRandD = makeShared<Lambertian>(albedo);
 
-  world.add(make_shared<Sphere>(Vec3{0, -10, 0}, 10, materialRight));
-  world.add(make_shared<Sphere>(Vec3{0, 10, 0}, 10, materialLeft));
+  world.add(makeShared<Sphere>(Vec3{0, -10, 0}, 10, materialRight));
+  world.add(makeShared<Sphere>(Vec3{0, 10, 0}, 10, materialLeft));
 
-  world.add(make_shared<Sphere>(Vec3{0, 0, 10}, 2.5, materialRandA));
-  world.add(make_shared<Sphere>(Vec3{0, 0, -10}, 3.5, materialGround));
-  world.add(make_shared<Sphere>(Vec3{-10, 0, 10}, 4, materialRandD));
-  world.add(make_shared<Sphere>(Vec3{-10, 0, -10}, 3, materialRandB));
-  world.add(make_shared<Sphere>(Vec3{-20, 0, 10}, 6, materialCenter));
-  world.add(make_shared<Sphere>(Vec3{-20, 0, -10}, 7, materialRandC));
-  // world.add(make_shared<Sphere>(Vec3{0, 10, 0}, 10, materialLeft));
-  // world.add(make_shared<Sphere>(Vec3{0, 10, 0}, 10, materialLeft));
+  world.add(makeShared<Sphere>(Vec3{0, 0, 10}, 2.5, materialRandA));
+  world.add(makeShared<Sphere>(Vec3{0, 0, -10}, 3.5, materialGround));
+  world.add(makeShared<Sphere>(Vec3{-10, 0, 10}, 4, materialRandD));
+  world.add(makeShared<Sphere>(Vec3{-10, 0, -10}, 3, materialRandB));
+  world.add(makeShared<Sphere>(Vec3{-20, 0, 10}, 6, materialCenter));
+  world.add(makeShared<Sphere>(Vec3{-20, 0, -10}, 7, materialRandC));
+  // world.add(makeShared<Sphere>(Vec3{0, 10, 0}, 10, materialLeft));
+  // world.add(makeShared<Sphere>(Vec3{0, 10, 0}, 10, materialLeft));
 
-  // world.add(make_shared<Sphere>(Vec3{0, 0, 0}, 50,
-  // make_shared<Dielectric>(checker)));
+  // world.add(makeShared<Sphere>(Vec3{0, 0, 0}, 50,
+  // makeShared<Dielectric>(checker)));
 
-  world = HittableList(make_shared<BVHNode>(world));
+  world = HittableList(makeShared<BVHNode>(world));
 
   cam.mAspectRatio = 8.0 / 2.0;
   cam.mImageWidth = 1200;
@@ -198,12 +202,12 @@ void coolSpheres(HittableList& world, Camera& cam) {
 }
 
 void UVTest(HittableList& world, Camera& cam) {
-  auto uvTexture = make_shared<UVTexture>();
+  auto uvTexture = makeShared<UVTexture>();
 
-  world.add(make_shared<Sphere>(Vec3{0, -5, 0}, 5,
-                                make_shared<Lambertian>(uvTexture)));
-  world.add(make_shared<Sphere>(Vec3{0, 5, 0}, 5,
-                                make_shared<Lambertian>(uvTexture)));
+  world.add(makeShared<Sphere>(Vec3{0, -5, 0}, 5,
+                                makeShared<Lambertian>(uvTexture)));
+  world.add(makeShared<Sphere>(Vec3{0, 5, 0}, 5,
+                                makeShared<Lambertian>(uvTexture)));
 
   cam.mAspectRatio = 16.0 / 9.0;
   cam.mImageWidth = 400;
@@ -219,9 +223,9 @@ void UVTest(HittableList& world, Camera& cam) {
   cam.mBackgroundColor = Color(0.5, 0.7, 1.0);
 }
 void earth(HittableList& world, Camera& cam) {
-  auto earthTexture = make_shared<ImageTexture>("earthmap.jpg");
-  auto earthSurface = make_shared<Lambertian>(earthTexture);
-  auto globe = make_shared<Sphere>(Vec3(0, 0, 0), 2, earthSurface);
+  auto earthTexture = makeShared<ImageTexture>("earthmap.jpg");
+  auto earthSurface = makeShared<Lambertian>(earthTexture);
+  auto globe = makeShared<Sphere>(Vec3(0, 0, 0), 2, earthSurface);
 
   world.add(globe);
 
@@ -238,11 +242,11 @@ void earth(HittableList& world, Camera& cam) {
 }
 
 void perlin_spheres(HittableList& world, Camera& cam) {
-  auto pertext = make_shared<NoiseTexture>(4);
-  world.add(make_shared<Sphere>(Vec3(0, -1000, 0), 1000,
-                                make_shared<Lambertian>(pertext)));
+  auto pertext = makeShared<NoiseTexture>(4);
+  world.add(makeShared<Sphere>(Vec3(0, -1000, 0), 1000,
+                                makeShared<Lambertian>(pertext)));
   world.add(
-      make_shared<Sphere>(Vec3(0, 2, 0), 2, make_shared<Lambertian>(pertext)));
+      makeShared<Sphere>(Vec3(0, 2, 0), 2, makeShared<Lambertian>(pertext)));
 
   cam.mAspectRatio = 16.0 / 9.0;
   cam.mImageWidth = 400;
@@ -258,33 +262,33 @@ void perlin_spheres(HittableList& world, Camera& cam) {
 
 void quadScene(HittableList& world, Camera& cam) {
   // Materials
-  auto left_red = make_shared<Lambertian>(Color(1.0, 0.2, 0.2));
-  auto back_green = make_shared<Lambertian>(Color(0.2, 1.0, 0.2));
-  auto right_blue = make_shared<Lambertian>(Color(0.2, 0.2, 1.0));
-  auto upper_orange = make_shared<Lambertian>(Color(1.0, 0.5, 0.0));
-  auto lower_teal = make_shared<Lambertian>(Color(0.2, 0.8, 0.8));
+  auto left_red = makeShared<Lambertian>(Color(1.0, 0.2, 0.2));
+  auto back_green = makeShared<Lambertian>(Color(0.2, 1.0, 0.2));
+  auto right_blue = makeShared<Lambertian>(Color(0.2, 0.2, 1.0));
+  auto upper_orange = makeShared<Lambertian>(Color(1.0, 0.5, 0.0));
+  auto lower_teal = makeShared<Lambertian>(Color(0.2, 0.8, 0.8));
 
-  auto pertext = make_shared<NoiseTexture>(4);
-  auto materialGlass = make_shared<Dielectric>(1.51);
+  auto pertext = makeShared<NoiseTexture>(4);
+  auto materialGlass = makeShared<Dielectric>(1.51);
 
-  auto earthTexture = make_shared<ImageTexture>("earthmap.jpg");
-  auto earthSurface = make_shared<Lambertian>(earthTexture);
+  auto earthTexture = makeShared<ImageTexture>("earthmap.jpg");
+  auto earthSurface = makeShared<Lambertian>(earthTexture);
 
-  auto materialMetal = make_shared<Metal>(Color(0.75, 0.2, 0.2), 0.05);
+  auto materialMetal = makeShared<Metal>(Color(0.75, 0.2, 0.2), 0.05);
 
   // Quads
-  world.add(make_shared<Quad>(Vec3(-3, -2, 5), Vec3(0, 0, -4), Vec3(0, 4, 0),
-                              make_shared<Lambertian>(pertext)));
-  world.add(make_shared<Quad>(Vec3(-2, -2, 0), Vec3(4, 0, 0), Vec3(0, 4, 0),
+  world.add(makeShared<Quad>(Vec3(-3, -2, 5), Vec3(0, 0, -4), Vec3(0, 4, 0),
+                              makeShared<Lambertian>(pertext)));
+  world.add(makeShared<Quad>(Vec3(-2, -2, 0), Vec3(4, 0, 0), Vec3(0, 4, 0),
                               back_green));
-  world.add(make_shared<Quad>(Vec3(3, -2, 1), Vec3(0, 0, 4), Vec3(0, 4, 0),
+  world.add(makeShared<Quad>(Vec3(3, -2, 1), Vec3(0, 0, 4), Vec3(0, 4, 0),
                               earthSurface));
-  world.add(make_shared<Quad>(Vec3(-2, 3, 1), Vec3(4, 0, 0), Vec3(0, 0, 4),
+  world.add(makeShared<Quad>(Vec3(-2, 3, 1), Vec3(4, 0, 0), Vec3(0, 0, 4),
                               upper_orange));
-  world.add(make_shared<Quad>(Vec3(-2, -3, 5), Vec3(4, 0, 0), Vec3(0, 0, -4),
+  world.add(makeShared<Quad>(Vec3(-2, -3, 5), Vec3(4, 0, 0), Vec3(0, 0, -4),
                               materialMetal));
 
-  world.add(make_shared<Sphere>(Vec3(0, 0, 3), 1.0, materialGlass));
+  world.add(makeShared<Sphere>(Vec3(0, 0, 3), 1.0, materialGlass));
 
   cam.mAspectRatio = 1.0;
   cam.mImageWidth = 500;
@@ -301,16 +305,16 @@ void quadScene(HittableList& world, Camera& cam) {
 }
 
 void simpleLight(HittableList& world, Camera& cam) {
-  auto pertext = make_shared<NoiseTexture>(4);
-  world.add(make_shared<Sphere>(Vec3(0, -1000, 0), 1000,
-                                make_shared<Lambertian>(pertext)));
+  auto pertext = makeShared<NoiseTexture>(4);
+  world.add(makeShared<Sphere>(Vec3(0, -1000, 0), 1000,
+                                makeShared<Lambertian>(pertext)));
   world.add(
-      make_shared<Sphere>(Vec3(0, 2, 0), 2, make_shared<Lambertian>(pertext)));
+      makeShared<Sphere>(Vec3(0, 2, 0), 2, makeShared<Lambertian>(pertext)));
 
-  auto difflight = make_shared<DiffuseLight>(Color(0.1, 0.2, 2));
-  auto redlight = make_shared<DiffuseLight>(Color(1, 0.2, 0.2));
-  world.add(make_shared<Sphere>(Vec3(0, 7, 0), 2, redlight));
-  world.add(make_shared<Quad>(Vec3(3, 1, -2), Vec3(2, 0, 0), Vec3(0, 2, 0),
+  auto difflight = makeShared<DiffuseLight>(Color(0.1, 0.2, 2));
+  auto redlight = makeShared<DiffuseLight>(Color(1, 0.2, 0.2));
+  world.add(makeShared<Sphere>(Vec3(0, 7, 0), 2, redlight));
+  world.add(makeShared<Quad>(Vec3(3, 1, -2), Vec3(2, 0, 0), Vec3(0, 2, 0),
                               difflight));
 
   cam.mAspectRatio = 16.0 / 9.0;
@@ -327,38 +331,31 @@ void simpleLight(HittableList& world, Camera& cam) {
   cam.mDefocusAngle = 0;
 }
 
-void cornellBox(HittableList& world, Camera& cam) {
-  auto red = make_shared<Lambertian>(Color(.65, .05, .05));
-  auto white = make_shared<Lambertian>(Color(.73, .73, .73));
-  auto green = make_shared<Lambertian>(Color(.12, .45, .15));
-  auto light = make_shared<DiffuseLight>(Color(15, 15, 15));
+void cornellBox(HittableList& world, HittableList& lights, Camera& cam) {
+  auto red = makeShared<Lambertian>(Color(.65, .05, .05));
+  auto white = makeShared<Lambertian>(Color(.73, .73, .73));
+  auto green = makeShared<Lambertian>(Color(.12, .45, .15));
+  auto light = makeShared<DiffuseLight>(Color(15, 15, 15));
 
-  world.add(make_shared<Quad>(Vec3(555, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555),
+  world.add(makeShared<Quad>(Vec3(555, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555),
                               green));
   world.add(
-      make_shared<Quad>(Vec3(0, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), red));
-  world.add(make_shared<Quad>(Vec3(343, 554, 332), Vec3(-130, 0, 0),
+      makeShared<Quad>(Vec3(0, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), red));
+  world.add(makeShared<Quad>(Vec3(343, 554, 332), Vec3(-130, 0, 0),
                               Vec3(0, 0, -105), light));
-  world.add(make_shared<Quad>(Vec3(0, 0, 0), Vec3(555, 0, 0), Vec3(0, 0, 555),
+  world.add(makeShared<Quad>(Vec3(0, 0, 0), Vec3(555, 0, 0), Vec3(0, 0, 555),
                               white));
-  world.add(make_shared<Quad>(Vec3(555, 555, 555), Vec3(-555, 0, 0),
+  world.add(makeShared<Quad>(Vec3(555, 555, 555), Vec3(-555, 0, 0),
                               Vec3(0, 0, -555), white));
-  world.add(make_shared<Quad>(Vec3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0),
+  world.add(makeShared<Quad>(Vec3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0),
                               white));
 
-  shared_ptr<Hittable> firstBox =
-      box(Vec3(0, 0, 0), Vec3(165, 330, 165), white);
-  firstBox = make_shared<RotateY>(firstBox, 15);
-  firstBox = make_shared<Translate>(firstBox, Vec3{265, 0, 295});
-  world.add(firstBox);
-
-  shared_ptr<Hittable> secondBox =
-      box(Vec3(0, 0, 0), Vec3{165, 165, 165}, white);
-  secondBox = make_shared<RotateY>(secondBox, -18);
-  secondBox = make_shared<Translate>(secondBox, Vec3{130, 0, 65});
-  world.add(secondBox);
+  world.add(box(Vec3(0, 0, 0), Vec3(165, 330, 165), white, 15,
+                Vec3{265, 0, 295}));
+  world.add(box(Vec3(0, 0, 0), Vec3{165, 165, 165}, white, -18,
+                Vec3{130, 0, 65}));
 
-  world = HittableList(make_shared<BVHNode>(world));
+  world = HittableList(makeShared<BVHNode>(world));
 
   cam.mAspectRatio = 1.0;
   cam.mImageWidth = 600;
@@ -372,39 +369,46 @@ void cornellBox(HittableList& world, Camera& cam) {
   cam.mUp = Vec3(0, 1, 0);
 
   cam.mDefocusAngle = 0;
+
+  // Light sampling only needs the geometry, never the material.
+  auto emptyMaterial = shared_ptr<IMaterial>();
+  lights.add(makeShared<Quad>(Vec3(343, 554, 332), Vec3(-130, 0, 0),
+                               Vec3(0, 0, -105), emptyMaterial));
+}
+
+void cornellBox(HittableList& world, Camera& cam) {
+  HittableList lights;
+  cornellBox(world, lights, cam);
 }
 
 void cornellSmoke(HittableList& world, Camera& cam) {
-  auto red = make_shared<Lambertian>(Color(.65, .05, .05));
-  auto white = make_shared<Lambertian>(Color(.73, .73, .73));
-  auto green = make_shared<Lambertian>(Color(.12, .45, .15));
-  auto whiteLight = make_shared<DiffuseLight>(Color(7, 7, 7));
+  auto red = makeShared<Lambertian>(Color(.65, .05, .05));
+  auto white = makeShared<Lambertian>(Color(.73, .73, .73));
+  auto green = makeShared<Lambertian>(Color(.12, .45, .15));
+  auto whiteLight = makeShared<DiffuseLight>(Color(7, 7, 7));
 
-  world.add(make_shared<Quad>(Vec3(555, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555),
+  world.add(makeShared<Quad>(Vec3(555, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555),
                               green));
   world.add(
-      make_shared<Quad>(Vec3(0, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), red));
-  world.add(make_shared<Quad>(Vec3(113, 554, 127), Vec3(330, 0, 0),
+      makeShared<Quad>(Vec3(0, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), red));
+  world.add(makeShared<Quad>(Vec3(113, 554, 127), Vec3(330, 0, 0),
                               Vec3(0, 0, 305), whiteLight));
-  world.add(make_shared<Quad>(Vec3(0, 555, 0), Vec3(555, 0, 0), Vec3(0, 0, 555),
+  world.add(makeShared<Quad>(Vec3(0, 555, 0), Vec3(555, 0, 0), Vec3(0, 0, 555),
                               white));
-  world.add(make_shared<Quad>(Vec3(0, 0, 0), Vec3(555, 0, 0), Vec3(0, 0, 555),
+  world.add(makeShared<Quad>(Vec3(0, 0, 0), Vec3(555, 0, 0), Vec3(0, 0, 555),
                               white));
-  world.add(make_shared<Quad>(Vec3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0),
+  world.add(makeShared<Quad>(Vec3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0),
                               white));
 
-  shared_ptr<Hittable> box1 = box(Vec3(0, 0, 0), Vec3(165, 330, 165), white);
-  box1 = make_shared<RotateY>(box1, 15);
-  box1 = make_shared<Translate>(box1, Vec3(265, 0, 295));
+  auto box1 =
+      box(Vec3(0, 0, 0), Vec3(165, 330, 165), white, 15, Vec3(265, 0, 295));
+  auto box2 =
+      box(Vec3(0, 0, 0), Vec3(165, 165, 165), white, -18, Vec3(130, 0, 65));
 
-  shared_ptr<Hittable> box2 = box(Vec3(0, 0, 0), Vec3(165, 165, 165), white);
-  box2 = make_shared<RotateY>(box2, -18);
-  box2 = make_shared<Translate>(box2, Vec3(130, 0, 65));
+  world.add(makeShared<ConstantMedium>(0.01, color::Black, box1));
+  world.add(makeShared<ConstantMedium>(0.01, color::White, box2));
 
-  world.add(make_shared<ConstantMedium>(0.01, color::Black, box1));
-  world.add(make_shared<ConstantMedium>(0.01, color::White, box2));
-
-  // world.add(make_shared<BVHNode>(world));
+  // world.add(makeShared<BVHNode>(world));
 
   cam.mAspectRatio = 1.0;
   cam.mImageWidth = 500;
@@ -422,7 +426,7 @@ void cornellSmoke(HittableList& world, Camera& cam) {
 void secondBookFinalScene(HittableList& world, Camera& cam, int image_width,
                           int samples_per_pixel, int max_depth) {
   HittableList boxes1;
-  auto ground = make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
+  auto ground = makeShared<Lambertian>(Color(0.48, 0.83, 0.53));
 
   int boxes_per_side = 20;
   for (int i = 0; i < boxes_per_side; i++) {
@@ -439,46 +443,46 @@ void secondBookFinalScene(HittableList& world, Camera& cam, int image_width,
     }
   }
 
-  world.add(make_shared<BVHNode>(boxes1));
+  world.add(makeShared<BVHNode>(boxes1));
 
-  auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
-  world.add(make_shared<Quad>(Vec3(123, 554, 147), Vec3(300, 0, 0),
+  auto light = makeShared<DiffuseLight>(Color(7, 7, 7));
+  world.add(makeShared<Quad>(Vec3(123, 554, 147), Vec3(300, 0, 0),
                               Vec3(0, 0, 265), light));
 
   auto center1 = Vec3(400, 400, 200);
   auto center2 = center1 + Vec3(30, 0, 0);
-  auto sphere_material = make_shared<Lambertian>(Color(0.7, 0.3, 0.1));
-  world.add(make_shared<Sphere>(center1, center2, 50, sphere_material));
+  auto sphere_material = makeShared<Lambertian>(Color(0.7, 0.3, 0.1));
+  world.add(makeShared<MovingSphere>(center1, center2, 50, sphere_material));
 
-  world.add(make_shared<Sphere>(Vec3(260, 150, 45), 50,
-                                make_shared<Dielectric>(1.5)));
-  world.add(make_shared<Sphere>(Vec3(0, 150, 145), 50,
-                                make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)));
+  world.add(makeShared<Sphere>(Vec3(260, 150, 45), 50,
+                                makeShared<Dielectric>(1.5)));
+  world.add(makeShared<Sphere>(Vec3(0, 150, 145), 50,
+                                makeShared<Metal>(Color(0.8, 0.8, 0.9), 1.0)));
 
-  auto boundary = make_shared<Sphere>(Vec3(360, 150, 145), 70,
-                                      make_shared<Dielectric>(1.5));
+  auto boundary = makeShared<Sphere>(Vec3(360, 150, 145), 70,
+                                      makeShared<Dielectric>(1.5));
   world.add(boundary);
-  world.add(make_shared<ConstantMedium>(0.2, Color(0.2, 0.4, 0.9), boundary));
+  world.add(makeShared<ConstantMedium>(0.2, Color(0.2, 0.4, 0.9), boundary));
   boundary =
-      make_shared<Sphere>(Vec3(0, 0, 0), 5000, make_shared<Dielectric>(1.5));
-  world.add(make_shared<ConstantMedium>(.0001, Color(1, 1, 1), boundary));
+      makeShared<Sphere>(Vec3(0, 0, 0), 5000, makeShared<Dielectric>(1.5));
+  world.add(makeShared<ConstantMedium>(.0001, Color(1, 1, 1), boundary));
 
   auto emat =
-      make_shared<Lambertian>(make_shared<ImageTexture>("earthmap.jpg"));
-  world.add(make_shared<Sphere>(Vec3(400, 200, 400), 100, emat));
-  auto pertext = make_shared<NoiseTexture>(0.2);
-  world.add(make_shared<Sphere>(Vec3(220, 280, 300), 80,
-                                make_shared<Lambertian>(pertext)));
+      makeShared<Lambertian>(makeShared<ImageTexture>("earthmap.jpg"));
+  world.add(makeShared<Sphere>(Vec3(400, 200, 400), 100, emat));
+  auto pertext = makeShared<NoiseTexture>(0.2);
+  world.add(makeShared<Sphere>(Vec3(220, 280, 300), 80,
+                                makeShared<Lambertian>(pertext)));
 
   HittableList boxes2;
-  auto white = make_shared<Lambertian>(Color(.73, .73, .73));
+  auto white = makeShared<Lambertian>(Color(.73, .73, .73));
   int ns = 1000;
   for (int j = 0; j < ns; j++) {
-    boxes2.add(make_shared<Sphere>(Vec3::random(0, 165), 10, white));
+    boxes2.add(makeShared<Sphere>(Vec3::random(0, 165), 10, white));
   }
 
-  world.add(make_shared<Translate>(
-      make_shared<RotateY>(make_shared<BVHNode>(boxes2), 15),
+  world.add(makeShared<Translate>(
+      makeShared<RotateY>(makeShared<BVHNode>(boxes2), 15),
       Vec3(-100, 270, 395)));
 
   cam.mAspectRatio = 1.0;
@@ -494,5 +498,88 @@ void secondBookFinalScene(HittableList& world, Camera& cam, int image_width,
 
   cam.mDefocusAngle = 0;
 }
+
+// Boxes tumbling over a field of static spheres for two seconds; render it
+// with Camera::renderSequence.
+void tumblingBoxes(Animation& world, Camera& cam) {
+  auto ground = makeShared<Lambertian>(makeShared<CheckerTexture>(
+      0.5, Color{.2, .3, .1}, Color{.9, .9, .9}));
+  world.add(makeShared<Sphere>(Vec3(0, -1000, 0), 1000, ground));
+
+  for (int a = -8; a < 8; a++) {
+    for (int b = -8; b < 8; b++) {
+      const Vec3 center(a + 0.9 * utils::randomDouble(), 0.2,
+                        b + 0.9 * utils::randomDouble());
+      world.add(makeShared<Sphere>(
+          center, 0.2,
+          makeShared<Lambertian>(Color::random() * Color::random())));
+    }
+  }
+
+  for (int i = 0; i < 24; i++) {
+    auto material = makeShared<Metal>(Color::random(0.5, 1), 0.2);
+    const double size = utils::randomDouble(0.3, 0.7);
+    const Vec3 start{utils::randomDouble(-8, 8), utils::randomDouble(0.5, 3),
+                     -9};
+    const Vec3 end{utils::randomDouble(-8, 8), utils::randomDouble(0.5, 3), 9};
+    world.addAnimated(makeShared<Keyframed>(
+        box(Vec3(-size, -size, -size), Vec3(size, size, size), material),
+        std::vector<Keyframe>{{0, start, 0},
+                              {1, 0.5 * (start + end) + Vec3{0, 2, 0}, 180},
+                              {2, end, 360}}));
+  }
+
+  cam.mAspectRatio = 16.0 / 9.0;
+  cam.mImageWidth = 400;
+  cam.mSamplesPerPixel = 32;
+  cam.mMaxDepth = 20;
+
+  cam.mVerticalFov = 30;
+  cam.mLookFrom = Vec3(16, 6, 4);
+  cam.mLookAt = Vec3(0, 1, 0);
+  cam.mUp = Vec3(0, 1, 0);
+
+  cam.mDefocusAngle = 0;
+  cam.mBackgroundColor = Color(0.5, 0.7, 1.0);
+}
+
+// A still scene by name. Scenes without light sampling leave lights empty.
+struct Entry {
+  std::string name;
+  std::function<void(HittableList& world, HittableList& lights, Camera& cam)>
+      build;
+};
+
+std::vector<Entry> all() {
+  auto withoutLights = [](void (*build)(HittableList&, Camera&)) {
+    return [build](HittableList& world, HittableList&, Camera& cam) {
+      build(world, cam);
+    };
+  };
+  return {
+      {"defaultScene", withoutLights(defaultScene)},
+      {"twoOppositeSphere",
+       [](HittableList& world, HittableList&, Camera&) {
+         twoOppositeSphere(world);
+       }},
+      {"oneWeekendFinalScene", withoutLights(oneWeekendFinalScene)},
+      {"checkeredSpheres", withoutLights(checkeredSpheres)},
+      {"coolSpheres", withoutLights(coolSpheres)},
+      {"UVTest", withoutLights(UVTest)},
+      {"earth", withoutLights(earth)},
+      {"perlin_spheres", withoutLights(perlin_spheres)},
+      {"quadScene", withoutLights(quadScene)},
+      {"simpleLight", withoutLights(simpleLight)},
+      {"cornellBox",
+       [](HittableList& world, HittableList& lights, Camera& cam) {
+         cornellBox(world, lights, cam);
+       }},
+      {"cornellSmoke", withoutLights(cornellSmoke)},
+      {"secondBookFinalScene",
+       [](HittableList& world, HittableList&, Camera& cam) {
+         secondBookFinalScene(world, cam, 400, 100, 50);
+       }},
+  };
+}
 }; // namespace scene
 // NOLINTEND(*magic-numbers)
\ No newline at end of file
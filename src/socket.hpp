@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#include <winsock2.h>
+// winsock2.h must come first.
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+// Minimal blocking TCP socket over BSD sockets and Winsock.
+class Socket {
+public:
+  Socket() = default;
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+  Socket(Socket&& other) noexcept
+      : mHandle{std::exchange(other.mHandle, kInvalid)} {}
+  Socket& operator=(Socket&& other) noexcept {
+    if (this != &other) {
+      close();
+      mHandle = std::exchange(other.mHandle, kInvalid);
+    }
+    return *this;
+  }
+  ~Socket() { close(); }
+
+  [[nodiscard]] bool valid() const { return mHandle != kInvalid; }
+
+  // Listens on all interfaces, or only to connections from this machine; an
+  // invalid socket means the port is taken.
+  static Socket listen(std::uint16_t port, bool loopbackOnly = false) {
+    startup();
+    Socket socket{::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)};
+    if (!socket.valid()) {
+      return {};
+    }
+    const int reuse = 1;
+    setsockopt(socket.mHandle, SOL_SOCKET, SO_REUSEADDR,
+               reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr =
+        htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+    address.sin_port = htons(port);
+    if (::bind(socket.mHandle, reinterpret_cast<const sockaddr*>(&address),
+               sizeof(address)) != 0 ||
+        ::listen(socket.mHandle, SOMAXCONN) != 0) {
+      return {};
+    }
+    return socket;
+  }
+
+  // Waits up to timeoutMilliseconds for a connection.
+  [[nodiscard]] std::optional<Socket> accept(int timeoutMilliseconds) const {
+    if (!waitReadable(timeoutMilliseconds)) {
+      return std::nullopt;
+    }
+    Socket client{::accept(mHandle, nullptr, nullptr)};
+    if (!client.valid()) {
+      return std::nullopt;
+    }
+    client.disableNagle();
+    return client;
+  }
+
+  static Socket connect(const std::string& host, std::uint16_t port) {
+    startup();
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                    &addresses) != 0) {
+      return {};
+    }
+
+    Socket socket;
+    for (auto* address = addresses; address != nullptr;
+         address = address->ai_next) {
+      Socket candidate{::socket(address->ai_family, address->ai_socktype,
+                                address->ai_protocol)};
+      if (candidate.valid() &&
+          ::connect(candidate.mHandle, address->ai_addr,
+                    static_cast<AddressLength>(address->ai_addrlen)) == 0) {
+        socket = std::move(candidate);
+        break;
+      }
+    }
+    freeaddrinfo(addresses);
+    if (socket.valid()) {
+      socket.disableNagle();
+    }
+    return socket;
+  }
+
+  // Makes receiveAll() fail when no data arrives for the given time; zero
+  // waits forever.
+  void setReceiveTimeout(int seconds) const {
+#ifdef _WIN32
+    const DWORD timeout = static_cast<DWORD>(seconds) * 1000;
+#else
+    timeval timeout{};
+    timeout.tv_sec = seconds;
+#endif
+    setsockopt(mHandle, SOL_SOCKET, SO_RCVTIMEO,
+               reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+  }
+
+  [[nodiscard]] bool sendAll(const void* data, size_t size) const {
+    const auto* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+      const auto sent = ::send(mHandle, bytes, chunk(size), kSendFlags);
+      if (sent <= 0) {
+        return false;
+      }
+      bytes += sent;
+      size -= static_cast<size_t>(sent);
+    }
+    return true;
+  }
+
+  [[nodiscard]] bool receiveAll(void* data, size_t size) const {
+    auto* bytes = static_cast<char*>(data);
+    while (size > 0) {
+      const auto received = ::recv(mHandle, bytes, chunk(size), 0);
+      if (received <= 0) {
+        return false;
+      }
+      bytes += received;
+      size -= static_cast<size_t>(received);
+    }
+    return true;
+  }
+
+  // Receives what has arrived, up to size bytes, waiting for at least one;
+  // zero once the peer closed the connection or it failed.
+  [[nodiscard]] size_t receiveSome(void* data, size_t size) const {
+    const auto received =
+        ::recv(mHandle, static_cast<char*>(data), chunk(size), 0);
+    return received > 0 ? static_cast<size_t>(received) : 0;
+  }
+
+  void close() {
+    if (valid()) {
+#ifdef _WIN32
+      closesocket(mHandle);
+#else
+      ::close(mHandle);
+#endif
+      mHandle = kInvalid;
+    }
+  }
+
+private:
+#ifdef _WIN32
+  using Handle = SOCKET;
+  static constexpr Handle kInvalid = INVALID_SOCKET;
+  using Length = int;
+  using AddressLength = int;
+#else
+  using Handle = int;
+  static constexpr Handle kInvalid = -1;
+  using Length = size_t;
+  using AddressLength = socklen_t;
+#endif
+#ifdef MSG_NOSIGNAL
+  // A peer that went away must not kill the process with SIGPIPE.
+  static constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+  static constexpr int kSendFlags = 0;
+#endif
+  static constexpr size_t kMaximumChunk = size_t{1} << 30U;
+
+  Handle mHandle{kInvalid};
+
+  explicit Socket(Handle handle) : mHandle{handle} {}
+
+  static void startup() {
+#ifdef _WIN32
+    static const bool started = [] {
+      WSADATA data{};
+      return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    (void)started;
+#endif
+  }
+
+  static Length chunk(size_t size) {
+    return static_cast<Length>(size < kMaximumChunk ? size : kMaximumChunk);
+  }
+
+  void disableNagle() const {
+    // Requests are small and answered one at a time.
+    const int noDelay = 1;
+    setsockopt(mHandle, IPPROTO_TCP, TCP_NODELAY,
+               reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+  }
+
+  [[nodiscard]] bool waitReadable(int timeoutMilliseconds) const {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(mHandle, &readable);
+    timeval timeout{};
+    timeout.tv_sec = timeoutMilliseconds / 1000;
+    timeout.tv_usec = (timeoutMilliseconds % 1000) * 1000;
+    return select(static_cast<int>(mHandle) + 1, &readable, nullptr, nullptr,
+                  &timeout) > 0;
+  }
+};
@@ -2,50 +2,56 @@
 
 #include "aabb.hpp"
 #include "hittable.hpp"
+#include "material.hpp"
+#include "onb.hpp"
+#include "stats.hpp"
 #include "vec2.hpp"
 #include "vec3.hpp"
+#include <cmath>
 #include <memory>
+#include <type_traits>
+#include <utility>
 
-class Sphere : public Hittable {
+// Sphere that either stays in place or moves linearly from one center at
+// time 0 to another at time 1. Static spheres skip evaluating the center at
+// the ray's time; both keep their squared and inverse radius.
+template <bool kMoving> class SphereShape final : public Hittable {
 public:
-  Sphere(const Vec3& center, double radius, std::shared_ptr<IMaterial> material)
-      : mCenter{center, {0, 0, 0}}, mRadius{std::fmax(0, radius)},
-        mMaterial{material} {
+  SphereShape(const Vec3& center, double radius,
+              std::shared_ptr<IMaterial> material)
+    requires(!kMoving)
+      : mCenter{center}, mRadius{std::fmax(0, radius)},
+        mMaterial{std::move(material)} {
     const auto radiusVector = Vec3{mRadius, mRadius, mRadius};
     mBoundingBox = {center - radiusVector, center + radiusVector};
+    mMotionBounds = {mBoundingBox, mBoundingBox};
   };
 
-  Sphere(const Vec3& startCenter, const Vec3& endCenter, double radius,
-         std::shared_ptr<IMaterial> material)
+  SphereShape(const Vec3& startCenter, const Vec3& endCenter, double radius,
+              std::shared_ptr<IMaterial> material)
+    requires kMoving
       : mCenter{startCenter, {endCenter - startCenter}},
-        mRadius{std::fmax(0, radius)}, mMaterial{material} {
+        mRadius{std::fmax(0, radius)}, mMaterial{std::move(material)} {
     const auto radiusVector = Vec3{mRadius, mRadius, mRadius};
-    AABB startBox{mCenter.at(0) - radiusVector, mCenter.at(0) + radiusVector};
-    AABB endBox{mCenter.at(1) - radiusVector, mCenter.at(1) + radiusVector};
-    mBoundingBox = AABB{startBox, endBox};
+    mMotionBounds = {
+        AABB{centerAt(0) - radiusVector, centerAt(0) + radiusVector},
+        AABB{centerAt(1) - radiusVector, centerAt(1) + radiusVector}};
+    mBoundingBox = AABB{mMotionBounds.start, mMotionBounds.end};
   };
 
   bool hit(const Ray& ray, Interval rayRange,
            HitRecord& hitInfo) const override {
-
-    // TODO: Find out why normal method produced weird visual bug?
-    const Vec3 currentCenter = mCenter.at(ray.time());
-    Vec3 oc = currentCenter - ray.origin();
-    auto a = ray.direction().length_squared();
-    auto h = dot(ray.direction(), oc);
-    auto c = oc.length_squared() - mRadius * mRadius;
-
-    auto discriminant = h * h - a * c;
-    if (discriminant < 0) {
+    stats::add(stats::Counter::SphereTests);
+    const Vec3 center = centerAt(ray.time());
+    Roots roots;
+    if (!intersect(ray, center, roots)) {
       return false;
     }
 
-    auto sqrtd = std::sqrt(discriminant);
-
     // Find the nearest root that lies in the acceptable range.
-    auto root = (h - sqrtd) / a;
+    auto root = roots.nearest;
     if (!rayRange.surrounds(root)) {
-      root = (h + sqrtd) / a;
+      root = roots.farthest;
       if (!rayRange.surrounds(root)) {
         return false;
       }
@@ -54,19 +60,160 @@ public:
     hitInfo.t = root;
     hitInfo.position = ray.at(root);
     hitInfo.material = mMaterial;
-    Vec3 normal = (hitInfo.position - currentCenter) / mRadius;
+    Vec3 normal = (hitInfo.position - center) * mInverseRadius;
     hitInfo.setFaceNormal(ray, normal);
     hitInfo.uv = getSphereUV(normal);
+    setSphereDerivatives(normal, hitInfo);
     return true;
   }
 
+  [[nodiscard]] bool occluded(const Ray& ray,
+                              Interval rayRange) const override {
+    stats::add(stats::Counter::SphereTests);
+    Roots roots;
+    return intersect(ray, centerAt(ray.time()), roots) &&
+           (rayRange.surrounds(roots.nearest) ||
+            rayRange.surrounds(roots.farthest));
+  }
+
+  bool hitSpan(const Ray& ray, Interval rayRange,
+               Interval& span) const override {
+    // Both roots of the intersection quadratic bound the chord through the
+    // sphere.
+    Roots roots;
+    if (!intersect(ray, centerAt(ray.time()), roots)) {
+      return false;
+    }
+    span = Interval{std::fmax(roots.nearest, rayRange.min()),
+                    std::fmin(roots.farthest, rayRange.max())};
+    return span.min() < span.max();
+  }
+
   [[nodiscard]] AABB boundingBox() const override { return mBoundingBox; }
 
+  [[nodiscard]] MotionBounds motionBounds() const override {
+    return mMotionBounds;
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add(kMoving ? "MovingSphere" : "Sphere");
+    if constexpr (kMoving) {
+      print.add(mCenter.origin());
+      print.add(mCenter.direction());
+    } else {
+      print.add(mCenter);
+    }
+    print.add(mRadius);
+    if (mMaterial) {
+      mMaterial->fingerprint(print);
+    }
+  }
+
+  [[nodiscard]] double pdfValue(const Vec3& origin,
+                                const Vec3& direction) const override {
+    // Only valid for stationary spheres: the solid angle of the cone from
+    // origin that bounds the sphere at its start position.
+    HitRecord hitInfo;
+    if (!hit(Ray{origin, direction}, Interval{0.001, utils::INFINITE_DOUBLE},
+             hitInfo)) {
+      return 0;
+    }
+
+    const auto distanceSquared = (centerAt(0) - origin).length_squared();
+    if (distanceSquared <= mRadiusSquared) {
+      // From inside, the sphere surrounds origin and random() samples every
+      // direction uniformly.
+      return 1 / (4 * utils::PI);
+    }
+    const auto cosThetaMax = std::sqrt(1 - mRadiusSquared / distanceSquared);
+    const auto solidAngle = 2 * utils::PI * (1 - cosThetaMax);
+
+    return 1 / solidAngle;
+  }
+
+  [[nodiscard]] Vec3 random(const Vec3& origin) const override {
+    const Vec3 direction = centerAt(0) - origin;
+    const auto distanceSquared = direction.length_squared();
+    if (distanceSquared <= mRadiusSquared) {
+      return randomUnitVector();
+    }
+    const OrthonormalBasis basis{direction};
+    return basis.transform(randomToSphere(mRadius, distanceSquared));
+  }
+
 private:
-  Ray mCenter;
+  // Roots of the intersection quadratic, nearest first.
+  struct Roots {
+    double nearest{};
+    double farthest{};
+  };
+
+  std::conditional_t<kMoving, Ray, Vec3> mCenter;
   double mRadius;
+  double mRadiusSquared{mRadius * mRadius};
+  double mInverseRadius{mRadius > 0 ? 1 / mRadius : 0};
   std::shared_ptr<IMaterial> mMaterial;
   AABB mBoundingBox;
+  MotionBounds mMotionBounds;
+
+  [[nodiscard]] Vec3 centerAt(double time) const {
+    if constexpr (kMoving) {
+      return mCenter.at(time);
+    } else {
+      (void)time;
+      return mCenter;
+    }
+  }
+
+  // Solves the quadratic as in Ray Tracing Gems, chapter 7, so that nothing
+  // cancels for small spheres far from the ray origin: the discriminant
+  // h^2 - a * c is rewritten through |d|^2 |oc|^2 - (d.oc)^2 = |d x oc|^2, and
+  // the second root comes from the product of the roots.
+  bool intersect(const Ray& ray, const Vec3& center, Roots& roots) const {
+    const Vec3 oc = center - ray.origin();
+    const auto a = ray.direction().length_squared();
+    const auto discriminant =
+        a * mRadiusSquared - cross(ray.direction(), oc).length_squared();
+    if (discriminant < 0) {
+      return false;
+    }
+
+    const auto h = dot(ray.direction(), oc);
+    const auto c = oc.length_squared() - mRadiusSquared;
+    const auto q = h + std::copysign(std::sqrt(discriminant), h);
+    const auto first = c / q;
+    const auto second = q / a;
+    roots = {std::fmin(first, second), std::fmax(first, second)};
+    return true;
+  }
+
+  static Vec3 randomToSphere(double radius, double distanceSquared) {
+    // Uniformly samples the cone of directions that subtends the sphere.
+    const auto [r1, r2] = utils::randomPair();
+    const auto z =
+        1 + r2 * (std::sqrt(1 - radius * radius / distanceSquared) - 1);
+
+    const auto phi = 2 * utils::PI * r1;
+    const auto x = std::cos(phi) * std::sqrt(1 - z * z);
+    const auto y = std::sin(phi) * std::sqrt(1 - z * z);
+
+    return {x, y, z};
+  }
+
+  void setSphereDerivatives(const Vec3& normal, HitRecord& hitInfo) const {
+    // Derivatives of the getSphereUV parameterization, scaled by the radius.
+    // At the poles dp/du vanishes and dp/dv has no unique direction.
+    const auto sinTheta =
+        std::sqrt(normal.x() * normal.x() + normal.z() * normal.z());
+    hitInfo.dpdu = 2 * utils::PI * mRadius * Vec3{normal.z(), 0, -normal.x()};
+    if (sinTheta <= 0) {
+      hitInfo.dpdv = Vec3{};
+      return;
+    }
+    hitInfo.dpdv = utils::PI * mRadius *
+                   Vec3{-normal.x() * normal.y() / sinTheta, sinTheta,
+                        -normal.y() * normal.z() / sinTheta};
+  }
 
   static Vec2<double> getSphereUV(const Vec3& point) {
     // point: a given point on the sphere of radius one, centered at the origin.
@@ -83,4 +230,7 @@ private:
     double v = theta / utils::PI;
     return {u, v};
   }
-};
\ No newline at end of file
+};
+
+using Sphere = SphereShape<false>;
+using MovingSphere = SphereShape<true>;
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Render statistics counters. Build with RAYTRACE_ENABLE_STATS defined to
+// collect them; otherwise every call below compiles to nothing.
+//
+// Each thread counts into its own thread-local block, so the hot paths never
+// share a cache line or take a lock. Camera::render() resets the blocks before
+// rendering and merges them into a Report afterwards.
+namespace stats {
+
+#ifdef RAYTRACE_ENABLE_STATS
+constexpr bool kEnabled = true;
+#else
+constexpr bool kEnabled = false;
+#endif
+
+enum class Counter : std::uint8_t {
+  PrimaryRays,
+  SecondaryRays,
+  Samples,
+  Hits,
+  BVHNodesVisited,
+  BoxTests,
+  SphereTests,
+  QuadTests,
+  BoxPrimitiveTests,
+  MediumTests,
+  MediumScatters,
+  Count
+};
+
+constexpr size_t kCounterCount = static_cast<size_t>(Counter::Count);
+// Paths longer than this are counted in the last bin.
+constexpr size_t kDepthBins = 64;
+
+constexpr std::array<std::string_view, kCounterCount> kCounterNames{
+    "primaryRays",     "secondaryRays", "samples",     "hits",
+    "bvhNodesVisited",   "boxTests",    "sphereTests", "quadTests",
+    "boxPrimitiveTests", "mediumTests", "mediumScatters"};
+
+struct Report {
+  std::array<std::uint64_t, kCounterCount> counters{};
+  // pathDepths[d] is the number of paths that traced exactly d + 1 rays.
+  std::array<std::uint64_t, kDepthBins> pathDepths{};
+
+  [[nodiscard]] std::uint64_t operator[](Counter counter) const {
+    return counters[static_cast<size_t>(counter)];
+  }
+
+  Report& operator+=(const Report& other) {
+    for (size_t i = 0; i < kCounterCount; ++i) {
+      counters[i] += other.counters[i];
+    }
+    for (size_t i = 0; i < kDepthBins; ++i) {
+      pathDepths[i] += other.pathDepths[i];
+    }
+    return *this;
+  }
+
+  [[nodiscard]] std::uint64_t rays() const {
+    return (*this)[Counter::PrimaryRays] + (*this)[Counter::SecondaryRays];
+  }
+
+  [[nodiscard]] double perRay(Counter counter) const {
+    const auto total = rays();
+    return total == 0 ? 0.0
+                      : static_cast<double>((*this)[counter]) /
+                            static_cast<double>(total);
+  }
+
+  void writeText(std::ostream& out) const {
+    out << "Render statistics:\n";
+    for (size_t i = 0; i < kCounterCount; ++i) {
+      out << "  " << kCounterNames[i] << ": " << counters[i] << '\n';
+    }
+    out << "  bvhNodesPerRay: " << perRay(Counter::BVHNodesVisited) << '\n'
+        << "  boxTestsPerRay: " << perRay(Counter::BoxTests) << '\n'
+        << "  pathDepths:";
+    for (size_t i = 0; i <= lastDepth(); ++i) {
+      out << ' ' << pathDepths[i];
+    }
+    out << '\n';
+  }
+
+  void writeJson(std::ostream& out) const {
+    out << "{\n";
+    for (size_t i = 0; i < kCounterCount; ++i) {
+      out << "  \"" << kCounterNames[i] << "\": " << counters[i] << ",\n";
+    }
+    out << "  \"bvhNodesPerRay\": " << perRay(Counter::BVHNodesVisited)
+        << ",\n"
+        << "  \"boxTestsPerRay\": " << perRay(Counter::BoxTests) << ",\n"
+        << "  \"pathDepths\": [";
+    for (size_t i = 0; i <= lastDepth(); ++i) {
+      out << (i == 0 ? "" : ", ") << pathDepths[i];
+    }
+    out << "]\n}\n";
+  }
+
+private:
+  [[nodiscard]] size_t lastDepth() const {
+    size_t last = 0;
+    for (size_t i = 0; i < kDepthBins; ++i) {
+      if (pathDepths[i] != 0) {
+        last = i;
+      }
+    }
+    return last;
+  }
+};
+
+namespace detail {
+
+struct Block {
+  Report report;
+  int pathRays{0};
+};
+
+// Constant initialized, so the hot paths touch it without a guard check.
+inline thread_local constinit Block tBlock;
+
+class Registry {
+public:
+  static Registry& instance() {
+    static Registry registry;
+    return registry;
+  }
+
+  void attach(Block* block) {
+    const std::lock_guard lock{mMutex};
+    mBlocks.push_back(block);
+  }
+
+  void detach(Block* block) {
+    // Keeps the counts of threads that finish before the report is made.
+    const std::lock_guard lock{mMutex};
+    mRetired += block->report;
+    std::erase(mBlocks, block);
+  }
+
+  void reset() {
+    const std::lock_guard lock{mMutex};
+    mRetired = {};
+    for (auto* block : mBlocks) {
+      block->report = {};
+    }
+  }
+
+  [[nodiscard]] Report collect() const {
+    const std::lock_guard lock{mMutex};
+    Report total = mRetired;
+    for (const auto* block : mBlocks) {
+      total += block->report;
+    }
+    return total;
+  }
+
+private:
+  Registry() = default;
+
+  mutable std::mutex mMutex;
+  std::vector<Block*> mBlocks;
+  Report mRetired;
+};
+
+// Registers the calling thread's block for the lifetime of the thread.
+class Attachment {
+public:
+  Attachment() { Registry::instance().attach(&tBlock); }
+  Attachment(const Attachment&) = delete;
+  Attachment(Attachment&&) = delete;
+  Attachment& operator=(const Attachment&) = delete;
+  Attachment& operator=(Attachment&&) = delete;
+  ~Attachment() { Registry::instance().detach(&tBlock); }
+};
+
+inline void attachThread() { thread_local Attachment attachment; }
+
+} // namespace detail
+
+inline void add(Counter counter, std::uint64_t amount = 1) {
+  if constexpr (kEnabled) {
+    detail::tBlock.report.counters[static_cast<size_t>(counter)] += amount;
+  } else {
+    (void)counter;
+    (void)amount;
+  }
+}
+
+// Counts a ray traced by the integrator towards the current path.
+inline void addPathRay(bool primary) {
+  if constexpr (kEnabled) {
+    auto& block = detail::tBlock;
+    ++block.report.counters[static_cast<size_t>(
+        primary ? Counter::PrimaryRays : Counter::SecondaryRays)];
+    ++block.pathRays;
+  } else {
+    (void)primary;
+  }
+}
+
+// Closes the current path, binning it by the number of rays it traced. Also
+// registers the calling thread, so every thread that traces paths is merged.
+inline void endPath() {
+  if constexpr (kEnabled) {
+    detail::attachThread();
+    auto& block = detail::tBlock;
+    const auto bin = static_cast<size_t>(std::max(block.pathRays - 1, 0));
+    ++block.report.pathDepths[std::min(bin, kDepthBins - 1)];
+    block.pathRays = 0;
+  }
+}
+
+// Closes a path whose rays were traced interleaved with those of other paths,
+// so the running count does not belong to it.
+inline void endPath(int pathRays) {
+  if constexpr (kEnabled) {
+    detail::tBlock.pathRays = pathRays;
+    endPath();
+  } else {
+    (void)pathRays;
+  }
+}
+
+// The calling thread's running count, for measuring a stretch of work.
+[[nodiscard]] inline std::uint64_t threadCount(Counter counter) {
+  if constexpr (kEnabled) {
+    return detail::tBlock.report.counters[static_cast<size_t>(counter)];
+  }
+  (void)counter;
+  return 0;
+}
+
+inline void reset() {
+  if constexpr (kEnabled) {
+    detail::attachThread();
+    detail::Registry::instance().reset();
+  }
+}
+
+// Sums the counters of every thread since the last reset().
+[[nodiscard]] inline Report collect() {
+  if constexpr (kEnabled) {
+    return detail::Registry::instance().collect();
+  }
+  return {};
+}
+
+} // namespace stats
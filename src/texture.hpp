@@ -1,14 +1,46 @@
 #pragma once
 
+#include "aabb.hpp"
+#include "arena.hpp"
 #include "color.hpp"
+#include "fingerprint.hpp"
 #include "image.hpp"
 #include "interval.hpp"
 #include "perlin.hpp"
+#include "texture_cache.hpp"
 #include "vec2.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+class TextureProgram;
+
 class Texture {
 public:
   [[nodiscard]] virtual Color value(const Vec2<double>& uvCoords,
                                     const Vec3& point) const = 0;
+  // Lookup filtered over the uv footprint (duvdx, duvdy) of one pixel.
+  // Textures that do not filter fall back to a point lookup.
+  [[nodiscard]] virtual Color filteredValue(const Vec2<double>& uvCoords,
+                                            const Vec3& point,
+                                            const Vec2<double>& duvdx,
+                                            const Vec2<double>& duvdy) const {
+    (void)duvdx;
+    (void)duvdy;
+    return value(uvCoords, point);
+  }
+
+  // Appends the nodes that evaluate this texture to program and returns the
+  // index of the last. By default the node calls back into the texture.
+  virtual std::uint32_t compile(TextureProgram& program) const;
+
+  // Adds the texture's type and parameters; see Hittable::fingerprint().
+  virtual void fingerprint(Fingerprint& print) const { print.markUnknown(); }
+
   virtual ~Texture() = default;
 
 protected:
@@ -33,10 +65,26 @@ public:
     return mAlbedo;
   }
 
+  std::uint32_t compile(TextureProgram& program) const override;
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("SolidColor");
+    print.add(mAlbedo);
+  }
+
 private:
   Color mAlbedo;
 };
 
+// Whether a point lies in an even cell of a 3D checkerboard.
+inline bool checkerIsEven(double inverseScale, const Vec3& point) {
+  auto xInteger = int(std::floor(inverseScale * point.x()));
+  auto yInteger = int(std::floor(inverseScale * point.y()));
+  auto zInteger = int(std::floor(inverseScale * point.z()));
+
+  return (xInteger + yInteger + zInteger) % 2 == 0;
+}
+
 class CheckerTexture : public Texture {
 public:
   CheckerTexture(double scale, std::shared_ptr<Texture> even,
@@ -44,22 +92,38 @@ public:
       : mInverseScale{1.0 / scale}, mEven{even}, mOdd{odd} {}
 
   CheckerTexture(double scale, const Color& c1, const Color& c2)
-      : CheckerTexture(scale, std::make_shared<SolidColor>(c1),
-                       std::make_shared<SolidColor>(c2)) {}
+      : CheckerTexture(scale, makeShared<SolidColor>(c1),
+                       makeShared<SolidColor>(c2)) {}
 
   [[nodiscard]] Color value(const Vec2<double>& uvCoords,
                             const Vec3& point) const override {
-    auto xInteger = int(std::floor(mInverseScale * point.x()));
-    auto yInteger = int(std::floor(mInverseScale * point.y()));
-    auto zInteger = int(std::floor(mInverseScale * point.z()));
+    return isEven(point) ? mEven->value(uvCoords, point)
+                         : mOdd->value(uvCoords, point);
+  }
+
+  [[nodiscard]] Color filteredValue(const Vec2<double>& uvCoords,
+                                    const Vec3& point,
+                                    const Vec2<double>& duvdx,
+                                    const Vec2<double>& duvdy) const override {
+    return isEven(point)
+               ? mEven->filteredValue(uvCoords, point, duvdx, duvdy)
+               : mOdd->filteredValue(uvCoords, point, duvdx, duvdy);
+  }
 
-    bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
+  std::uint32_t compile(TextureProgram& program) const override;
 
-    return isEven ? mEven->value(uvCoords, point)
-                  : mOdd->value(uvCoords, point);
+  void fingerprint(Fingerprint& print) const override {
+    print.add("CheckerTexture");
+    print.add(mInverseScale);
+    mEven->fingerprint(print);
+    mOdd->fingerprint(print);
   }
 
 private:
+  [[nodiscard]] bool isEven(const Vec3& point) const {
+    return checkerIsEven(mInverseScale, point);
+  }
+
   double mInverseScale;
   std::shared_ptr<Texture> mEven;
   std::shared_ptr<Texture> mOdd;
@@ -72,39 +136,203 @@ public:
     (void)point;
     return Color{uvCoords.u, uvCoords.v, 0.0};
   }
+
+  std::uint32_t compile(TextureProgram& program) const override;
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("UVTexture");
+  }
 };
 
-class ImageTexture : public Texture {
+// A texture graph flattened into an array of nodes, children before their
+// parents, for the materials to evaluate without a virtual call per node.
+// Compiling folds constants: a checker of two solid colours becomes a single
+// node, and one of two equal colours a constant. Textures without a node of
+// their own are called through their virtual interface.
+class TextureProgram {
 public:
-  ImageTexture(const char* filename) : mImage(filename){};
+  enum class Op : std::uint8_t { Constant, Checker, ConstantChecker, UV, Call };
+
+  struct Node {
+    Op op{Op::Constant};
+    // Constant colour, or the colours of a ConstantChecker.
+    Color even{};
+    Color odd{};
+    double inverseScale{};
+    std::uint32_t evenNode{};
+    std::uint32_t oddNode{};
+    const Texture* texture{};
+  };
+
+  // Where a batch of lookups happens.
+  struct Lookup {
+    Vec2<double> uv;
+    Vec3 point;
+  };
+
+  explicit TextureProgram(const Texture& texture)
+      : mRoot{texture.compile(*this)} {}
 
   [[nodiscard]] Color value(const Vec2<double>& uvCoords,
-                            const Vec3& point) const override {
-    (void)point;
-    if (mImage.height() <= 0) {
-      return mDebugColor;
+                            const Vec3& point) const {
+    return evaluate<false>(uvCoords, point, {}, {});
+  }
+
+  [[nodiscard]] Color filteredValue(const Vec2<double>& uvCoords,
+                                    const Vec3& point,
+                                    const Vec2<double>& duvdx,
+                                    const Vec2<double>& duvdy) const {
+    return evaluate<true>(uvCoords, point, duvdx, duvdy);
+  }
+
+  // Point lookups for many hit points at once.
+  void values(std::span<const Lookup> lookups, std::span<Color> colors) const {
+    for (size_t i = 0; i < lookups.size(); ++i) {
+      colors[i] = evaluate<false>(lookups[i].uv, lookups[i].point, {}, {});
+    }
+  }
+
+  [[nodiscard]] size_t size() const { return mNodes.size(); }
+
+  std::uint32_t addConstant(const Color& color) {
+    return add({.op = Op::Constant, .even = color});
+  }
+
+  std::uint32_t addChecker(double inverseScale, std::uint32_t evenNode,
+                           std::uint32_t oddNode) {
+    const Node even = mNodes[evenNode];
+    const Node odd = mNodes[oddNode];
+    if (even.op != Op::Constant || odd.op != Op::Constant) {
+      return add({.op = Op::Checker,
+                  .inverseScale = inverseScale,
+                  .evenNode = evenNode,
+                  .oddNode = oddNode});
+    }
+    // Two solid colours; the nodes just added for them are no longer needed.
+    if (oddNode + 1 == mNodes.size() && evenNode + 1 == oddNode) {
+      mNodes.resize(evenNode);
+    }
+    if (even.even.e == odd.even.e) {
+      return addConstant(even.even);
+    }
+    return add({.op = Op::ConstantChecker,
+                .even = even.even,
+                .odd = odd.even,
+                .inverseScale = inverseScale});
+  }
+
+  std::uint32_t addUV() { return add({.op = Op::UV}); }
+
+  std::uint32_t addCall(const Texture& texture) {
+    return add({.op = Op::Call, .texture = &texture});
+  }
+
+private:
+  std::vector<Node> mNodes;
+  std::uint32_t mRoot;
+
+  std::uint32_t add(const Node& node) {
+    mNodes.push_back(node);
+    return static_cast<std::uint32_t>(mNodes.size() - 1);
+  }
+
+  template <bool kFiltered>
+  [[nodiscard]] Color evaluate(const Vec2<double>& uvCoords,
+                               const Vec3& point, const Vec2<double>& duvdx,
+                               const Vec2<double>& duvdy) const {
+    const Node* node = &mNodes[mRoot];
+    while (node->op == Op::Checker) {
+      node = &mNodes[checkerIsEven(node->inverseScale, point) ? node->evenNode
+                                                               : node->oddNode];
+    }
+    switch (node->op) {
+    case Op::Constant:
+      return node->even;
+    case Op::ConstantChecker:
+      return checkerIsEven(node->inverseScale, point) ? node->even : node->odd;
+    case Op::UV:
+      return Color{uvCoords.u, uvCoords.v, 0.0};
+    case Op::Checker:
+    case Op::Call:
+      break;
     }
+    if constexpr (kFiltered) {
+      return node->texture->filteredValue(uvCoords, point, duvdx, duvdy);
+    } else {
+      return node->texture->value(uvCoords, point);
+    }
+  }
+};
+
+inline std::uint32_t Texture::compile(TextureProgram& program) const {
+  return program.addCall(*this);
+}
+
+inline std::uint32_t SolidColor::compile(TextureProgram& program) const {
+  return program.addConstant(mAlbedo);
+}
 
-    double u = uvCoords.u;
-    double v = uvCoords.v;
+inline std::uint32_t CheckerTexture::compile(TextureProgram& program) const {
+  const std::uint32_t even = mEven->compile(program);
+  const std::uint32_t odd = mOdd->compile(program);
+  return program.addChecker(mInverseScale, even, odd);
+}
 
-    u = Interval{0, 1}.clamp(u);
-    v = 1.0 - Interval{0, 1}.clamp(v);
+inline std::uint32_t UVTexture::compile(TextureProgram& program) const {
+  return program.addUV();
+}
 
-    auto uIntCoord = int(u * mImage.width());
-    auto vIntCoord = int(v * mImage.height());
+class ImageTexture : public Texture {
+public:
+  // Images are shared through the TextureCache and decoded on first lookup.
+  ImageTexture(const char* filename)
+      : mImage{TextureCache::instance().acquire(filename)} {};
+
+  [[nodiscard]] Color value(const Vec2<double>& uvCoords,
+                            const Vec3& point) const override {
+    return lookup(uvCoords, point, 0.0);
+  }
 
-    auto pixelData = mImage.pixelData(uIntCoord, vIntCoord);
+  [[nodiscard]] Color filteredValue(const Vec2<double>& uvCoords,
+                                    const Vec3& point,
+                                    const Vec2<double>& duvdx,
+                                    const Vec2<double>& duvdy) const override {
+    // Pick the mip level whose texels match the larger side of the pixel
+    // footprint.
+    const auto& image = mImage->image();
+    const double width = image.width();
+    const double height = image.height();
+    const double xFootprint = std::hypot(duvdx.u * width, duvdx.v * height);
+    const double yFootprint = std::hypot(duvdy.u * width, duvdy.v * height);
+    const double footprint = std::fmax(xFootprint, yFootprint);
 
-    auto r = pixelData[0];
-    auto g = pixelData[1];
-    auto b = pixelData[2];
-    return {r, g, b};
+    const double lod = footprint > 1.0 ? std::log2(footprint) : 0.0;
+    return lookup(uvCoords, point, lod);
+  }
+
+  void fingerprint(Fingerprint& print) const override {
+    print.add("ImageTexture");
+    mImage->fingerprint(print);
   }
 
 private:
   static constexpr Color mDebugColor = Color{0, 1, 1};
-  Image mImage;
+  std::shared_ptr<const CachedImage> mImage;
+
+  [[nodiscard]] Color lookup(const Vec2<double>& uvCoords, const Vec3& point,
+                             double lod) const {
+    (void)point;
+    const auto& image = mImage->image();
+    if (image.height() <= 0) {
+      return mDebugColor;
+    }
+
+    double u = Interval{0, 1}.clamp(uvCoords.u);
+    double v = 1.0 - Interval{0, 1}.clamp(uvCoords.v);
+
+    const auto pixelData = image.trilinear(u, v, lod);
+    return {pixelData[0], pixelData[1], pixelData[2]};
+  }
 };
 
 class NoiseTexture : public Texture {
@@ -114,10 +342,103 @@ public:
                             const Vec3& point) const override {
     (void)uvCoords;
     return 0.5 * color::White *
-           (1 + std::sin(scale * point.z() + 10 * noise.turbulence(point, 7)));
+           (1 + std::sin(scale * point.z() + 10 * turbulence(point)));
+  }
+
+  // The baked grid changes the pattern slightly, so it counts too.
+  void fingerprint(Fingerprint& print) const override {
+    print.add("NoiseTexture");
+    print.add(scale);
+    noise.fingerprint(print);
+    print.add(mBakeResolution);
+    if (mBakeResolution > 0) {
+      print.add(mBakeBounds.mX.min());
+      print.add(mBakeBounds.mX.max());
+      print.add(mBakeBounds.mY.min());
+      print.add(mBakeBounds.mY.max());
+      print.add(mBakeBounds.mZ.min());
+      print.add(mBakeBounds.mZ.max());
+    }
+  }
+
+  void bake(const AABB& bounds, int resolution) {
+    // Samples the turbulence on a resolution^3 grid spanning bounds. Lookups
+    // inside bounds then interpolate the grid instead of evaluating all
+    // octaves; detail finer than a grid cell is smoothed out, so the grid
+    // should be dense relative to the pattern scale. Bounds that are flat or
+    // unbounded along an axis cannot be gridded and leave lookups direct.
+    mBaked.clear();
+    mBakeResolution = 0;
+    for (size_t axis = 0; axis < 3; ++axis) {
+      const double extent = bounds.axisInterval(axis).size();
+      if (!(extent > 0) || !std::isfinite(extent)) {
+        return;
+      }
+    }
+    mBakeBounds = bounds;
+    mBakeResolution = std::max(resolution, 2);
+    const auto samples = static_cast<size_t>(mBakeResolution);
+    mBaked.assign(samples * samples * samples, 0.0f);
+
+    const double steps = mBakeResolution - 1;
+    for (size_t z = 0; z < samples; ++z) {
+      for (size_t y = 0; y < samples; ++y) {
+        for (size_t x = 0; x < samples; ++x) {
+          const Vec3 point{bakeAxis(0, double(x) / steps),
+                           bakeAxis(1, double(y) / steps),
+                           bakeAxis(2, double(z) / steps)};
+          mBaked[(z * samples + y) * samples + x] = static_cast<float>(
+              noise.turbulence(point, kTurbulenceDepth));
+        }
+      }
+    }
   }
 
 private:
+  static constexpr int kTurbulenceDepth = 7;
   Perlin noise;
   double scale;
+  AABB mBakeBounds;
+  int mBakeResolution{0};
+  std::vector<float> mBaked;
+
+  [[nodiscard]] double bakeAxis(size_t axis, double fraction) const {
+    const auto& interval = mBakeBounds.axisInterval(axis);
+    return interval.min() + fraction * interval.size();
+  }
+
+  [[nodiscard]] double turbulence(const Vec3& point) const {
+    if (mBaked.empty() || !mBakeBounds.mX.contains(point.x()) ||
+        !mBakeBounds.mY.contains(point.y()) ||
+        !mBakeBounds.mZ.contains(point.z())) {
+      return noise.turbulence(point, kTurbulenceDepth);
+    }
+
+    const double steps = mBakeResolution - 1;
+    std::array<size_t, 3> cell{};
+    std::array<double, 3> fraction{};
+    for (size_t axis = 0; axis < 3; ++axis) {
+      const auto& interval = mBakeBounds.axisInterval(axis);
+      const double position =
+          (point[axis] - interval.min()) / interval.size() * steps;
+      const double lower = std::fmin(std::floor(position), steps - 1);
+      cell[axis] = static_cast<size_t>(lower);
+      fraction[axis] = position - lower;
+    }
+
+    const auto samples = static_cast<size_t>(mBakeResolution);
+    auto at = [&](size_t dx, size_t dy, size_t dz) {
+      return double(mBaked[((cell[2] + dz) * samples + cell[1] + dy) * samples +
+                           cell[0] + dx]);
+    };
+    auto lerp = [](double a, double b, double t) { return a + t * (b - a); };
+
+    const double y0 = lerp(lerp(at(0, 0, 0), at(1, 0, 0), fraction[0]),
+                           lerp(at(0, 1, 0), at(1, 1, 0), fraction[0]),
+                           fraction[1]);
+    const double y1 = lerp(lerp(at(0, 0, 1), at(1, 0, 1), fraction[0]),
+                           lerp(at(0, 1, 1), at(1, 1, 1), fraction[0]),
+                           fraction[1]);
+    return lerp(y0, y1, fraction[2]);
+  }
 };
\ No newline at end of file
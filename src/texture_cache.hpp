@@ -0,0 +1,179 @@
+#pragma once
+
+#include "fingerprint.hpp"
+#include "image.hpp"
+#include "tile_cache.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class CachedImage;
+
+// Process-wide registry of image files. Every file is decoded at most once,
+// on first lookup rather than at scene construction. Images whose mip chain is
+// larger than the paging threshold are written to a tiled cache file and then
+// paged in per tile through the TileCache instead of staying resident.
+class TextureCache {
+public:
+  struct Statistics {
+    size_t requests{};
+    size_t uniqueImages{};
+    size_t decodes{};
+    size_t pagedImages{};
+  };
+
+  static TextureCache& instance() {
+    static TextureCache cache;
+    return cache;
+  }
+
+  TextureCache(const TextureCache&) = delete;
+  TextureCache(TextureCache&&) = delete;
+  TextureCache& operator=(const TextureCache&) = delete;
+  TextureCache& operator=(TextureCache&&) = delete;
+  ~TextureCache() = default;
+
+  std::shared_ptr<const CachedImage> acquire(const std::string& filename);
+
+  void setPagingThreshold(size_t bytes) {
+    const std::lock_guard lock{mMutex};
+    mPagingThresholdBytes = bytes;
+  }
+
+  void setCacheDirectory(const std::filesystem::path& directory) {
+    const std::lock_guard lock{mMutex};
+    mCacheDirectory = directory;
+  }
+
+  [[nodiscard]] Statistics statistics() const {
+    const std::lock_guard lock{mMutex};
+    return mStatistics;
+  }
+
+  void report(std::ostream& out) const {
+    const auto images = statistics();
+    const auto tiles = TileCache::instance().statistics();
+    constexpr double kBytesPerMegabyte = 1024.0 * 1024.0;
+    out << "Textures: " << images.requests << " requested, "
+        << images.uniqueImages << " unique, " << images.decodes
+        << " decoded, " << images.pagedImages << " paged\n"
+        << "Texture tiles: " << tiles.hits << " hits, " << tiles.misses
+        << " misses, " << tiles.evictions << " evictions, "
+        << static_cast<double>(tiles.peakResidentBytes) / kBytesPerMegabyte
+        << " MB peak resident\n";
+  }
+
+private:
+  friend class CachedImage;
+  static constexpr size_t kDefaultPagingThresholdBytes = size_t{64} << 20U;
+
+  TextureCache() = default;
+
+  mutable std::mutex mMutex;
+  std::unordered_map<std::string, std::shared_ptr<const CachedImage>> mImages;
+  size_t mPagingThresholdBytes{kDefaultPagingThresholdBytes};
+  std::filesystem::path mCacheDirectory{
+      std::filesystem::temp_directory_path() / "rtw_tile_cache"};
+  Statistics mStatistics;
+
+  void load(const std::string& filename, Image& image) {
+    const auto path = Image::locate(filename.c_str());
+    if (path.empty()) {
+      std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+      return;
+    }
+
+    std::filesystem::path tilePath;
+    size_t threshold = 0;
+    {
+      const std::lock_guard lock{mMutex};
+      threshold = mPagingThresholdBytes;
+      tilePath = mCacheDirectory /
+                 (std::to_string(std::hash<std::string>{}(
+                      std::filesystem::absolute(path).string())) +
+                  ".tiles");
+    }
+
+    // A tile file from an earlier run skips decoding entirely.
+    std::error_code error;
+    if (std::filesystem::exists(tilePath, error) &&
+        std::filesystem::last_write_time(tilePath, error) >=
+            std::filesystem::last_write_time(path, error) &&
+        image.pageFrom(tilePath.string())) {
+      countLoad(false, true);
+      return;
+    }
+
+    if (!image.load(path)) {
+      std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+      return;
+    }
+
+    bool paged = false;
+    if (image.memoryBytes() >= threshold) {
+      std::filesystem::create_directories(tilePath.parent_path(), error);
+      paged = image.writeTileFile(tilePath.string()) &&
+              image.pageFrom(tilePath.string());
+    }
+    countLoad(true, paged);
+  }
+
+  void countLoad(bool decoded, bool paged) {
+    const std::lock_guard lock{mMutex};
+    mStatistics.decodes += decoded ? 1 : 0;
+    mStatistics.pagedImages += paged ? 1 : 0;
+  }
+};
+
+class CachedImage {
+public:
+  CachedImage(std::string filename, TextureCache& owner)
+      : mFilename{std::move(filename)}, mOwner{owner} {}
+
+  // Decodes (or maps) the image on first use.
+  [[nodiscard]] const Image& image() const {
+    std::call_once(mLoaded, [this] { mOwner.load(mFilename, mImage); });
+    return mImage;
+  }
+
+  // Adds the file the image comes from and when it was last written, so a
+  // changed file counts as a different image without decoding it.
+  void fingerprint(Fingerprint& print) const {
+    print.add(mFilename);
+    const auto path = Image::locate(mFilename.c_str());
+    std::error_code error;
+    const auto size = std::filesystem::file_size(path, error);
+    const auto written = std::filesystem::last_write_time(path, error);
+    if (error) {
+      print.add("missing");
+      return;
+    }
+    print.add(std::filesystem::absolute(path, error).string());
+    print.add(static_cast<std::uint64_t>(size));
+    print.add(static_cast<std::uint64_t>(written.time_since_epoch().count()));
+  }
+
+private:
+  std::string mFilename;
+  TextureCache& mOwner;
+  mutable std::once_flag mLoaded;
+  mutable Image mImage;
+};
+
+inline std::shared_ptr<const CachedImage>
+TextureCache::acquire(const std::string& filename) {
+  const std::lock_guard lock{mMutex};
+  ++mStatistics.requests;
+  auto& entry = mImages[filename];
+  if (!entry) {
+    entry = std::make_shared<const CachedImage>(filename, *this);
+    ++mStatistics.uniqueImages;
+  }
+  return entry;
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Process-wide LRU cache of texture tiles paged in from tiled cache files.
+// Tiles are 8x8 texels of four bytes each, stored back to back after a
+// header of one tile, so every tile sits at a 256 byte aligned offset and the
+// file can equally be memory mapped.
+class TileCache {
+public:
+  using Texel = std::array<unsigned char, 4>;
+  static constexpr int kTileSize = 8;
+  static constexpr int kTexelsPerTile = kTileSize * kTileSize;
+  using Tile = std::array<Texel, kTexelsPerTile>;
+  static constexpr size_t kTileBytes = sizeof(Tile);
+
+  struct Statistics {
+    size_t hits{};
+    size_t misses{};
+    size_t evictions{};
+    size_t residentBytes{};
+    size_t peakResidentBytes{};
+  };
+
+  static TileCache& instance() {
+    static TileCache cache;
+    return cache;
+  }
+
+  TileCache(const TileCache&) = delete;
+  TileCache(TileCache&&) = delete;
+  TileCache& operator=(const TileCache&) = delete;
+  TileCache& operator=(TileCache&&) = delete;
+  ~TileCache() = default;
+
+  // Returns an id to fetch tiles of the given file with, or -1 if the file
+  // cannot be opened.
+  int registerFile(const std::string& path) {
+    auto file = std::make_unique<File>();
+    file->path = path;
+    file->stream.open(path, std::ios::binary);
+    if (!file->stream.is_open()) {
+      return -1;
+    }
+    const std::lock_guard lock{mFilesMutex};
+    mFiles.push_back(std::move(file));
+    return static_cast<int>(mFiles.size()) - 1;
+  }
+
+  // The returned tile stays valid while it is held, even once evicted. Null
+  // if the file no longer holds the tile.
+  [[nodiscard]] std::shared_ptr<const Tile> fetch(int fileId,
+                                                  size_t tileIndex) {
+    const auto key = (static_cast<std::uint64_t>(fileId) << kFileIdShift) |
+                     static_cast<std::uint64_t>(tileIndex);
+    Shard& shard = mShards[key % kShardCount];
+
+    std::shared_ptr<Slot> slot;
+    {
+      const std::lock_guard lock{shard.mutex};
+      if (auto found = shard.index.find(key); found != shard.index.end()) {
+        ++shard.statistics.hits;
+        shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+        slot = found->second->slot;
+      } else {
+        ++shard.statistics.misses;
+        evictToFit(shard, shardBudget() - kTileBytes);
+        slot = std::make_shared<Slot>();
+        shard.lru.push_front(Entry{key, slot});
+        shard.index[key] = shard.lru.begin();
+        addResident(kTileBytes);
+      }
+    }
+
+    // Read outside the shard lock, so lookups of other tiles go on meanwhile
+    // and threads wanting this tile wait for the one that reads it.
+    std::call_once(slot->loaded, [&] {
+      slot->valid = readTile(fileId, tileIndex, slot->tile);
+    });
+    if (!slot->valid) {
+      return nullptr;
+    }
+    return {slot, &slot->tile};
+  }
+
+  void setBudget(size_t bytes) {
+    mBudgetBytes = std::max(bytes, kTileBytes * kShardCount);
+    for (Shard& shard : mShards) {
+      const std::lock_guard lock{shard.mutex};
+      evictToFit(shard, shardBudget());
+    }
+  }
+
+  [[nodiscard]] Statistics statistics() const {
+    Statistics total;
+    for (const Shard& shard : mShards) {
+      const std::lock_guard lock{shard.mutex};
+      total.hits += shard.statistics.hits;
+      total.misses += shard.statistics.misses;
+      total.evictions += shard.statistics.evictions;
+    }
+    total.residentBytes = mResidentBytes;
+    total.peakResidentBytes = mPeakResidentBytes;
+    return total;
+  }
+
+private:
+  static constexpr int kFileIdShift = 40;
+  static constexpr size_t kDefaultBudgetBytes = size_t{256} << 20U;
+  // Tiles are spread over independently locked shards, each with its own
+  // share of the budget, so render threads rarely wait on each other.
+  static constexpr size_t kShardCount = 16;
+
+  struct Slot {
+    std::once_flag loaded;
+    bool valid{};
+    Tile tile{};
+  };
+
+  struct Entry {
+    std::uint64_t key;
+    std::shared_ptr<Slot> slot;
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::list<Entry> lru;
+    std::unordered_map<std::uint64_t, std::list<Entry>::iterator> index;
+    Statistics statistics;
+  };
+
+  struct File {
+    std::mutex mutex;
+    std::string path;
+    std::ifstream stream;
+    bool reportedShortRead{};
+  };
+
+  TileCache() = default;
+
+  std::array<Shard, kShardCount> mShards;
+  std::mutex mFilesMutex;
+  std::vector<std::unique_ptr<File>> mFiles;
+  std::atomic<size_t> mBudgetBytes{kDefaultBudgetBytes};
+  std::atomic<size_t> mResidentBytes{};
+  std::atomic<size_t> mPeakResidentBytes{};
+
+  [[nodiscard]] size_t shardBudget() const {
+    return mBudgetBytes / kShardCount;
+  }
+
+  void addResident(size_t bytes) {
+    const size_t resident = mResidentBytes += bytes;
+    size_t peak = mPeakResidentBytes;
+    while (peak < resident &&
+           !mPeakResidentBytes.compare_exchange_weak(peak, resident)) {
+    }
+  }
+
+  void evictToFit(Shard& shard, size_t bytes) {
+    while (!shard.lru.empty() && shard.lru.size() * kTileBytes > bytes) {
+      shard.index.erase(shard.lru.back().key);
+      shard.lru.pop_back();
+      mResidentBytes -= kTileBytes;
+      ++shard.statistics.evictions;
+    }
+  }
+
+  bool readTile(int fileId, size_t tileIndex, Tile& tile) {
+    // The header occupies the first tile slot of the file.
+    File* file = nullptr;
+    {
+      const std::lock_guard lock{mFilesMutex};
+      file = mFiles[static_cast<size_t>(fileId)].get();
+    }
+    const std::lock_guard lock{file->mutex};
+    file->stream.clear();
+    file->stream.seekg(
+        static_cast<std::streamoff>((tileIndex + 1) * kTileBytes));
+    file->stream.read(reinterpret_cast<char*>(tile.data()), kTileBytes);
+    if (file->stream.gcount() == static_cast<std::streamsize>(kTileBytes)) {
+      return true;
+    }
+    if (!file->reportedShortRead) {
+      file->reportedShortRead = true;
+      std::cerr << "ERROR: Tile file '" << file->path
+                << "' is truncated; its missing tiles show magenta.\n";
+    }
+    return false;
+  }
+};
@@ -1,9 +1,9 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <numbers>
-#include <random>
 #include <utility>
 
 namespace utils {
@@ -35,10 +35,84 @@ inline T scaleToSymmetricRange(T value) {
   return scaleFactor * value - 1.0; // Maps from [0,1] to [-1,1]
 }
 
+// SplitMix64 (Steele et al.): a single word of state, so reseeding for every
+// pixel costs nothing, and its output passes BigCrush.
+class RandomGenerator {
+public:
+  using result_type = std::uint64_t;
+
+  explicit RandomGenerator(std::uint64_t seed = 0) : mState{seed} {}
+
+  void seed(std::uint64_t seed) { mState = seed; }
+  [[nodiscard]] std::uint64_t state() const { return mState; }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()() {
+    mState += 0x9e3779b97f4a7c15ULL;
+    std::uint64_t z = mState;
+    z = (z ^ (z >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27U)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31U);
+  }
+
+private:
+  std::uint64_t mState;
+};
+
+// One per thread; the camera reseeds it for every pixel, so renders spread
+// over threads stay reproducible.
+inline RandomGenerator& randomGenerator() {
+  thread_local RandomGenerator generator;
+  return generator;
+}
+
+// Restarts the random sequence, e.g. to build a scene reproducibly.
+inline void seedRandom(std::uint64_t seed) { randomGenerator().seed(seed); }
+
+// Supplies randomDouble() and randomPair() in place of the generator, e.g. a
+// low-discrepancy Sampler while the camera traces a sample. Every call takes
+// the next dimension of the current sample.
+class SampleSource {
+public:
+  SampleSource() = default;
+  SampleSource(const SampleSource&) = delete;
+  SampleSource& operator=(const SampleSource&) = delete;
+  virtual ~SampleSource() = default;
+
+  virtual double get1D() = 0;
+  virtual std::pair<double, double> get2D() = 0;
+};
+
+inline SampleSource*& sampleSource() {
+  thread_local constinit SampleSource* source = nullptr;
+  return source;
+}
+
+inline double generatorDouble() {
+  // Returns a random real in [0,1) from the top 53 bits of the generator.
+  constexpr double kScale = 1.0 / static_cast<double>(1ULL << 53U);
+  return static_cast<double>(randomGenerator()() >> 11U) * kScale;
+}
+
 inline double randomDouble() {
-  static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-  static std::mt19937 generator;
-  return distribution(generator);
+  if (auto* source = sampleSource()) {
+    return source->get1D();
+  }
+  return generatorDouble();
+}
+
+// Two values meant to be used together, e.g. to pick a direction, so a
+// sample source can stratify them jointly.
+inline std::pair<double, double> randomPair() {
+  if (auto* source = sampleSource()) {
+    return source->get2D();
+  }
+  const double first = generatorDouble();
+  return {first, generatorDouble()};
 }
 
 inline double randomDouble(double min, double max) {
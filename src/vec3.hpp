@@ -107,23 +107,32 @@ inline Vec3 cross(const Vec3& u, const Vec3& v) {
 
 inline Vec3 unitVector(const Vec3& v) { return v / v.length(); }
 
+// The mappings below turn exactly one randomPair() into a point, rather than
+// rejection sampling, so every sample uses the same dimensions of a Sampler.
+
 inline Vec3 randomUnitVector() {
-  while (true) {
-    auto p = Vec3::random(-1, 1);
-    auto lensq = p.length_squared();
-    if (1e-160 < lensq && lensq <= 1.0) {
-      return p / std::sqrt(lensq);
-    }
-  }
+  // Uniform in z and in the angle around it, which is uniform on the sphere.
+  const auto [r1, r2] = utils::randomPair();
+  const auto z = 1 - 2 * r1;
+  const auto radius = std::sqrt(std::fmax(0.0, 1 - z * z));
+  const auto phi = 2 * utils::PI * r2;
+  return {radius * std::cos(phi), radius * std::sin(phi), z};
 }
 
 inline Vec3 randomInUnitDisk() {
-  while (true) {
-    auto p = Vec3(utils::randomDouble(-1, 1), utils::randomDouble(-1, 1), 0);
-    if (p.length_squared() < 1) {
-      return p;
-    }
+  // Shirley and Chiu's concentric mapping from the square to the disk keeps
+  // stratified points stratified.
+  const auto [r1, r2] = utils::randomPair();
+  const auto x = 2 * r1 - 1;
+  const auto y = 2 * r2 - 1;
+  if (x == 0 && y == 0) {
+    return {0, 0, 0};
   }
+  const bool wide = std::fabs(x) > std::fabs(y);
+  const auto radius = wide ? x : y;
+  const auto phi = wide ? utils::PI / 4 * (y / x)
+                        : utils::PI / 2 - utils::PI / 4 * (x / y);
+  return {radius * std::cos(phi), radius * std::sin(phi), 0};
 }
 
 inline Vec3 randomOnHemisphere(const Vec3& normal) {
@@ -134,6 +143,18 @@ inline Vec3 randomOnHemisphere(const Vec3& normal) {
   return -onUnitSphere;
 }
 
+inline Vec3 randomCosineDirection() {
+  // Returns a direction on the +z hemisphere with density cos(theta) / pi.
+  const auto [r1, r2] = utils::randomPair();
+
+  const auto phi = 2 * utils::PI * r1;
+  const auto x = std::cos(phi) * std::sqrt(r2);
+  const auto y = std::sin(phi) * std::sqrt(r2);
+  const auto z = std::sqrt(1 - r2);
+
+  return {x, y, z};
+}
+
 inline Vec3 reflect(const Vec3& incoming, const Vec3& normal) {
   return incoming - 2 * dot(incoming, normal) * normal;
 }